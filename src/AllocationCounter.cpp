@@ -0,0 +1,60 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+std::atomic<bool> allocationCounter::counting{false};
+std::atomic<long> allocationCounter::count{0};
+
+static void *allocate(std::size_t size) noexcept {
+    if (allocationCounter::counting.load(std::memory_order_relaxed)) {
+        allocationCounter::count.fetch_add(1, std::memory_order_relaxed);
+    }
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+// Every replaceable form that allocates with the default alignment goes through allocate, and every matching form of
+// delete frees with free, so memory is never released by a different allocator than the one it came from
+
+void *operator new(std::size_t size) {
+    void *ptr = allocate(size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](std::size_t size) {
+    void *ptr = allocate(size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
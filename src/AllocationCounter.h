@@ -0,0 +1,16 @@
+#ifndef PERLPARSER_ALLOCATIONCOUNTER_H
+#define PERLPARSER_ALLOCATIONCOUNTER_H
+
+#include <atomic>
+
+/**
+ * Counts heap allocations by replacing the global operator new. Only linked into the PerlParserTests target, which
+ * defines PERLPARSER_ALLOCATION_TEST, so the server binary keeps the standard allocator.
+ */
+namespace allocationCounter {
+    // Allocations are counted while this is set
+    extern std::atomic<bool> counting;
+    extern std::atomic<long> count;
+}
+
+#endif //PERLPARSER_ALLOCATIONCOUNTER_H
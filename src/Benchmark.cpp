@@ -0,0 +1,551 @@
+#include "Benchmark.h"
+
+// Output that is thrown away, for hiding the per file logs of loading. Files are loaded on several threads, so this
+// can't be a stringstream
+struct DiscardBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+// Nanoseconds per call of check over all the literals
+static double timePerLiteral(const std::vector<std::string> &literals, int iterations,
+                             const std::function<bool(std::string_view)> &check) {
+    int matched = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const auto &literal : literals) {
+            if (check(literal)) matched++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Print so the calls can't be optimised away
+    if (matched < 0) std::cout << matched << std::endl;
+    return std::chrono::duration<double, std::nano>(end - begin).count() / ((double) iterations * literals.size());
+}
+
+static void benchmarkNumericLiterals() {
+    // Roughly the mix found in data tables and generated config modules, plus some strings that are rejected
+    std::vector<std::string> numeric{"0", "1", "42", "-1", "+7", "3.14159", "1_000_000", "0xFF", "0xdeadBEEF",
+                                     "0b1011", "1e10", "2.5e-3", "6.02e+23", "20200612", "5.036000", "1.", "_",
+                                     "12abc", "0x", "1e", "1.2.3"};
+    std::vector<std::string> versions{"v5", "v5.36.0", "5.036", "1_001", "v1.2.3.4", "5.", "v", "1..2"};
+    int iterations = 20000;
+
+    auto regexNumeric = timePerLiteral(numeric, iterations, regexIsNumericLiteral);
+    auto scannerNumeric = timePerLiteral(numeric, iterations, isNumericLiteral);
+    auto regexVersion = timePerLiteral(versions, iterations, regexIsVersionString);
+    auto scannerVersion = timePerLiteral(versions, iterations, isVersionString);
+
+    std::cout << "numeric: regex " << regexNumeric << " ns/literal, scanner " << scannerNumeric
+              << " ns/literal (" << regexNumeric / scannerNumeric << "x)" << std::endl;
+    std::cout << "version: regex " << regexVersion << " ns/literal, scanner " << scannerVersion
+              << " ns/literal (" << regexVersion / scannerVersion << "x)" << std::endl;
+}
+
+// Tokenise each file with every scan implementation the CPU supports
+static void benchmarkTokenise(const std::vector<std::string> &paths) {
+    int iterations = 20;
+    for (const auto &path : paths) {
+        std::string program;
+        try {
+            program = readFile(path);
+        } catch (IOException &) {
+            std::cerr << "Failed to read " << path << std::endl;
+            continue;
+        }
+
+        std::cout << path << std::endl;
+        for (auto implementation : {scan::Implementation::Scalar, scan::Implementation::SSE2,
+                                    scan::Implementation::AVX2}) {
+            if (!scan::setImplementation(implementation)) continue;
+            auto begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; i++) {
+                Tokeniser tokeniser(program);
+                tokeniser.tokenise();
+            }
+            auto end = std::chrono::steady_clock::now();
+            std::cout << "\t" << scan::implementationName(implementation) << ": "
+                      << std::chrono::duration<double, std::milli>(end - begin).count() / iterations << " ms"
+                      << std::endl;
+        }
+    }
+
+    scan::setImplementation(scan::bestImplementation());
+}
+
+// Type a character in the middle of each file, comparing full and incremental tokenisation of the edited file
+static void benchmarkIncremental(const std::vector<std::string> &paths) {
+    int iterations = 20;
+    for (const auto &path : paths) {
+        std::string program;
+        try {
+            program = readFile(path);
+        } catch (IOException &) {
+            std::cerr << "Failed to read " << path << std::endl;
+            continue;
+        }
+
+        // Start of the middle line, so the edit is in code rather than half way through a token
+        auto middle = program.find('\n', program.size() / 2);
+        TextEdit edit(middle == std::string::npos ? program.size() : middle + 1, 0, "x");
+        std::string edited = program;
+        edited.insert(edit.position, edit.replacement);
+
+        Tokeniser previousTokeniser(program);
+        auto previousTokens = previousTokeniser.tokenise();
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            Tokeniser tokeniser(edited);
+            tokeniser.tokenise();
+        }
+        auto full = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            Tokeniser tokeniser(edited);
+            tokeniser.tokenise(previousTokens, *previousTokeniser.getSource(), edit);
+        }
+        auto incremental = std::chrono::steady_clock::now();
+
+        auto fullMs = std::chrono::duration<double, std::milli>(full - begin).count() / iterations;
+        auto incrementalMs = std::chrono::duration<double, std::milli>(incremental - full).count() / iterations;
+        std::cout << path << " (" << previousTokens.size() << " tokens): full " << fullMs << " ms, incremental "
+                  << incrementalMs << " ms (" << fullMs / incrementalMs << "x)" << std::endl;
+    }
+}
+
+// Program with very long lines (data tables, minified code) and lots of heredocs, which newline handling has to cope with
+static std::string heredocStressProgram() {
+    std::string program = "my %table = (";
+    for (int i = 0; i < 200000; i++) program += "key" + std::to_string(i) + " => [" + std::to_string(i) + ", 'v'], ";
+    program += ");\n";
+
+    for (int i = 0; i < 20000; i++) {
+        program += "print <<EOF . $x{a} . \"tail\";\nbody " + std::to_string(i) + "\nEOF\n";
+    }
+
+    std::string line = "$x = 1 << 2; ";
+    for (int i = 0; i < 2000; i++) {
+        for (int j = 0; j < 50; j++) program += line;
+        program += "\n";
+    }
+
+    return program;
+}
+
+static void benchmarkHeredocs() {
+    int iterations = 5;
+    auto program = heredocStressProgram();
+    std::cout << "heredoc stress program: " << program.size() << " bytes" << std::endl;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        Tokeniser tokeniser(program);
+        tokeniser.tokenise();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "\ttokenise: " << std::chrono::duration<double, std::milli>(end - begin).count() / iterations
+              << " ms" << std::endl;
+}
+
+// Tokenise every perl file under the given directories, with a new tokeniser per file and then with the pool
+static void benchmarkPool(const std::vector<std::string> &directories) {
+    std::vector<std::string> programs;
+    for (const auto &directory : directories) {
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(directory)) {
+            auto extension = entry.path().extension();
+            if (!entry.is_regular_file() || (extension != ".pm" && extension != ".pl" && extension != ".t")) continue;
+            try {
+                programs.emplace_back(readFile(entry.path().string()));
+            } catch (IOException &) {
+                std::cerr << "Failed to read " << entry.path() << std::endl;
+            }
+        }
+    }
+
+    std::cout << programs.size() << " files" << std::endl;
+    int iterations = 5;
+    size_t numTokens = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const auto &program : programs) {
+            Tokeniser tokeniser(program);
+            numTokens += tokeniser.tokenise().size();
+        }
+    }
+    auto fresh = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const auto &program : programs) {
+            auto pooled = tokeniserPool::acquire(program);
+            pooled->tokeniser.tokenise(pooled->tokens);
+            numTokens += pooled->tokens.size();
+        }
+    }
+    auto pooled = std::chrono::steady_clock::now();
+
+    if (numTokens == 0) std::cout << "No tokens" << std::endl;
+    auto freshMs = std::chrono::duration<double, std::milli>(fresh - begin).count() / iterations;
+    auto pooledMs = std::chrono::duration<double, std::milli>(pooled - fresh).count() / iterations;
+    std::cout << "\tnew tokeniser per file: " << freshMs << " ms" << std::endl;
+    std::cout << "\tpooled: " << pooledMs << " ms (" << freshMs / pooledMs << "x)" << std::endl;
+}
+
+// Long flat script with thousands of lexicals at the top level, which every usage further down has to be resolved against
+static std::string lexicalStressProgram() {
+    int numLexicals = 5000;
+    std::string program;
+    for (int i = 0; i < numLexicals; i++) {
+        program += "my $v" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+    }
+
+    for (int i = 0; i < 5000; i++) {
+        auto v = [&](int n) { return "$v" + std::to_string(n % numLexicals); };
+        program += "sub f" + std::to_string(i) + " {\n";
+        program += "    my " + v(i) + " = " + v(i + 1) + " + 1;\n";
+        program += "    for my $j (1..10) {\n";
+        program += "        my @list = (" + v(i) + ", $j);\n";
+        program += "        $total += $list[0] + " + v(i * 7) + ";\n";
+        program += "    }\n";
+        program += "    return " + v(i) + ";\n";
+        program += "}\n";
+        program += "f" + std::to_string(i) + "();\n";
+    }
+
+    return program;
+}
+
+static void benchmarkScopes() {
+    int iterations = 10;
+    auto program = lexicalStressProgram();
+    Tokeniser tokeniser(program);
+    std::vector<Token> tokens;
+    TriviaTable trivia;
+    tokeniser.tokenise(tokens, trivia);
+    int partial = -1;
+    auto tree = buildParseTree(tokens, partial);
+    std::cout << "lexical stress program: " << LineIndex(program).numLines() << " lines, " << tokens.size()
+              << " tokens" << std::endl;
+
+    size_t numUsages = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        FileSymbols fileSymbols;
+        parseFileSymbols(tree, fileSymbols);
+        for (const auto &variable : fileSymbols.variableUsages) numUsages += variable.second.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "\t" << numUsages / iterations << " variable usages" << std::endl;
+    std::cout << "\tanalysis: " << std::chrono::duration<double, std::milli>(end - begin).count() / iterations
+              << " ms" << std::endl;
+}
+
+// Generated module with hundreds of top level subs, like the large ones parallel analysis is for
+static std::string generatedModuleProgram() {
+    std::string program = "package Generated::Module;\nuse strict;\nour $VERSION = '1.0';\nmy %registry;\n\n";
+    for (int i = 0; i < 2000; i++) {
+        auto n = std::to_string(i);
+        program += "sub handler_" + n + " {\n";
+        program += "    my ($self, %args) = @_;\n";
+        program += "    my @rows = map { $_ * " + n + " } @{$args{rows}};\n";
+        program += "    for my $row (@rows) {\n";
+        program += "        if ($row > $self->{limit}) {\n";
+        program += "            $registry{" + n + "} += $row;\n";
+        program += "            handler_" + std::to_string((i + 1) % 2000) + "($self, rows => [$row]);\n";
+        program += "        }\n";
+        program += "    }\n";
+        program += "    $Generated::Module::count++;\n";
+        program += "    return scalar @rows;\n";
+        program += "}\n\n";
+    }
+
+    return program;
+}
+
+static void benchmarkParallel() {
+    int iterations = 10;
+    auto program = generatedModuleProgram();
+    Tokeniser tokeniser(program);
+    std::vector<Token> tokens;
+    TriviaTable trivia;
+    tokeniser.tokenise(tokens, trivia);
+    int partial = -1;
+    auto tree = buildParseTree(tokens, partial);
+    std::cout << "generated module: " << LineIndex(program).numLines() << " lines, " << tokens.size()
+              << " tokens, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    double singleMs = 0;
+    for (int threads : {1, 2, 4, 8, 12, 16}) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            FileSymbols fileSymbols;
+            parseFileSymbols(tree, fileSymbols, threads);
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - begin).count() / iterations;
+        if (threads == 1) singleMs = ms;
+        std::cout << "\t" << threads << " threads: " << ms << " ms (" << singleMs / ms << "x)" << std::endl;
+    }
+}
+
+static void benchmarkGraph(const std::vector<std::string> &directories) {
+    std::vector<std::string> projectFiles;
+    for (const auto &directory : directories) {
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(directory)) {
+            auto extension = entry.path().extension();
+            if (!entry.is_regular_file() || (extension != ".pm" && extension != ".pl")) continue;
+            projectFiles.emplace_back(entry.path().string());
+        }
+    }
+
+    std::cout << projectFiles.size() << " project files, " << std::thread::hardware_concurrency()
+              << " hardware threads" << std::endl;
+
+    // Loading logs every file, which would drown out the results
+    DiscardBuffer discarded;
+    double singleMs = 0;
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+        Cache cache;
+        auto original = std::cout.rdbuf(&discarded);
+        auto begin = std::chrono::steady_clock::now();
+        auto graph = loadProjectGraph(projectFiles, directories, cache, threads);
+        auto end = std::chrono::steady_clock::now();
+        std::cout.rdbuf(original);
+
+        double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+        if (threads == 1) singleMs = ms;
+        std::cout << "\t" << threads << " threads: " << graph.size() << " files in " << ms << " ms ("
+                  << singleMs / ms << "x)" << std::endl;
+    }
+}
+
+// Synthetic project of separate areas, where each module imports a few others from the same area
+static std::unordered_map<std::string, PathNode> generatedImportGraph(int modules, int areaSize) {
+    std::mt19937 random(20200709);
+    auto modulePath = [&](int module) {
+        return "/project/lib/Area" + std::to_string(module / areaSize) + "/Module" + std::to_string(module) + ".pm";
+    };
+
+    std::unordered_map<std::string, PathNode> graph;
+    for (int module = 0; module < modules; module++) {
+        auto path = modulePath(module);
+        int areaStart = module - module % areaSize;
+        int areaEnd = std::min(modules, areaStart + areaSize);
+        for (int i = 0; i < 3; i++) {
+            auto importedPath = modulePath(areaStart + (int) (random() % (areaEnd - areaStart)));
+            graph[path].children.insert(importedPath);
+            graph[importedPath].parents.insert(path);
+        }
+    }
+
+    return graph;
+}
+
+static void benchmarkReachability() {
+    int queries = 100;
+    auto graph = generatedImportGraph(50000, 500);
+
+    auto begin = std::chrono::steady_clock::now();
+    ImportGraph importGraph(graph);
+    auto built = std::chrono::steady_clock::now();
+    size_t connected = 0;
+    size_t descendents = 0;
+    for (int i = 0; i < queries; i++) {
+        int file = i * (importGraph.size() / queries);
+        connected += importGraph.connectedTo(file).size();
+        descendents += importGraph.descendentsOf(file).size();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::cout << importGraph.size() << " files, " << connected / queries << " connected and " << descendents / queries
+              << " descendents per file" << std::endl;
+    std::cout << "\tbuild: " << std::chrono::duration<double, std::milli>(built - begin).count() << " ms" << std::endl;
+    double queryUs = std::chrono::duration<double, std::micro>(end - built).count() / queries;
+    std::cout << "\tquery: " << queryUs << " us for both searches, "
+              << queryUs * 1000 * queries / (double) (connected + descendents) << " ns per file found" << std::endl;
+}
+
+// Files a query loads, and how long it takes once they are all cached
+static void printQuery(const std::string &name, size_t files, size_t connected, const std::function<void()> &query) {
+    int iterations = 5;
+    DiscardBuffer discarded;
+    auto original = std::cout.rdbuf(&discarded);
+    query();
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) query();
+    auto end = std::chrono::steady_clock::now();
+    std::cout.rdbuf(original);
+
+    std::cout << "\t" << name << ": " << files << " of " << connected << " connected files, "
+              << std::chrono::duration<double, std::milli>(end - begin).count() / iterations << " ms" << std::endl;
+}
+
+// Project where every module uses a shared Util.pm, and imports the previous module in its own area
+static void benchmarkQueryScope() {
+    int areas = 20;
+    int modulesPerArea = 25;
+    auto directory = std::filesystem::temp_directory_path() / "perlparser-scope-benchmark";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    auto utilPath = (directory / "Util.pm").string();
+    std::ofstream(utilPath) << "package Util;\n\nsub helper {\n    return 1;\n}\n\n1;\n";
+    std::vector<std::string> projectFiles{utilPath};
+    for (int area = 0; area < areas; area++) {
+        std::filesystem::create_directories(directory / ("Area" + std::to_string(area)));
+        for (int module = 0; module < modulesPerArea; module++) {
+            auto package = "Area" + std::to_string(area) + "::Module" + std::to_string(module);
+            auto path = (directory / ("Area" + std::to_string(area)) / ("Module" + std::to_string(module) + ".pm"));
+            std::ofstream file(path.string());
+            file << "package " << package << ";\nuse Util;\n";
+            if (module > 0) file << "use Area" << area << "::Module" << module - 1 << ";\n";
+            file << "\nsub run" << module << " {\n    my $value = Util::helper();\n";
+            if (module > 0) file << "    Area" << area << "::Module" << module - 1 << "::run" << module - 1 << "();\n";
+            file << "    return $value;\n}\n\n1;\n";
+            projectFiles.emplace_back(path.string());
+        }
+    }
+
+    // Module in the middle of the first area, so it has files on both sides
+    int middle = modulesPerArea / 2;
+    auto spokePath = (directory / "Area0" / ("Module" + std::to_string(middle) + ".pm")).string();
+    auto spokeSub = analysis::getFileSymbols(spokePath).subroutineDeclarations.begin()->second->location.from;
+    auto helper = analysis::getFileSymbols(utilPath).subroutineDeclarations.begin()->second->location.from;
+    auto spokeCursor = LineIndex(readFile(spokePath)).filePos(6, 10);
+
+    // Modules are found through @INC, as in a real project
+    setenv("PERL5LIB", directory.c_str(), 1);
+    Cache cache;
+    ProjectGraph projectGraph;
+    DiscardBuffer discarded;
+    auto original = std::cout.rdbuf(&discarded);
+    projectGraph.update(projectFiles, getIncludePaths(directoryOf(spokePath)), cache);
+    std::cout.rdbuf(original);
+    auto connected = relatedFiles(spokePath, projectGraph.nodes()).size();
+
+    std::cout << projectFiles.size() << " files, " << areas << " areas of " << modulesPerArea
+              << " modules using Util.pm" << std::endl;
+    printQuery("autocomplete-sub", projectGraph.importsOf(spokePath).size(), connected, [&] {
+        analysis::autocompleteSubs(spokePath, spokePath, spokeCursor, projectFiles, cache, projectGraph);
+    });
+    printQuery("find-usages of module sub", projectGraph.importersOf({spokePath}).size(), connected, [&] {
+        analysis::findUsages(spokePath, spokePath, spokeSub, projectFiles, cache, projectGraph);
+    });
+    printQuery("find-usages of Util sub", projectGraph.importersOf({utilPath}).size(), connected, [&] {
+        analysis::findUsages(utilPath, utilPath, helper, projectFiles, cache, projectGraph);
+    });
+
+    std::filesystem::remove_all(directory);
+}
+
+static void benchmarkIncludes(const std::vector<std::string> &paths) {
+    auto begin = std::chrono::steady_clock::now();
+    auto includes = getIncludePaths(".");
+    auto firstIncludes = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++) includes = getIncludePaths(".");
+    auto cachedIncludes = std::chrono::steady_clock::now();
+    std::cout << includes.size() << " include paths: first "
+              << std::chrono::duration<double, std::milli>(firstIncludes - begin).count() << " ms, then "
+              << std::chrono::duration<double, std::micro>(cachedIncludes - firstIncludes).count() / 100 << " us"
+              << std::endl;
+
+    std::vector<std::string> modules;
+    for (const auto &path : paths) {
+        for (const auto &import : analysis::getFileSymbols(path).imports) {
+            if (import.type != ImportType::Module) continue;
+            modules.emplace_back(join(splitPackage(import.data), "/") + ".pm");
+        }
+    }
+
+    // How every lookup used to be done
+    auto openEach = [&](const std::string &module) -> std::optional<std::string> {
+        for (const auto &includePath : includes) {
+            auto fullPath = includePath + "/" + module;
+            if (std::ifstream(fullPath).good()) return fullPath;
+        }
+        return std::nullopt;
+    };
+
+    int iterations = 20;
+    int found = 0;
+    int differences = 0;
+    for (const auto &module : modules) {
+        auto resolved = resolvePath(includes, module);
+        if (resolved.has_value()) found++;
+        if (resolved != openEach(module)) differences++;
+    }
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const auto &module : modules) openEach(module);
+    }
+    auto opened = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const auto &module : modules) resolvePath(includes, module);
+    }
+    auto indexed = std::chrono::steady_clock::now();
+
+    double openUs = std::chrono::duration<double, std::micro>(opened - begin).count() / iterations / modules.size();
+    double indexUs = std::chrono::duration<double, std::micro>(indexed - opened).count() / iterations / modules.size();
+    std::cout << modules.size() << " imported modules, " << found << " found, " << differences << " differences"
+              << std::endl;
+    std::cout << "\topening each: " << openUs << " us/module, index: " << indexUs << " us/module (" << openUs / indexUs
+              << "x)" << std::endl;
+}
+
+bool runBenchmark(const std::string &name, const std::vector<std::string> &args) {
+    if (name == "numeric") {
+        benchmarkNumericLiterals();
+        return true;
+    }
+
+    if (name == "tokenise") {
+        benchmarkTokenise(args);
+        return true;
+    }
+
+    if (name == "heredoc") {
+        benchmarkHeredocs();
+        return true;
+    }
+
+    if (name == "pool") {
+        benchmarkPool(args);
+        return true;
+    }
+
+    if (name == "scopes") {
+        benchmarkScopes();
+        return true;
+    }
+
+    if (name == "parallel") {
+        benchmarkParallel();
+        return true;
+    }
+
+    if (name == "reachability") {
+        benchmarkReachability();
+        return true;
+    }
+
+    if (name == "includes") {
+        benchmarkIncludes(args);
+        return true;
+    }
+
+    if (name == "scope") {
+        benchmarkQueryScope();
+        return true;
+    }
+
+    if (name == "graph") {
+        benchmarkGraph(args);
+        return true;
+    }
+
+    if (name == "incremental") {
+        benchmarkIncremental(args);
+        return true;
+    }
+
+    return false;
+}
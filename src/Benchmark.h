@@ -0,0 +1,21 @@
+#ifndef PERLPARSER_BENCHMARK_H
+#define PERLPARSER_BENCHMARK_H
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Tokeniser.h"
+#include "LineIndex.h"
+#include "Parser.h"
+#include "SymbolLoader.h"
+#include "Test.h"
+#include "Scan.h"
+#include "IOException.h"
+
+// Run micro benchmark with given name, returns false if there is no benchmark with that name
+bool runBenchmark(const std::string &name, const std::vector<std::string> &args);
+
+#endif //PERLPARSER_BENCHMARK_H
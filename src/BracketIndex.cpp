@@ -0,0 +1,49 @@
+#include "BracketIndex.h"
+
+BracketIndex::BracketIndex(const std::vector<Token> &tokens) {
+    this->pairOf.resize(tokens.size(), -1);
+
+    int current = -1;
+    for (int i = 0; i < (int) tokens.size(); i++) {
+        auto type = tokens[i].type;
+        if (type == TokenType::LBracket) {
+            this->brackets.emplace_back(i);
+            this->parent.emplace_back(current);
+            this->depth.emplace_back(current == -1 ? 0 : this->depth[current] + 1);
+            this->open.emplace_back(i);
+            this->close.emplace_back(-1);
+            current = this->open.size() - 1;
+            this->pairOf[i] = current;
+        } else if (type == TokenType::RBracket) {
+            this->brackets.emplace_back(i);
+            this->pairOf[i] = current;
+            if (current != -1) {
+                this->close[current] = i;
+                current = this->parent[current];
+            }
+        } else {
+            this->pairOf[i] = current;
+        }
+    }
+}
+
+int BracketIndex::numPairs() const {
+    return this->open.size();
+}
+
+int BracketIndex::matching(int tokenIdx) const {
+    int pair = this->pairOf[tokenIdx];
+    if (pair == -1) return -1;
+    if (this->open[pair] == tokenIdx) return this->close[pair];
+    if (this->close[pair] == tokenIdx) return this->open[pair];
+    return -1;
+}
+
+int BracketIndex::enclosingPair(int tokenIdx) const {
+    return this->pairOf[tokenIdx];
+}
+
+bool BracketIndex::isClose(int tokenIdx) const {
+    int pair = this->pairOf[tokenIdx];
+    return pair != -1 && this->close[pair] == tokenIdx;
+}
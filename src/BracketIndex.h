@@ -0,0 +1,48 @@
+#ifndef PERLPARSER_BRACKETINDEX_H
+#define PERLPARSER_BRACKETINDEX_H
+
+#include <vector>
+
+#include "Token.h"
+
+/**
+ * Where every block bracket ('{' and '}', LBracket and RBracket tokens) of a token vector is, built in one pass. Each
+ * bracket pair has an entry in the parallel pair arrays, in the order of its opening bracket, so the block structure
+ * can be looked up without walking the tokens again.
+ */
+class BracketIndex {
+public:
+    BracketIndex() = default;
+
+    explicit BracketIndex(const std::vector<Token> &tokens);
+
+    // Token index of every bracket in order, matched or not
+    std::vector<int> brackets;
+
+    // Token index of the '{' of each pair
+    std::vector<int> open;
+    // Token index of the matching '}' of each pair, or -1 if it was never closed
+    std::vector<int> close;
+    // Number of pairs the pair is inside
+    std::vector<int> depth;
+    // Pair this pair is inside, or -1 if it's at the top level
+    std::vector<int> parent;
+
+    int numPairs() const;
+
+    // Token index of the bracket matching the bracket at tokenIdx, or -1 if it doesn't have one
+    int matching(int tokenIdx) const;
+
+    // Innermost pair containing the token (a bracket is part of the pair it opens or closes), or -1 for top level
+    int enclosingPair(int tokenIdx) const;
+
+    // Whether the bracket at tokenIdx closes a pair (rather than being an unmatched '}')
+    bool isClose(int tokenIdx) const;
+
+private:
+    // Innermost pair of each token
+    std::vector<int> pairOf;
+};
+
+
+#endif //PERLPARSER_BRACKETINDEX_H
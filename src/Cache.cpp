@@ -37,27 +37,38 @@ std::string generateMd5Sum(const std::string &path) {
 }
 
 void Cache::addItem(std::string path, std::shared_ptr<FileSymbols> fileSymbols) {
-    this->evictItems();
     CacheItem cacheItem(isSystemPath(path), generateMd5Sum(path), fileSymbols);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->evictItems();
     this->cache[path] = cacheItem;
 }
 
 std::optional<std::shared_ptr<FileSymbols>> Cache::getItem(std::string path) {
-    if (this->cache.count(path) == 0) {
-        return {};
+    CacheItem cacheItem;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto item = this->cache.find(path);
+        if (item == this->cache.end()) {
+            return {};
+        }
+
+        item->second.markJustUsed();
+        cacheItem = item->second;
     }
 
-    auto cacheItem = this->cache[path];
     if (!cacheItem.isSystemPath && generateMd5Sum(path) != cacheItem.md5) {
-        this->cache.erase(path);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        // Only if another thread hasn't already replaced it
+        auto item = this->cache.find(path);
+        if (item != this->cache.end() && item->second.md5 == cacheItem.md5) this->cache.erase(item);
         return {};
     }
 
-    cacheItem.markJustUsed();
     return cacheItem.fileSymbols;
 }
 
 std::string Cache::toStr() {
+    std::lock_guard<std::mutex> lock(this->mutex);
     std::string str = "";
     for (auto pathCacheItem : this->cache) {
         str += "system=" + std::to_string(pathCacheItem.second.isSystemPath) + " ";
@@ -69,6 +80,7 @@ std::string Cache::toStr() {
     return str;
 }
 
+// Called with the mutex held
 void Cache::evictItems() {
     // Evict 10% of the cache size ONLY IF it is full
     int overflow = (int) this->cache.size() - constant::CACHE_MAX_ITEMS;
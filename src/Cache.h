@@ -8,6 +8,7 @@
 #include <string>
 #include <unordered_map>
 #include <chrono>
+#include <mutex>
 #include "Util.h"
 #include "Symbols.h"
 #include "Constants.h"
@@ -42,9 +43,13 @@ struct CacheItem {
 };
 
 
+// Safe to use from several threads at once
 class Cache {
     std::unordered_map<std::string, CacheItem> cache;
 
+    // Guards cache. Not held while hashing files, which is most of the time spent in here
+    std::mutex mutex;
+
     void evictItems();
 
 public:
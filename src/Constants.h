@@ -9,80 +9,16 @@
 #include <vector>
 
 namespace constant {
-    const std::vector<std::string> SPECIAL_SCALARS = std::vector<std::string>{"$_", "$ARG", "$.", "$NR", "$/", "$RS",
-                                                                              "$,",
-                                                                              "$OFS", "$\\",
-                                                                              "$ORS", "$\"", "$LIST_SEPARATOR", "$;",
-                                                                              "$SUBSCRIPT_SEPARATOR", "$^L",
-                                                                              "$FORMAT_FORMFEED", "$:",
-                                                                              "$FORMAT_LINE_BREAK_CHARACTERS", "$^A",
-                                                                              "$ACCUMULATOR", "$#",
-                                                                              "$OFMT", "$?", "$CHILD_ERROR", "$!",
-                                                                              "$OS_ERROR", "$@",
-                                                                              "$EVAL_ERROR", "$$", "$PROCESS_ID", "$<",
-                                                                              "$REAL_USER_ID",
-                                                                              "$>", "$EFFECTIVE_USER_ID", "$(",
-                                                                              "$REAL_GROUP_ID", "$)",
-                                                                              "$EFFECTIVE_GROUP_ID", "$0",
-                                                                              "$PROGRAM_NAME",
-                                                                              "$[", "$]",
-                                                                              "$PERL_VERSION", "$^D", "$DEBUGGING",
-                                                                              "$^E",
-                                                                              "$EXTENDED_OS_ERROR", "$^F",
-                                                                              "$SYSTEM_FD_MAX",
-                                                                              "$^H", "$^I",
-                                                                              "$INPLACE_EDIT", "$^M", "$^O", "$OSNAME",
-                                                                              "$^P",
-                                                                              "$PERLDB",
-                                                                              "$^T", "$BASETIME", "$^W", "$WARNING",
-                                                                              "$^X",
-                                                                              "$EXECUTABLE_NAME", "$ARGV", "$INC",
-                                                                              "$ENV",
-                                                                              "$SIG",
-                                                                              "$&", "$MATCH", "$`", "$PREMATCH", "$'",
-                                                                              "$POSTMATCH", "$+",
-                                                                              "$LAST_PAREN_MATCH", "$|",
-                                                                              "$OUTPUT_AUTOFLUSH",
-                                                                              "$%",
-                                                                              "$FORMAT_PAGE_NUMBER", "$=",
-                                                                              "$FORMAT_LINES_PER_PAGE", "$-",
-                                                                              "$FORMAT_LINES_LEFT", "$~",
-                                                                              "$FORMAT_NAME",
-                                                                              "$^",
-                                                                              "$FORMAT_TOP_NAME"
-    };
+    const int CACHE_MAX_ITEMS = 1000;
 
-    const std::vector<std::string> SPECIAL_ARRAYS = std::vector<std::string>{"@ARGV", "@INC", "@F", "@ENV", "@ENV",
-                                                                             "@SIG",
-                                                                             "@_"};
+    // Files with fewer tokens than this are analysed on a single thread, as starting threads would cost more than it saves
+    const int PARALLEL_ANALYSIS_MIN_TOKENS = 50000;
 
-    const std::vector<std::string> SPECIAL_HASHES = std::vector<std::string>{"%INC", "%ENV", "%SIG"};
-    const std::vector<std::string> PRAGMATIC_MODULES = std::vector<std::string>{"attributes", "autodie",
-                                                                                "autodie::exception",
-                                                                                "autodie::exception::system",
-                                                                                "autodie::hints",
-                                                                                "autodie::skip", "autouse", "base",
-                                                                                "bigint",
-                                                                                "bignum", "bigrat", "blib", "bytes",
-                                                                                "charnames",
-                                                                                "constant", "deprecate", "diagnostics",
-                                                                                "encoding", "encoding::warnings",
-                                                                                "experimental",
-                                                                                "feature", "fields", "filetest", "if",
-                                                                                "integer",
-                                                                                "less", "lib", "locale", "mro", "ok",
-                                                                                "open",
-                                                                                "ops", "overload", "overloading",
-                                                                                "parent",
-                                                                                "re",
-                                                                                "sigtrapsort", "strict", "subs",
-                                                                                "threads",
-                                                                                "threads::shared", "utf8", "vars",
-                                                                                "version",
-                                                                                "vmsish", "warnings",
-                                                                                "warnings::register"};
+    // Most threads to analyse a single file on
+    const int PARALLEL_ANALYSIS_MAX_THREADS = 16;
 
-    const int CACHE_MAX_ITEMS = 1000;
+    // How long an include directory's listing is used before checking whether the directory has changed
+    const int INCLUDE_INDEX_RECHECK_MS = 1000;
 }
 
 #endif //PERLPARSE_CONSTANTS_H
@@ -6,31 +6,44 @@
 
 FileSymbols analysis::getFileSymbols(const std::string &path) {
     auto program = readFile(path);
-    Tokeniser tokeniser(program);
-    std::vector<Token> tokens = tokeniser.tokenise();
+    auto pooled = tokeniserPool::acquire(program);
+    // Analysis doesn't need whitespace or comments, so keep them out of the way
+    pooled->tokeniser.tokenise(pooled->tokens, pooled->trivia);
     FileSymbols fileSymbols;
 
     int partial = -1;
-    auto parseTree = buildParseTree(tokens, partial);
-    fileSymbols.packages = parsePackages(parseTree);
-    parseFirstPass(parseTree, fileSymbols);
-    buildVariableSymbolTree(parseTree, fileSymbols);
+    auto parseTree = buildParseTree(pooled->tokens, partial);
+    parseFileSymbols(parseTree, fileSymbols);
+    // From the text the tokeniser holds, so positions can be converted later without reading the file again
+    auto source = pooled->tokeniser.getSource();
+    fileSymbols.lines = std::make_shared<LineIndex>(Tokeniser::withoutByteOrderMark(source->text));
     return fileSymbols;
 }
 
+std::shared_ptr<const LineIndex> analysis::getLineIndex(const std::string &path, Cache &cache) {
+    auto cached = cache.getItem(path);
+    if (cached.has_value() && cached.value()->lines != nullptr) return cached.value()->lines;
+
+    auto fileSymbols = std::make_shared<FileSymbols>(getFileSymbols(path));
+    cache.addItem(path, fileSymbols);
+    return fileSymbols->lines;
+}
+
 std::vector<AutocompleteItem>
 analysis::autocompleteVariables(const std::string &filePath, const std::string &contextPath, FilePos location,
-                                std::vector<std::string> projectFiles, char sigilContext, Cache &cache) {
+                                std::vector<std::string> projectFiles, char sigilContext, Cache &cache,
+                                ProjectGraph &projectGraph) {
     std::vector<AutocompleteItem> completions;
-    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, projectFiles, cache, true, false, false);
+    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, projectFiles, cache, projectGraph, true, false,
+                                            false);
     if (!symbolsMaybe.has_value()) {
         return completions;
     }
 
     Symbols symbols = symbolsMaybe.value();
 
-    // Symbol map contains all lexically scoped variables
-    SymbolMap symbolMap = getSymbolMap(symbols.rootFileSymbols, location);
+    // All lexically scoped variables, sorted by name
+    auto visibleVariables = getVisibleVariables(symbols.rootFileSymbols, location);
 
     // Get package - so if we are in a global's package, we can suggest it's short name providing there are no
     // conflicts with lexically scoped variables
@@ -38,7 +51,7 @@ analysis::autocompleteVariables(const std::string &filePath, const std::string &
     for (auto globalItem : symbols.globalVariablesMap.globalsMap) {
         GlobalVariable global = globalItem.first;
         if (global.getPackage() == currentPackage) {
-            if (symbolMap.count(global.getSigil() + global.getName()) == 0) {
+            if (findVisibleVariable(visibleVariables, global.getSigil() + global.getName()) == nullptr) {
                 auto variableName = variableForCompletion(global.getSigil() + global.getName(),
                                                           sigilContext);
                 if (!variableName.empty()) {
@@ -59,8 +72,8 @@ analysis::autocompleteVariables(const std::string &filePath, const std::string &
     }
 
     // Now add lexical variables
-    for (const auto &symbolVal : symbolMap) {
-        auto variableName = variableForCompletion(symbolVal.first, sigilContext);
+    for (const auto &variable : visibleVariables) {
+        auto variableName = variableForCompletion(variable->name, sigilContext);
         if (!variableName.empty()) {
             completions.emplace_back(AutocompleteItem(variableName, ""));
         }
@@ -71,9 +84,10 @@ analysis::autocompleteVariables(const std::string &filePath, const std::string &
 
 std::vector<AutocompleteItem>
 analysis::autocompleteSubs(const std::string &filePath, const std::string &contextPath, FilePos location,
-                           std::vector<std::string> projectFiles, Cache &cache) {
+                           std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph) {
     std::vector<AutocompleteItem> completions;
-    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, projectFiles, cache, false, true, false);
+    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, projectFiles, cache, projectGraph, false, true,
+                                            false);
     if (!symbolsMaybe.has_value()) {
         return completions;
     }
@@ -98,35 +112,17 @@ analysis::findGlobalVariable(const std::string &filePath, const std::string &con
                              Symbols &symbols) {
     // Not a local, now check for global variable and get usages
     // Will include multiple files
-    auto globals = symbols.globalVariablesMap.globalsMap;
-
-    for (auto globalWithFiles : globals) {
-        GlobalVariable globalVariable = globalWithFiles.first;
-        // This global doesn't appear in the current file, so skip
-        if (globalWithFiles.second.count(contextPath) == 0) {
-            continue;
-        }
-
-        // Now check every usage to see if location is within usage
-        for (GlobalVariable &usage : globalWithFiles.second[contextPath]) {
-            if (insideRange(usage.getLocation(), location)) {
-                // We've found a global
-                return globalVariable;
-            }
-        }
-    }
-
-    return {};
+    return symbols.rootFileIndex.globalAt(location);
 }
 
 
 optional<vector<Range>>
 analysis::findLocalVariableUsages(const std::string &filePath, const std::string &contextPath, FilePos location,
                                   Symbols &symbols) {
-    auto maybeVariable = findVariableAtLocation(symbols.rootFileSymbols, location);
-    if (maybeVariable.has_value()) {
+    auto variable = symbols.rootFileIndex.variableAt(location);
+    if (variable != nullptr) {
         // Was a local variable
-        return maybeVariable.value().usages;
+        return symbols.rootFileSymbols.variableUsages[variable];
     }
 
     return {};
@@ -167,43 +163,18 @@ analysis::findVariableUsages(const std::string &filePath, const std::string &con
 
 std::optional<SubroutineDecl>
 analysis::doFindSubroutineDeclaration(std::string contextPath, FilePos location, Symbols &symbols) {
-    auto subMap = symbols.subroutineMap.subsMap;
-
-    for (const auto &subMapItem : subMap) {
-        auto fileToRangeMap = subMapItem.second;
-        if (fileToRangeMap.count(contextPath) == 0) continue;
-
-        for (auto range : fileToRangeMap[contextPath]) {
-            if (insideRange(range.location, location)) {
-                // We've found the subroutine symbol, now get declaration
-                return subMapItem.first;
-            }
-        }
-    }
-
-    return {};
+    return symbols.rootFileIndex.subroutineAt(location);
 }
 
 optional<unordered_map<string, vector<SubroutineCode>>>
 analysis::findSubroutineUsagesCode(const std::string &filePath, const std::string &contextPath, FilePos location,
                                    Symbols &symbols) {
-    auto subMap = symbols.subroutineMap.subsMap;
-
-    for (const auto &subMapItem : subMap) {
-        auto fileToRangeMap = subMapItem.second;
-        if (fileToRangeMap.count(contextPath) == 0) continue;
-
-        for (auto range : fileToRangeMap[contextPath]) {
-            if (insideRange(range.location, location)) {
-                // We've found the subroutine symbol, now get usages
-                return subMap[subMapItem.first];
-            }
-        }
+    if (auto subroutine = symbols.rootFileIndex.subroutineAt(location)) {
+        // We've found the subroutine symbol, now get usages
+        return symbols.subroutineMap.subsMap[subroutine.value()];
     }
 
     return {};
-
-
 }
 
 std::optional<std::unordered_map<std::string, std::vector<Range>>>
@@ -225,8 +196,9 @@ analysis::findSubroutineUsages(const std::string &filePath, const std::string &c
 
 std::unordered_map<std::string, std::vector<Range>>
 analysis::findUsages(const std::string &filePath, const std::string &contextPath, FilePos location,
-                     std::vector<std::string> projectFiles, Cache &cache) {
-    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, std::move(projectFiles), cache, true, false, true);
+                     std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph) {
+    auto symbolsMaybe = buildUsageSymbols(filePath, contextPath, location, std::move(projectFiles), cache,
+                                          projectGraph);
     if (!symbolsMaybe.has_value()) {
         return std::unordered_map<std::string, std::vector<Range>>();
     }
@@ -253,8 +225,9 @@ std::optional<FilePos> analysis::findVariableDeclaration(const std::string &file
 
 std::optional<analysis::Declaration>
 analysis::findSubroutineDeclaration(const std::string &filePath, const std::string &contextPath, FilePos location,
-                                    std::vector<std::string> projectFiles, Cache &cache) {
-    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, projectFiles, cache, false, false, true);
+                                    std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph) {
+    auto symbolsMaybe = buildProjectSymbols(filePath, contextPath, projectFiles, cache, projectGraph, false, false,
+                                            true);
     if (!symbolsMaybe.has_value()) {
         return {};
     }
@@ -271,15 +244,17 @@ analysis::findSubroutineDeclaration(const std::string &filePath, const std::stri
 
 
 optional<string>
-analysis::getSymbolName(std::string &filePath, FilePos location, vector<string> projectFiles, Cache &cache) {
-    auto symbolsMaybe = buildProjectSymbols(filePath, filePath, std::move(projectFiles), cache, true, false, true);
+analysis::getSymbolName(std::string &filePath, FilePos location, vector<string> projectFiles, Cache &cache,
+                        ProjectGraph &projectGraph) {
+    auto symbolsMaybe = buildProjectSymbols(filePath, filePath, std::move(projectFiles), cache, projectGraph, true,
+                                            false, true);
     if (!symbolsMaybe.has_value()) {
         return {};
     }
     auto symbols = symbolsMaybe.value();
 
-    if (auto localVar = findVariableAtLocation(symbols.rootFileSymbols, location)) {
-        return localVar.value().declaration->name;
+    if (auto localVar = symbols.rootFileIndex.variableAt(location)) {
+        return localVar->name;
     }
 
     if (auto sub = analysis::doFindSubroutineDeclaration(filePath, location, symbols)) {
@@ -305,8 +280,8 @@ void analysis::indexProject(std::vector<std::string> projectFiles, Cache &cache)
 }
 
 analysis::RenameResult analysis::renameSymbol(const string &filePath, FilePos location, string renameTo,
-                                              vector<string> projectFiles, Cache &cache) {
-    auto symbolsMaybe = buildProjectSymbols(filePath, filePath, std::move(projectFiles), cache, true, false, true);
+                                              vector<string> projectFiles, Cache &cache, ProjectGraph &projectGraph) {
+    auto symbolsMaybe = buildUsageSymbols(filePath, filePath, location, std::move(projectFiles), cache, projectGraph);
     if (!symbolsMaybe.has_value()) {
         return RenameResult(false, "Rename error");
     }
@@ -433,12 +408,21 @@ analysis::RenameResult analysis::renameSymbol(const string &filePath, FilePos lo
         }
     }
 
-    // Now do the actual renaming
-    for (auto fileReplacement : replacementMap) {
+    // Work out every file's new contents before writing any, so a bad replacement leaves them all untouched
+    std::vector<std::pair<std::string, std::string>> newFiles;
+    for (auto &fileReplacement : replacementMap) {
         if (isSystemPath(fileReplacement.first)) continue;
         auto fileContents = readFile(fileReplacement.first);
         auto newFile = doReplacements(fileContents, fileReplacement.second);
-        writeFile(fileReplacement.first, newFile);
+        if (!newFile.has_value()) {
+            return RenameResult(false, "Rename has overlapping or out of range changes in " + fileReplacement.first);
+        }
+        newFiles.emplace_back(fileReplacement.first, std::move(newFile.value()));
+    }
+
+    // Now do the actual renaming
+    for (const auto &newFile : newFiles) {
+        writeFile(newFile.first, newFile.second);
     }
 
     return RenameResult(true, "");
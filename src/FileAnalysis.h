@@ -39,13 +39,17 @@ namespace analysis {
 
     FileSymbols getFileSymbols(const std::string &path);
 
+    // Lines of the file at path, kept with its cached symbols (which are loaded if they aren't cached yet)
+    std::shared_ptr<const LineIndex> getLineIndex(const std::string &path, Cache &cache);
+
     std::vector<AutocompleteItem>
     autocompleteVariables(const std::string &filePath, const std::string &contextPath, FilePos location,
-                          std::vector<std::string> projectFiles, char sigilContext, Cache &cache);
+                          std::vector<std::string> projectFiles, char sigilContext, Cache &cache,
+                          ProjectGraph &projectGraph);
 
     std::vector<AutocompleteItem>
     autocompleteSubs(const std::string &filePath, const std::string &contextPath, FilePos location,
-                     std::vector<std::string> projectFiles, Cache &cache);
+                     std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph);
 
     std::optional<std::unordered_map<std::string, std::vector<Range>>>
     findVariableUsages(const std::string &filePath, const std::string &contextPath, FilePos location,
@@ -57,18 +61,18 @@ namespace analysis {
 
     std::optional<analysis::Declaration>
     findSubroutineDeclaration(const std::string &filePath, const std::string &contextPath, FilePos location,
-                              std::vector<std::string> projectFiles, Cache &cache);
+                              std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph);
 
     std::unordered_map<std::string, std::vector<Range>>
     findUsages(const std::string &filePath, const std::string &contextPath, FilePos location,
-               std::vector<std::string> projectFiles, Cache &cache);
+               std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph);
 
     std::optional<std::unordered_map<std::string, std::vector<Range>>>
     findSubroutineUsages(const std::string &filePath, const std::string &contextPath, FilePos location,
                          Symbols &symbols);
 
     RenameResult renameSymbol(const std::string &filePath, FilePos location, std::string renameTo,
-                              std::vector<std::string> projectFiles, Cache &cache);
+                              std::vector<std::string> projectFiles, Cache &cache, ProjectGraph &projectGraph);
 
     bool isSymbol(const std::string &filePath, FilePos location);
 
@@ -87,7 +91,8 @@ namespace analysis {
 
     optional<SubroutineDecl> doFindSubroutineDeclaration(string contextPath, FilePos location, Symbols &symbols);
 
-    optional<string> getSymbolName(string &filePath, FilePos location, vector<string> projectFiles, Cache &cache);
+    optional<string> getSymbolName(string &filePath, FilePos location, vector<string> projectFiles, Cache &cache,
+                                   ProjectGraph &projectGraph);
 }
 
 #endif //PERLPARSE_FILEANALYSIS_H
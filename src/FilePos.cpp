@@ -4,8 +4,8 @@
 
 #include "FilePos.h"
 
-std::string FilePos::toStr() {
-    return std::to_string(this->line) + ":" + std::to_string(this->col);
+std::string FilePos::toStr() const {
+    return std::to_string(this->position);
 }
 
 Range::Range(FilePos from, FilePos to) {
@@ -17,16 +17,10 @@ Range::Range(FilePos from, int symbolLength) {
     this->from = from;
     this->to = from;
     this->to.position += symbolLength;
-    this->to.col += symbolLength;
 }
 
 std::string Range::toStr() {
-    if (this->from.line == this->to.line) {
-        return std::to_string(this->from.line) + ":" + std::to_string(this->from.col) + "-" +
-               std::to_string(this->to.col);
-    }
-
-    return "[" + this->from.toStr() + "] - [" + this->to.toStr() + "]";
+    return this->from.toStr() + "-" + this->to.toStr();
 }
 
 bool Range::operator==(const Range other) {
@@ -5,45 +5,34 @@
 #ifndef PERLPARSER_FILEPOS_H
 #define PERLPARSER_FILEPOS_H
 
+#include <cstdint>
 #include <iostream>
 
+/**
+ * Byte offset into a program. Line and column are only needed at the edges (requests and responses to the editor), so
+ * they are worked out from a LineIndex there rather than being kept alongside every position
+ */
 struct FilePos {
-    FilePos() {
-        this->line = 0;
-        this->col = 0;
-        this->position = -1;
-    }
+    FilePos() = default;
 
-    FilePos(int line, int pos) {
-        this->line = line;
-        this->col = pos;
-        this->position = -1;
-    }
-
-    FilePos(int line, int pos, int position) {
-        this->line = line;
-        this->col = pos;
-        this->position = position;
-    }
+    explicit FilePos(int position) : position(position) {}
 
     bool operator==(const FilePos &other) const {
-        // NOTE: Ignores position
-        return other.line == this->line && other.col == this->col;
+        return this->position == other.position;
     }
 
-    bool operator<(const FilePos& other) {
+    bool operator<(const FilePos &other) const {
         return this->position < other.position;
     }
 
-    bool operator<=(const FilePos& other) {
-        return this->operator<(other) || this->operator==(other);
+    bool operator<=(const FilePos &other) const {
+        return this->position <= other.position;
     }
 
-    std::string toStr();
+    std::string toStr() const;
 
-    int line;
-    int col;
-    int position;
+    // -1 if not known (e.g. the end of a block that is never closed)
+    int32_t position = -1;
 };
 
 struct Range {
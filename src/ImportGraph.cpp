@@ -0,0 +1,102 @@
+#include "ImportGraph.h"
+
+#include <algorithm>
+#include <cstdint>
+
+ImportGraph::ImportGraph(const std::unordered_map<std::string, PathNode> &graph) {
+    // Nodes are only made for files with edges, so paths in an edge may not have a node of their own
+    for (const auto &node : graph) {
+        this->paths.emplace_back(node.first);
+        for (const auto &child : node.second.children) this->paths.emplace_back(child);
+    }
+    std::sort(this->paths.begin(), this->paths.end());
+    this->paths.erase(std::unique(this->paths.begin(), this->paths.end()), this->paths.end());
+
+    int files = (int) this->paths.size();
+    this->ids.reserve(files);
+    for (int i = 0; i < files; i++) this->ids.emplace(this->paths[i], i);
+
+    std::vector<std::pair<int, int>> imports;
+    for (const auto &node : graph) {
+        int parent = this->ids[node.first];
+        for (const auto &child : node.second.children) imports.emplace_back(parent, this->ids[child]);
+    }
+
+    std::vector<std::pair<int, int>> importedBy;
+    importedBy.reserve(imports.size());
+    for (const auto &import : imports) importedBy.emplace_back(import.second, import.first);
+
+    this->children = buildRows(files, imports);
+    this->parents = buildRows(files, importedBy);
+    imports.insert(imports.end(), importedBy.begin(), importedBy.end());
+    this->links = buildRows(files, imports);
+}
+
+ImportGraph::Rows ImportGraph::buildRows(int files, const std::vector<std::pair<int, int>> &edges) {
+    // Count the edges of each file first, so the rows can be filled in place
+    Rows rows;
+    rows.offsets.assign(files + 1, 0);
+    for (const auto &edge : edges) rows.offsets[edge.first + 1]++;
+    for (int i = 0; i < files; i++) rows.offsets[i + 1] += rows.offsets[i];
+
+    rows.edges.resize(edges.size());
+    std::vector<int> next(rows.offsets.begin(), rows.offsets.end() - 1);
+    for (const auto &edge : edges) rows.edges[next[edge.first]++] = edge.second;
+    return rows;
+}
+
+std::optional<int> ImportGraph::id(const std::string &path) const {
+    auto found = this->ids.find(path);
+    if (found == this->ids.end()) return std::nullopt;
+    return found->second;
+}
+
+const std::string &ImportGraph::path(int id) const {
+    return this->paths[id];
+}
+
+int ImportGraph::size() const {
+    return (int) this->paths.size();
+}
+
+std::vector<int> ImportGraph::connectedTo(int id) const {
+    return this->search({id}, this->links, true);
+}
+
+std::vector<int> ImportGraph::descendentsOf(int id) const {
+    return this->search({id}, this->children, false);
+}
+
+std::vector<int> ImportGraph::importersOf(const std::vector<int> &ids) const {
+    return this->search(ids, this->parents, true);
+}
+
+std::vector<int> ImportGraph::search(const std::vector<int> &starts, const Rows &rows, bool includeStarts) const {
+    std::vector<uint64_t> seen((this->paths.size() + 63) / 64, 0);
+    auto markSeen = [&](int file) {
+        uint64_t bit = uint64_t(1) << (file % 64);
+        if (seen[file / 64] & bit) return false;
+        seen[file / 64] |= bit;
+        return true;
+    };
+
+    // Files found so far, which doubles as the queue: files before next have had their edges followed
+    std::vector<int> found;
+    auto follow = [&](int file) {
+        for (int edge = rows.offsets[file]; edge < rows.offsets[file + 1]; edge++) {
+            if (markSeen(rows.edges[edge])) found.emplace_back(rows.edges[edge]);
+        }
+    };
+
+    for (int start : starts) {
+        if (includeStarts) {
+            if (markSeen(start)) found.emplace_back(start);
+        } else {
+            // Only found if it imports itself through a cycle
+            follow(start);
+        }
+    }
+
+    for (size_t next = 0; next < found.size(); next++) follow(found[next]);
+    return found;
+}
@@ -0,0 +1,61 @@
+#ifndef PERLPARSER_IMPORTGRAPH_H
+#define PERLPARSER_IMPORTGRAPH_H
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Symbols.h"
+
+/**
+ * Read only copy of an import graph for answering reachability queries quickly.
+ *
+ * Each path is given a dense integer id, in sorted order of path, and the edges are stored in compressed sparse row
+ * form: the children of file i are children.edges[children.offsets[i]] up to children.edges[children.offsets[i + 1]].
+ * Searches are iterative breadth first searches over those arrays, marking files seen in a bitset.
+ */
+class ImportGraph {
+public:
+    ImportGraph() = default;
+
+    explicit ImportGraph(const std::unordered_map<std::string, PathNode> &graph);
+
+    std::optional<int> id(const std::string &path) const;
+
+    const std::string &path(int id) const;
+
+    int size() const;
+
+    // Files connected to id by imports in either direction, including id
+    std::vector<int> connectedTo(int id) const;
+
+    // Files that id imports, directly or through other files
+    std::vector<int> descendentsOf(int id) const;
+
+    // Files that import any of ids, directly or through other files, along with ids themselves
+    std::vector<int> importersOf(const std::vector<int> &ids) const;
+
+private:
+    struct Rows {
+        std::vector<int> offsets;
+        std::vector<int> edges;
+    };
+
+    static Rows buildRows(int files, const std::vector<std::pair<int, int>> &edges);
+
+    // Files reachable from starts along rows, in the order they are reached
+    std::vector<int> search(const std::vector<int> &starts, const Rows &rows, bool includeStarts) const;
+
+    std::vector<std::string> paths;
+    std::unordered_map<std::string, int> ids;
+
+    Rows children;
+    Rows parents;
+
+    // Children and parents together
+    Rows links;
+};
+
+
+#endif //PERLPARSER_IMPORTGRAPH_H
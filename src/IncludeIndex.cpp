@@ -0,0 +1,78 @@
+#include "IncludeIndex.h"
+
+#include <fstream>
+#include "Constants.h"
+#include "Util.h"
+
+// Whether path is found by just following its parts down from an include directory
+static bool isPlainRelativePath(const std::string &path, const std::vector<std::string> &parts) {
+    if (path.empty() || path[0] == '/') return false;
+    for (const auto &part : parts) {
+        if (part.empty() || part == "." || part == "..") return false;
+    }
+    return !parts.empty();
+}
+
+IncludeIndex::IncludeIndex() : IncludeIndex(std::chrono::milliseconds(constant::INCLUDE_INDEX_RECHECK_MS)) {}
+
+IncludeIndex::IncludeIndex(std::chrono::milliseconds recheckInterval) : recheckInterval(recheckInterval) {}
+
+std::optional<std::string>
+IncludeIndex::resolve(const std::vector<std::string> &includePaths, const std::string &relativePath) {
+    auto parts = split(relativePath, "/");
+    if (!isPlainRelativePath(relativePath, parts)) {
+        // Rare enough (require "../file.pl" and the like) to just check each directory
+        for (const auto &includePath : includePaths) {
+            auto fullPath = includePath + "/" + relativePath;
+            if (std::ifstream(fullPath).good()) return fullPath;
+        }
+        return std::nullopt;
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (const auto &includePath : includePaths) {
+        std::string path = includePath;
+        bool found = true;
+        for (int i = 0; i < (int) parts.size() - 1 && found; i++) {
+            found = this->directory(path).directories.count(parts[i]) > 0;
+            path += "/" + parts[i];
+        }
+
+        if (found && this->directory(path).files.count(parts.back()) > 0) return includePath + "/" + relativePath;
+    }
+
+    return std::nullopt;
+}
+
+const IncludeIndex::Directory &IncludeIndex::directory(const std::string &path) {
+    auto now = std::chrono::steady_clock::now();
+    auto &directory = this->directories[path];
+    if (directory.checked.time_since_epoch().count() != 0 &&
+        now - directory.checked < this->recheckInterval) {
+        return directory;
+    }
+
+    bool listed = directory.checked.time_since_epoch().count() != 0;
+    directory.checked = now;
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time(path, error);
+    bool exists = !error;
+    if (listed && exists == directory.exists && (!exists || modified == directory.modified)) return directory;
+
+    directory.exists = exists;
+    directory.modified = modified;
+    directory.files.clear();
+    directory.directories.clear();
+    if (!exists) return directory;
+
+    for (const auto &entry : std::filesystem::directory_iterator(path, error)) {
+        // Both follow symlinks, as perl does
+        if (entry.is_directory(error)) {
+            directory.directories.insert(entry.path().filename().string());
+        } else if (entry.is_regular_file(error)) {
+            directory.files.insert(entry.path().filename().string());
+        }
+    }
+
+    return directory;
+}
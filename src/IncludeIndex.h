@@ -0,0 +1,51 @@
+#ifndef PERLPARSER_INCLUDEINDEX_H
+#define PERLPARSER_INCLUDEINDEX_H
+
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Finds files under include directories from listings of the directories kept in memory, rather than trying to open
+ * the file in each include directory in turn.
+ *
+ * A directory is listed the first time a lookup passes through it. After that a lookup only checks the directory's
+ * modification time (listing it again if it has changed) once the recheck interval has passed, so until then lookups,
+ * including ones that find nothing, don't touch the disk at all.
+ *
+ * Safe to use from several threads at once.
+ */
+class IncludeIndex {
+public:
+    // Rechecks directories every constant::INCLUDE_INDEX_RECHECK_MS
+    IncludeIndex();
+
+    explicit IncludeIndex(std::chrono::milliseconds recheckInterval);
+
+    // Full path of relativePath in the first of includePaths containing it
+    std::optional<std::string> resolve(const std::vector<std::string> &includePaths, const std::string &relativePath);
+
+private:
+    struct Directory {
+        bool exists = false;
+        std::filesystem::file_time_type modified;
+        std::chrono::steady_clock::time_point checked;
+        std::unordered_set<std::string> files;
+        std::unordered_set<std::string> directories;
+    };
+
+    // Listing of the directory at path, brought up to date if it is due a check. Called with the mutex held
+    const Directory &directory(const std::string &path);
+
+    std::chrono::milliseconds recheckInterval;
+    std::unordered_map<std::string, Directory> directories;
+    std::mutex mutex;
+};
+
+
+#endif //PERLPARSER_INCLUDEINDEX_H
@@ -0,0 +1,205 @@
+#ifndef PERLPARSER_LEXICON_H
+#define PERLPARSER_LEXICON_H
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include "Token.h"
+
+// Fixed word lists of the perl language (keywords, builtins, special variables, pragmas).
+// Each is a perfect hash table built at compile time, so there is nothing to construct at runtime and a lookup is two
+// hashes of the word plus one comparison.
+// Building the tables does take the compiler about a second, so include this from .cpp files that use it, not headers.
+namespace lexicon {
+    constexpr uint32_t hash(std::string_view str, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char c : str) {
+            h ^= (uint8_t) c;
+            h *= 16777619u;
+        }
+
+        // FNV has weak low bits, mix so that the table index (the low bits) depends on every character
+        h ^= h >> 13;
+        h *= 0x5bd1e995u;
+        h ^= h >> 15;
+        return h;
+    }
+
+    constexpr std::size_t nextPowerOfTwo(std::size_t n) {
+        std::size_t power = 1;
+        while (power < n) power *= 2;
+        return power;
+    }
+
+    template<typename Value>
+    struct Entry {
+        std::string_view key;
+        Value value;
+    };
+
+    /**
+     * Perfect hash map using hash and displace. Keys are first hashed into buckets, then each bucket (largest first)
+     * gets the first seed that places all of its keys into free slots. Lookup is then hash(key, seeds[bucket]).
+     */
+    template<typename Value, std::size_t Count>
+    class PerfectHashMap {
+    public:
+        static constexpr std::size_t SIZE = nextPowerOfTwo(2 * Count);
+        static constexpr std::size_t BUCKETS = Count / 2 + 1;
+
+        constexpr explicit PerfectHashMap(const Entry<Value> (&entries)[Count]) {
+            std::array<std::size_t, Count> bucketOf{};
+            std::array<std::size_t, BUCKETS> bucketSize{};
+            for (std::size_t i = 0; i < Count; i++) {
+                for (std::size_t j = 0; j < i; j++) {
+                    if (entries[i].key == entries[j].key) throw std::logic_error("Duplicate key in lexicon");
+                }
+                bucketOf[i] = hash(entries[i].key, 0) % BUCKETS;
+                bucketSize[bucketOf[i]]++;
+            }
+
+            // Place the largest buckets first, while the table is emptiest
+            std::array<std::size_t, BUCKETS> order{};
+            for (std::size_t b = 0; b < BUCKETS; b++) {
+                std::size_t j = b;
+                while (j > 0 && bucketSize[order[j - 1]] < bucketSize[b]) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = b;
+            }
+
+            std::array<bool, SIZE> used{};
+            for (std::size_t b : order) {
+                if (bucketSize[b] == 0) break;
+                for (uint32_t seed = 1;; seed++) {
+                    std::array<std::size_t, Count> slots{};
+                    std::size_t placed = 0;
+                    bool ok = true;
+                    for (std::size_t i = 0; i < Count && ok; i++) {
+                        if (bucketOf[i] != b) continue;
+                        auto slot = hash(entries[i].key, seed) % SIZE;
+                        if (used[slot]) ok = false;
+                        for (std::size_t j = 0; j < placed && ok; j++) {
+                            if (slots[j] == slot) ok = false;
+                        }
+                        slots[placed++] = slot;
+                    }
+                    if (!ok) continue;
+
+                    placed = 0;
+                    for (std::size_t i = 0; i < Count; i++) {
+                        if (bucketOf[i] != b) continue;
+                        auto slot = slots[placed++];
+                        used[slot] = true;
+                        keys[slot] = entries[i].key;
+                        values[slot] = entries[i].value;
+                    }
+                    seeds[b] = seed;
+                    break;
+                }
+            }
+            occupied = used;
+        }
+
+        // Returns nullptr if key isn't in the map
+        constexpr const Value *find(std::string_view key) const {
+            auto slot = hash(key, seeds[hash(key, 0) % BUCKETS]) % SIZE;
+            if (!occupied[slot] || keys[slot] != key) return nullptr;
+            return &values[slot];
+        }
+
+        constexpr bool contains(std::string_view key) const {
+            return find(key) != nullptr;
+        }
+
+    private:
+        std::array<std::string_view, SIZE> keys{};
+        std::array<Value, SIZE> values{};
+        std::array<bool, SIZE> occupied{};
+        std::array<uint32_t, BUCKETS> seeds{};
+    };
+
+    template<typename Value, std::size_t Count>
+    constexpr auto makeMap(const Entry<Value> (&entries)[Count]) {
+        return PerfectHashMap<Value, Count>(entries);
+    }
+
+    // Set of words, stored as a map to bool
+    template<std::size_t Count>
+    constexpr auto makeSet(const std::string_view (&words)[Count]) {
+        Entry<bool> entries[Count]{};
+        for (std::size_t i = 0; i < Count; i++) entries[i] = {words[i], true};
+        return PerfectHashMap<bool, Count>(entries);
+    }
+
+    // Words that are tokenised as their own TokenType
+    constexpr auto KEYWORDS = makeMap<TokenType>({
+            {"use", TokenType::Use}, {"if", TokenType::If}, {"else", TokenType::Else}, {"elsif", TokenType::ElsIf},
+            {"unless", TokenType::Unless}, {"while", TokenType::While}, {"until", TokenType::Until},
+            {"for", TokenType::For}, {"foreach", TokenType::Foreach}, {"when", TokenType::When},
+            {"do", TokenType::Do}, {"next", TokenType::Next}, {"redo", TokenType::Redo}, {"last", TokenType::Last},
+            {"my", TokenType::My}, {"state", TokenType::State}, {"local", TokenType::Local}, {"our", TokenType::Our},
+            {"break", TokenType::Break}, {"continue", TokenType::Continue}, {"given", TokenType::Given},
+            {"sub", TokenType::Sub}, {"package", TokenType::Package}, {"require", TokenType::Require}
+    });
+
+    // Built in perl functions, from https://perldoc.perl.org/5.30.0/index-functions.html
+    constexpr auto BUILTINS = makeSet({
+            "abs", "accept", "alarm", "and", "atan2", "bind", "binmode", "bless", "break", "caller", "chdir",
+            "chmod", "chomp", "chop", "chown", "chr", "chroot", "close", "closedir", "cmp", "connect", "continue",
+            "cos", "crypt", "__DATA__", "dbmclose", "dbmopen", "default", "defined", "delete", "die", "do", "dump",
+            "each", "else", "elseif", "elsif", "endgrent", "endhostent", "endnetent", "endprotoent", "endpwent",
+            "endservent", "eof", "eq", "eval", "evalbytes", "exec", "exists", "exit", "exp", "fc", "fcntl", "fileno",
+            "flock", "for", "foreach", "fork", "format", "formline", "ge", "getc", "getgrent", "getgrgid",
+            "getgrnam", "gethostbyaddr", "gethostbyname", "gethostent", "getlogin", "getnetbyaddr", "getnetbyname",
+            "getnetent", "getpeername", "getpgrp", "getppid", "getpriority", "getprotobyname", "getprotobynumber",
+            "getprotoent", "getpwent", "getpwnam", "getpwuid", "getservbyname", "getservbyport", "getservent",
+            "getsockname", "getsockopt", "given", "glob", "gmtime", "goto", "grep", "gt", "hex", "INIT", "if",
+            "import", "index", "int", "ioctl", "join", "keys", "kill", "last", "lc", "lcfirst", "le", "length",
+            "link", "listen", "local", "localtime", "lock", "log", "lstat", "lt", "m", "map", "mkdir", "msgctl",
+            "msgget", "msgrcv", "msgsnd", "my", "ne", "next", "no", "not", "oct", "open", "opendir", "or", "ord",
+            "our", "pack", "package", "pipe", "pop", "pos", "print", "printf", "prototype", "push", "q", "qq", "qr",
+            "quotemeta", "qw", "qx", "rand", "read", "readdir", "readline", "readlink", "readpipe", "recv", "redo",
+            "ref", "rename", "require", "reset", "return", "reverse", "rewinddir", "rindex", "rmdir", "s", "say",
+            "scalar", "seek", "seekdir", "select", "semctl", "semget", "semop", "send", "setgrent", "sethostent",
+            "setnetent", "setpgrp", "setpriority", "setprotoent", "setpwent", "setservent", "setsockopt", "shift",
+            "shmctl", "shmget", "shmread", "shmwrite", "shutdown", "sin", "sleep", "socket", "socketpair", "sort",
+            "splice", "split", "sprintf", "sqrt", "srand", "stat", "state", "study", "sub", "substr", "symlink",
+            "syscall", "sysopen", "sysread", "sysseek", "system", "syswrite", "tell", "telldir", "tie", "tied",
+            "time", "times", "tr", "truncate", "UNITCHECK", "uc", "ucfirst", "umask", "undef", "unless", "unlink",
+            "unpack", "unshift", "untie", "until", "use", "utime", "values", "vec", "wait", "waitpid", "wantarray",
+            "warn", "when", "while", "write", "-X", "x", "xor"
+    });
+
+    // Special variables are not treated as package globals
+    constexpr auto SPECIAL_SCALARS = makeSet({
+            "$_", "$ARG", "$.", "$NR", "$/", "$RS", "$,", "$OFS", "$\\", "$ORS", "$\"", "$LIST_SEPARATOR", "$;",
+            "$SUBSCRIPT_SEPARATOR", "$^L", "$FORMAT_FORMFEED", "$:", "$FORMAT_LINE_BREAK_CHARACTERS", "$^A",
+            "$ACCUMULATOR", "$#", "$OFMT", "$?", "$CHILD_ERROR", "$!", "$OS_ERROR", "$@", "$EVAL_ERROR", "$$",
+            "$PROCESS_ID", "$<", "$REAL_USER_ID", "$>", "$EFFECTIVE_USER_ID", "$(", "$REAL_GROUP_ID", "$)",
+            "$EFFECTIVE_GROUP_ID", "$0", "$PROGRAM_NAME", "$[", "$]", "$PERL_VERSION", "$^D", "$DEBUGGING", "$^E",
+            "$EXTENDED_OS_ERROR", "$^F", "$SYSTEM_FD_MAX", "$^H", "$^I", "$INPLACE_EDIT", "$^M", "$^O", "$OSNAME",
+            "$^P", "$PERLDB", "$^T", "$BASETIME", "$^W", "$WARNING", "$^X", "$EXECUTABLE_NAME", "$ARGV", "$INC",
+            "$ENV", "$SIG", "$&", "$MATCH", "$`", "$PREMATCH", "$'", "$POSTMATCH", "$+", "$LAST_PAREN_MATCH", "$|",
+            "$OUTPUT_AUTOFLUSH", "$%", "$FORMAT_PAGE_NUMBER", "$=", "$FORMAT_LINES_PER_PAGE", "$-",
+            "$FORMAT_LINES_LEFT", "$~", "$FORMAT_NAME", "$^", "$FORMAT_TOP_NAME"
+    });
+
+    constexpr auto SPECIAL_ARRAYS = makeSet({"@ARGV", "@INC", "@F", "@ENV", "@SIG", "@_"});
+
+    constexpr auto SPECIAL_HASHES = makeSet({"%INC", "%ENV", "%SIG"});
+
+    // `use <pragma>` is not an import of a module
+    constexpr auto PRAGMATIC_MODULES = makeSet({
+            "attributes", "autodie", "autodie::exception", "autodie::exception::system", "autodie::hints",
+            "autodie::skip", "autouse", "base", "bigint", "bignum", "bigrat", "blib", "bytes", "charnames",
+            "constant", "deprecate", "diagnostics", "encoding", "encoding::warnings", "experimental", "feature",
+            "fields", "filetest", "if", "integer", "less", "lib", "locale", "mro", "ok", "open", "ops", "overload",
+            "overloading", "parent", "re", "sigtrapsort", "strict", "subs", "threads", "threads::shared", "utf8",
+            "vars", "version", "vmsish", "warnings", "warnings::register"
+    });
+}
+
+#endif //PERLPARSER_LEXICON_H
@@ -0,0 +1,65 @@
+#include <algorithm>
+
+#include "LineIndex.h"
+#include "Scan.h"
+
+LineIndex::LineIndex(std::string_view program) {
+    reset(program);
+}
+
+void LineIndex::reset(std::string_view program) {
+    static const scan::StopChars newline{'\n'};
+
+    this->end = program.size();
+    this->lineStarts.clear();
+    this->lineStarts.emplace_back(0);
+    std::size_t next = scan::findFirstOf(program, 0, newline);
+    while (next < program.size()) {
+        bool windows = next > 0 && program[next - 1] == '\r';
+        this->lineStarts.emplace_back(windows ? next : next + 1);
+        next = scan::findFirstOf(program, next + 1, newline);
+    }
+}
+
+std::string LineCol::toStr() const {
+    return std::to_string(this->line) + ":" + std::to_string(this->col);
+}
+
+LineCol LineIndex::lineCol(const FilePos &pos) const {
+    int line = 0;
+    return lineCol(pos, line);
+}
+
+LineCol LineIndex::lineCol(const FilePos &pos, int &lineHint) const {
+    int position = pos.position;
+    auto isOnLine = [&](int line) {
+        return line >= 0 && line < (int) this->lineStarts.size() && this->lineStarts[line] <= position &&
+               (line + 1 == (int) this->lineStarts.size() || position < this->lineStarts[line + 1]);
+    };
+
+    // Usually on the same line as last time or the one after
+    if (!isOnLine(lineHint)) {
+        if (isOnLine(lineHint + 1)) {
+            lineHint++;
+        } else {
+            auto after = std::upper_bound(this->lineStarts.begin(), this->lineStarts.end(), position);
+            lineHint = std::max(0, (int) (after - this->lineStarts.begin()) - 1);
+        }
+    }
+
+    return LineCol{lineHint + 1, position - this->lineStarts[lineHint] + 1};
+}
+
+FilePos LineIndex::filePos(int line, int col) const {
+    if (line < 1 || line > (int) this->lineStarts.size() || col < 1) return FilePos();
+
+    // Up to and including the newline ending the line, or just after the last character of the program
+    int position = this->lineStarts[line - 1] + col - 1;
+    int next = line == (int) this->lineStarts.size() ? this->end + 1 : this->lineStarts[line];
+    if (position >= next) return FilePos();
+    return FilePos(position);
+}
+
+int LineIndex::numLines() const {
+    return this->lineStarts.size();
+}
@@ -0,0 +1,52 @@
+#ifndef PERLPARSER_LINEINDEX_H
+#define PERLPARSER_LINEINDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FilePos.h"
+
+// Line and column of a position, both starting at 1, as editors give and expect them
+struct LineCol {
+    int line;
+    int col;
+
+    std::string toStr() const;
+};
+
+/**
+ * Where each line of a program starts, so that a position can be converted to a line and column (and the other way)
+ * with a binary search. Lines are split the same way the tokeniser always has: after "\n", and before the "\n" of
+ * "\r\n" (so the first character after "\r\n" is column 2).
+ */
+class LineIndex {
+public:
+    LineIndex() = default;
+
+    explicit LineIndex(std::string_view program);
+
+    // Index program, reusing the existing capacity
+    void reset(std::string_view program);
+
+    LineCol lineCol(const FilePos &pos) const;
+
+    // As above, starting the search from lineHint (a line index) which is updated to the line found. Much faster when
+    // positions are looked up mostly in order
+    LineCol lineCol(const FilePos &pos, int &lineHint) const;
+
+    // Position of line and column, or an unknown position if they aren't in the program
+    FilePos filePos(int line, int col) const;
+
+    int numLines() const;
+
+private:
+    // Position of the first column of each line
+    std::vector<int> lineStarts{0};
+
+    // Length of the program, the position after its last character
+    int end = 0;
+};
+
+
+#endif //PERLPARSER_LINEINDEX_H
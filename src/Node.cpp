@@ -0,0 +1,32 @@
+#include "Node.h"
+
+ParseTree::ParseTree(const std::vector<Token> &tokens) : tokens(tokens) {}
+
+int ParseTree::firstChild(int block) const {
+    return block + 1 < this->nodes[block].subtreeEnd ? block + 1 : -1;
+}
+
+int ParseTree::nextSibling(int block, int child) const {
+    int next = this->nodes[child].subtreeEnd;
+    return next < this->nodes[block].subtreeEnd ? next : -1;
+}
+
+TokenIterator ParseTree::tokenIterator(int tokensNode, TokenTypeSet ignoreTokens) const {
+    const Node &node = this->nodes[tokensNode];
+    return TokenIterator(this->tokens, ignoreTokens, node.tokensBegin, node.tokensEnd);
+}
+
+std::string ParseTree::toStr(int node) const {
+    const Node &n = this->nodes[node];
+    if (n.type == NodeType::Block) return "BlockNode " + n.start.toStr() + " - " + n.end.toStr();
+
+    if (n.tokensEnd - n.tokensBegin > 1) {
+        int i = n.tokensBegin;
+        while (i < n.tokensEnd && isWhitespaceNewlineComment(this->tokens[i].type)) i++;
+        Token first = this->tokens[i];
+        Token last = this->tokens[n.tokensEnd - 1];
+        return "TokensNode " + first.toStr(true) + " - " + last.startPos.toStr() + " " + last.endPos.toStr();
+    }
+
+    return "TokensNode";
+}
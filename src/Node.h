@@ -8,52 +8,59 @@
 #include "FilePos.h"
 #include "Token.h"
 #include "Util.h"
-#include <memory>
+#include "BracketIndex.h"
 #include <vector>
 
+enum class NodeType {
+    // Scope between a pair of brackets (or the whole file)
+    Block,
+    // Run of tokens between the brackets
+    Tokens
+};
+
 struct Node {
-    Node() {}
+    NodeType type;
 
-    std::vector<std::shared_ptr<Node>> children;
+    // Nodes are stored in pre-order, so the children of a block start straight after it. subtreeEnd is one past the
+    // last node under this one, which is also where its next sibling is
+    int subtreeEnd;
 
-    virtual std::string toStr() {
-        return std::string();
-    };
+    // Tokens of a tokens node are tokens[tokensBegin] up to tokens[tokensEnd]
+    int tokensBegin;
+    int tokensEnd;
+
+    // Block nodes only
+    FilePos start;
+    FilePos end;
 };
 
-struct TokensNode : Node {
-    std::vector<Token> tokens;
+/**
+ * Blocks of a program, with the tokens between them. All nodes are in a single vector and refer to the tokens by index,
+ * so the tokens must outlive the tree.
+ */
+class ParseTree {
+public:
+    explicit ParseTree(const std::vector<Token> &tokens);
 
-    explicit TokensNode(std::vector<Token> tokens) {
-        this->tokens = tokens;
-    }
+    const std::vector<Token> &tokens;
 
-    std::string toStr() override {
+    // nodes[ROOT] is the block for the whole file
+    std::vector<Node> nodes;
 
-        if (tokens.size() > 1) {
-            int i = 0;
-            auto token = tokens[i];
-            while (i < tokens.size() && tokens[i].isWhitespaceNewlineOrComment()) i++;
-            return "TokensNode " + tokens[i].toStr(true) + " - " +
-                   tokens[tokens.size() - 1].startPos.toStr() + " " + tokens[tokens.size() - 1].endPos.toStr();
-        }
+    // Brackets the blocks were built from
+    BracketIndex brackets;
 
-        return "TokensNode";
-    }
-};
+    static constexpr int ROOT = 0;
 
-struct BlockNode : Node {
+    // Iterate the children of a block with
+    //     for (int child = tree.firstChild(block); child != -1; child = tree.nextSibling(block, child))
+    int firstChild(int block) const;
 
-    explicit BlockNode(FilePos start) {
-        this->start = start;
-    }
+    int nextSibling(int block, int child) const;
 
-    FilePos start;
-    FilePos end;
+    TokenIterator tokenIterator(int tokensNode, TokenTypeSet ignoreTokens = {}) const;
 
-    std::string toStr() override {
-        return "BlockNode " + start.toStr() + " - " + end.toStr();
-    }
+    std::string toStr(int node) const;
 };
 
 
@@ -3,6 +3,8 @@
 //
 
 #include "Package.h"
+#include <set>
+#include <unordered_map>
 
 std::string findPackageAtPos(const std::vector<PackageSpan> &packages, FilePos pos) {
     for (const PackageSpan &package : packages) {
@@ -12,6 +14,61 @@ std::string findPackageAtPos(const std::vector<PackageSpan> &packages, FilePos p
     return "main";
 }
 
+PackageIndex::PackageIndex(const std::vector<PackageSpan> &packages) {
+    // Mark where each span starts and stops covering positions. Spans are inclusive (see insideRange)
+    struct Boundary {
+        int key;
+        int span;
+        bool isStart;
+    };
+    std::vector<Boundary> boundaries;
+    std::vector<int> spanNames;
+    std::unordered_map<std::string, int> nameIds;
+
+    for (int i = 0; i < (int) packages.size(); i++) {
+        const auto &package = packages[i];
+        auto nameId = nameIds.find(package.packageName);
+        if (nameId == nameIds.end()) {
+            nameId = nameIds.emplace(package.packageName, names.size()).first;
+            names.emplace_back(package.packageName);
+        }
+        spanNames.emplace_back(nameId->second);
+
+        // Covers no positions
+        if (package.end < package.start) continue;
+
+        boundaries.emplace_back(Boundary{package.start.position, i, true});
+        boundaries.emplace_back(Boundary{package.end.position + 1, i, false});
+    }
+
+    std::sort(boundaries.begin(), boundaries.end(), [](const Boundary &a, const Boundary &b) {
+        return a.key < b.key;
+    });
+
+    // Sweep through the boundaries, keeping track of the spans that cover each segment. The earliest one wins
+    std::set<int> coveringSpans;
+    for (int i = 0; i < (int) boundaries.size(); i++) {
+        if (boundaries[i].isStart) {
+            coveringSpans.insert(boundaries[i].span);
+        } else {
+            coveringSpans.erase(boundaries[i].span);
+        }
+
+        if (i + 1 < (int) boundaries.size() && boundaries[i + 1].key == boundaries[i].key) continue;
+        segmentStarts.emplace_back(boundaries[i].key);
+        segmentNames.emplace_back(coveringSpans.empty() ? -1 : spanNames[*coveringSpans.begin()]);
+    }
+}
+
+const std::string &PackageIndex::packageAt(const FilePos &pos) const {
+    static const std::string MAIN = "main";
+    auto segment = std::upper_bound(segmentStarts.begin(), segmentStarts.end(), pos.position);
+    if (segment == segmentStarts.begin()) return MAIN;
+
+    int name = segmentNames[segment - segmentStarts.begin() - 1];
+    return name == -1 ? MAIN : names[name];
+}
+
 PackageSpan::PackageSpan(FilePos start, FilePos end, const std::string &name) {
     this->start = start;
     this->end = end;
@@ -46,9 +103,16 @@ std::vector<std::string> splitPackage(const std::string &package) {
     return parts;
 }
 
-PackagedSymbol splitOnPackage(std::string canonicalSymbol, std::string packageContext) {
-    std::vector<std::string> parts = split(canonicalSymbol, "::");
+PackagedSymbol splitOnPackage(const std::string &canonicalSymbol, const std::string &packageContext) {
     PackagedSymbol packagedSymbol;
+    if (canonicalSymbol.find("::") == std::string::npos) {
+        // Most symbols aren't qualified, so don't bother splitting
+        packagedSymbol.symbol = canonicalSymbol;
+        packagedSymbol.package = packageContext;
+        return packagedSymbol;
+    }
+
+    std::vector<std::string> parts = split(canonicalSymbol, "::");
 
     // Remove actual name
     packagedSymbol.symbol = parts[parts.size() - 1];
@@ -66,6 +130,9 @@ PackagedSymbol splitOnPackage(std::string canonicalSymbol, std::string packageCo
 }
 
 std::string getCanonicalPackageName(const std::string &package) {
+    // Nothing to replace
+    if (package.find_first_of(":'-") == std::string::npos) return package;
+
     std::string canonical = package;
 
     // Now replace ' with ::, -> with ::
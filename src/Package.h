@@ -28,9 +28,32 @@ struct PackagedSymbol {
 
 std::string findPackageAtPos(const std::vector<PackageSpan> &packages, FilePos pos);
 
+/**
+ * Finds the package at a position with a binary search rather than checking every span, giving the same package as
+ * findPackageAtPos. Package names are stored once, so looking one up doesn't copy it
+ */
+class PackageIndex {
+public:
+    PackageIndex() = default;
+
+    explicit PackageIndex(const std::vector<PackageSpan> &packages);
+
+    const std::string &packageAt(const FilePos &pos) const;
+
+private:
+    // The spans are split up into segments that don't overlap, segment i is from segmentStarts[i] up to the start of
+    // the next one
+    std::vector<int> segmentStarts;
+
+    // Index into names of the first span covering each segment, -1 if no span covers it
+    std::vector<int> segmentNames;
+
+    std::vector<std::string> names;
+};
+
 std::vector<std::string> splitPackage(const std::string &package);
 
-PackagedSymbol splitOnPackage(std::string canonicalSymbol, std::string packageContext);
+PackagedSymbol splitOnPackage(const std::string &canonicalSymbol, const std::string &packageContext);
 
 std::string getCanonicalPackageName(const std::string &package);
 
@@ -3,61 +3,45 @@
 //
 
 #include "Parser.h"
+#include "Lexicon.h"
+#include "VarAnalysis.h"
+#include "ThreadPool.h"
 
 // These are modules that have a special syntaxic meaning in perl e.g. `use warnings` turns on warnings, it does
 // not search for a module called 'warnings'
 
-// Returns -1 if there is no next token
-int nextTokenIdx(const std::vector<Token> &tokens, int currentIdx) {
-    while (currentIdx < tokens.size() - 1) {
+// Returns -1 if there is no next token before end
+int nextTokenIdx(const std::vector<Token> &tokens, int currentIdx, int end) {
+    while (currentIdx < end - 1) {
         currentIdx += 1;
 
-        auto nextType = tokens[currentIdx].type;
-        if (nextType != TokenType::Whitespace && nextType != TokenType::Newline) return currentIdx;
+        if (!isWhitespaceNewlineComment(tokens[currentIdx].type)) return currentIdx;
     }
 
     return -1;
 }
 
-void doBuildParseTree(const std::shared_ptr<BlockNode> &node, const std::vector<Token> &tokens, int &tokenIdx) {
-    std::vector<Token> tokensAcc;
-    while (tokenIdx < tokens.size()) {
-        Token token = tokens[tokenIdx];
-        tokensAcc.emplace_back(token);
-        tokenIdx += 1;
-
-        if (token.type == TokenType::LBracket) {
-            node->children.emplace_back(std::make_shared<TokensNode>(tokensAcc));
-            tokensAcc.clear();
-
-            // Now create child
-            auto child = std::make_shared<BlockNode>(token.startPos);
-
-            node->children.emplace_back(child);
-            doBuildParseTree(child, tokens, tokenIdx);
-        } else if (token.type == TokenType::RBracket) {
-            node->children.emplace_back(std::make_shared<TokensNode>(tokensAcc));
-            node->end = token.endPos;
-            tokensAcc.clear();
-            return;
-        }
-    }
-
-    // Add remaining tokens
-    node->children.emplace_back(std::make_shared<TokensNode>(tokensAcc));
+static int addNode(ParseTree &tree, NodeType type, int tokensBegin, int tokensEnd) {
+    Node node;
+    node.type = type;
+    node.subtreeEnd = tree.nodes.size() + 1;
+    node.tokensBegin = tokensBegin;
+    node.tokensEnd = tokensEnd;
+    tree.nodes.emplace_back(node);
+    return tree.nodes.size() - 1;
 }
 
-void doPrintParseTree(std::shared_ptr<Node> parent, int level) {
-    for (int i = 0; i < (int) parent->children.size(); i++) {
+void doPrintParseTree(const ParseTree &tree, int block, int level) {
+    for (int child = tree.firstChild(block); child != -1; child = tree.nextSibling(block, child)) {
         for (int j = 0; j < level; j++) std::cout << "  ";
-        std::cout << parent->children[i]->toStr() << std::endl;
-        doPrintParseTree(parent->children[i], level + 1);
+        std::cout << tree.toStr(child) << std::endl;
+        if (tree.nodes[child].type == NodeType::Block) doPrintParseTree(tree, child, level + 1);
     }
 }
 
 
-void printParseTree(std::shared_ptr<Node> root) {
-    doPrintParseTree(root, 0);
+void printParseTree(const ParseTree &tree) {
+    doPrintParseTree(tree, ParseTree::ROOT, 0);
 }
 
 void addPackageSpan(std::vector<PackageSpan> &packageSpans, PackageSpan packageSpan) {
@@ -72,142 +56,159 @@ void addPackageSpan(std::vector<PackageSpan> &packageSpans, PackageSpan packageS
     packageSpans.emplace_back(packageSpan);
 }
 
-std::vector<PackageSpan>
-doParsePackages(const std::shared_ptr<BlockNode> &parent, std::stack<std::string> &packageStack,
-                FilePos &currentPackageStart) {
+// Package scope ends with the block it's in
+static void endPackageBlock(std::vector<PackageSpan> &packageSpans, std::stack<std::string> &packageStack,
+                            FilePos &currentPackageStart, FilePos end) {
+    if (packageStack.empty()) {
+        std::cerr << "Package analysis failed - package stack empty at end of BlockScope" << std::endl;
+        return;
+    }
+
+    addPackageSpan(packageSpans, PackageSpan(currentPackageStart, end, packageStack.top()));
+    packageStack.pop();
+    currentPackageStart = end;
+}
+
+std::vector<PackageSpan> parsePackages(const ParseTree &tree) {
+    // This is a bit of a pain to do
+    // We can have multiple package statements in a single file. They are constrained to the scope they are in
+    // Blocks come from the bracket index, so this is a single pass over the tokens
     std::vector<PackageSpan> packageSpans;
+    std::stack<std::string> packageStack;
+    packageStack.push("main");  // Perl starts off any file in the main package
+    auto currentPackageStart = FilePos(0);
+    const auto &tokens = tree.tokens;
+    const auto &brackets = tree.brackets;
 
+    // Blocks that have been entered but not closed yet
+    int numOpenBlocks = 0;
     bool isBlockPackage = false;
 
-    for (int childIdx = 0; childIdx < (int) parent->children.size(); childIdx++) {
-        std::shared_ptr<Node> child = parent->children[childIdx];
-        if (std::shared_ptr<BlockNode> blockNode = std::dynamic_pointer_cast<BlockNode>(child)) {
+    for (int i = 0; i < (int) tokens.size(); i++) {
+        const auto &token = tokens[i];
+        if (token.type == TokenType::LBracket) {
             // Going into new scope, push current package onto stack
             if (!isBlockPackage) packageStack.push(packageStack.top());
             isBlockPackage = false;
-            auto morePackages = doParsePackages(blockNode, packageStack, currentPackageStart);
-            if (!morePackages.empty()) {
-                int start = 0;
-                if (!packageSpans.empty() &&
-                    packageSpans[packageSpans.size() - 1].packageName == morePackages[0].packageName) {
-                    // Combine two packages together
-                    start = 1;
-                    packageSpans[packageSpans.size() - 1].end = morePackages[0].end;
-                }
-                for (int i = start; i < (int) morePackages.size(); i++) {
-                    packageSpans.emplace_back(std::move(morePackages[i]));
-                }
+            numOpenBlocks++;
+        } else if (token.type == TokenType::RBracket && brackets.isClose(i)) {
+            endPackageBlock(packageSpans, packageStack, currentPackageStart, token.endPos);
+            numOpenBlocks--;
+        } else if (token.type == TokenType::Package) {
+            // Tokens may or may not have trivia between them, so find the name explicitly
+            int nameIdx = nextTokenIdx(tokens, i, tokens.size());
+            if (nameIdx == -1) continue;
+            auto nameType = tokens[nameIdx].type;
+            if (nameType != TokenType::LBracket && nameType != TokenType::RBracket) i = nameIdx;
+            if (nameType != TokenType::Name) continue;
+
+            // Found a new package definition
+
+            // Check for a package block (i.e. package NAME {...}
+            // This applies only to the next scope
+            int nextTok = nextTokenIdx(tokens, i, tokens.size());
+            if (nextTok > -1 && tokens[nextTok].type == TokenType::LBracket) isBlockPackage = true;
+
+            if (packageStack.empty()) {
+                // Package analysis failed
+                // FIXME Put a proper handling here
+                std::cerr << "Package analysis failed - package stack empty!";
+                return packageSpans;
             }
-        }
 
-        if (std::shared_ptr<TokensNode> tokensNode = std::dynamic_pointer_cast<TokensNode>(child)) {
-            for (int i = 0; i < (int) tokensNode->tokens.size() - 1; i++) {
-                if (tokensNode->tokens[i].type == TokenType::Package) {
-                    auto nextToken = tokensNode->tokens[i + 1];
-                    while (i < tokensNode->tokens.size() && nextToken.isWhitespaceNewlineOrComment()) {
-                        i++;
-                        nextToken = tokensNode->tokens[i];
-                    }
-
-                    if (nextToken.type == TokenType::Name) {
-                        // Found a new package definition
-
-                        // Check for a package block (i.e. package NAME {...}
-                        // This applies only to the next scope
-                        int nextTok = nextTokenIdx(tokensNode->tokens, i);
-                        if (nextTok > -1 && tokensNode->tokens[nextTok].type == TokenType::LBracket &&
-                            childIdx <= parent->children.size() - 2) {
-                            if (std::dynamic_pointer_cast<BlockNode>(parent->children[childIdx + 1]) != nullptr) {
-                                // Indeed we have the block syntax
-                                isBlockPackage = true;
-                            }
-                        }
-
-                        if (packageStack.empty()) {
-                            // Package analysis failed
-                            // FIXME Put a proper handling here
-                            std::cerr << "Package analysis failed - package stack empty!";
-                            return packageSpans;
-                        }
-
-                        std::string prevPackageName = packageStack.top();
-                        if (!isBlockPackage) packageStack.pop();
-                        packageStack.push(nextToken.data);
-
-                        auto packageStart = tokensNode->tokens[i].startPos;
-                        addPackageSpan(packageSpans, PackageSpan(currentPackageStart, packageStart, prevPackageName));
-                        currentPackageStart = packageStart;
-                    }
-                }
-            }
+            std::string prevPackageName = packageStack.top();
+            if (!isBlockPackage) packageStack.pop();
+            packageStack.push(std::string(tokens[i].data));
+
+            auto packageStart = tokens[i].startPos;
+            addPackageSpan(packageSpans, PackageSpan(currentPackageStart, packageStart, prevPackageName));
+            currentPackageStart = packageStart;
         }
     }
 
-    // End of BlockScope
-    if (packageStack.empty()) {
-        std::cerr << "Package analysis failed - package stack empty at end of BlockScope" << std::endl;
-    } else {
-        addPackageSpan(packageSpans, PackageSpan(currentPackageStart, parent->end, packageStack.top()));
-        packageStack.pop();
-        currentPackageStart = parent->end;
+    // Blocks that were never closed end at the end of the program, then the file itself ends
+    for (; numOpenBlocks > 0; numOpenBlocks--) {
+        endPackageBlock(packageSpans, packageStack, currentPackageStart, FilePos());
     }
-
-    return packageSpans;
-}
-
-std::vector<PackageSpan> parsePackages(std::shared_ptr<BlockNode> parent) {
-    // This is a bit of a pain to do
-    // We can have multiple package statements in a single file. They are constrained to the scope they are in
-    std::stack<std::string> packageStack;
-    packageStack.push("main");  // Perl starts off any file in the main package
-    auto start = FilePos(1, 1);
-    auto packageSpans = doParsePackages(parent, packageStack, start);
+    FilePos end = tree.nodes[ParseTree::ROOT].end;
+    endPackageBlock(packageSpans, packageStack, currentPackageStart, end);
 
     if (packageStack.empty()) {
         return packageSpans;
     }
 
-    packageSpans.emplace_back(PackageSpan(start, parent->end, packageStack.top()));
+    packageSpans.emplace_back(PackageSpan(currentPackageStart, end, packageStack.top()));
     return packageSpans;
 }
 
-std::shared_ptr<BlockNode> buildParseTree(std::vector<Token> tokens, int &incorrectNestingStart) {
+ParseTree buildParseTree(const std::vector<Token> &tokens, int &incorrectNestingStart) {
     incorrectNestingStart = -1;
-    auto node = std::make_shared<BlockNode>(FilePos(0, 0));
-    if (tokens.empty()) return node;
+    ParseTree tree(tokens);
+    int root = addNode(tree, NodeType::Block, 0, tokens.size());
+    tree.nodes[root].start = FilePos(0);
+    if (tokens.empty()) return tree;
+
+    tree.nodes[root].end = tokens[tokens.size() - 1].endPos;
+    tree.brackets = BracketIndex(tokens);
+
+    // Only the brackets need looking at, tokens between them are just a span
+    std::vector<int> openBlocks;
+    int tokensStart = 0;
+    for (int bracket : tree.brackets.brackets) {
+        addNode(tree, NodeType::Tokens, tokensStart, bracket + 1);
+        tokensStart = bracket + 1;
+
+        if (tokens[bracket].type == TokenType::LBracket) {
+            int close = tree.brackets.matching(bracket);
+            int child = addNode(tree, NodeType::Block, bracket + 1, close == -1 ? tokens.size() : close + 1);
+            tree.nodes[child].start = tokens[bracket].startPos;
+            if (close != -1) tree.nodes[child].end = tokens[close].endPos;
+            openBlocks.emplace_back(child);
+        } else if (!openBlocks.empty()) {
+            tree.nodes[openBlocks.back()].subtreeEnd = tree.nodes.size();
+            openBlocks.pop_back();
+        } else {
+            // Unmatched '}' ends the top level early, carry on after it
+            tree.nodes[root].end = tokens[bracket].endPos;
+            if (incorrectNestingStart == -1) incorrectNestingStart = tokens[tokens.size() - 1].endPos.position;
+        }
+    }
 
-    node->end = tokens[tokens.size() - 1].endPos;
-    int tokenIdx = 0;
-    doBuildParseTree(node, tokens, tokenIdx);
-    incorrectNestingStart = tokenIdx < tokens.size() ? tokens[tokens.size() - 1].endPos.line : -1;
+    // Add remaining tokens
+    addNode(tree, NodeType::Tokens, tokensStart, tokens.size());
 
-    while (tokenIdx < tokens.size()) {
-        doBuildParseTree(node, tokens, tokenIdx);
+    // Any blocks not closed end with the program, leaving an empty tokens node after each in its parent
+    while (!openBlocks.empty()) {
+        tree.nodes[openBlocks.back()].subtreeEnd = tree.nodes.size();
+        openBlocks.pop_back();
+        addNode(tree, NodeType::Tokens, tokens.size(), tokens.size());
     }
-    return node;
+
+    tree.nodes[root].subtreeEnd = tree.nodes.size();
+    return tree;
 }
 
-Subroutine handleSub(TokenIterator &tokenIter, FilePos subStart, std::vector<PackageSpan> &packages) {
+Subroutine handleSub(TokenIterator &tokenIter, FilePos subStart, const PackageIndex &packages) {
     Subroutine subroutine;
 
-    auto nextTok = tokenIter.next();
+    const Token *nextTok = &tokenIter.next();
     bool unnamed = true;
-    if (nextTok.type == TokenType::SubName) {
+    if (nextTok->type == TokenType::SubName) {
         unnamed = false;
         // If this is not the case then function is unnamed
-        subroutine.name = nextTok.data;
+        subroutine.name = nextTok->data;
         subroutine.code = subroutine.name;  // Keep reference to original code, even after package analysis
-        subroutine.location = Range(nextTok.startPos, nextTok.endPos);
-        nextTok = tokenIter.next();
+        subroutine.location = Range(nextTok->startPos, nextTok->endPos);
+        nextTok = &tokenIter.next();
     }
 
-    while (nextTok.type != TokenType::LBracket && nextTok.type != TokenType::EndOfInput) {
-        if (nextTok.type == TokenType::Signature) subroutine.signature = nextTok.data;
-        if (nextTok.type == TokenType::Prototype) subroutine.prototype = nextTok.data;
-        nextTok = tokenIter.next();
+    while (nextTok->type != TokenType::LBracket && nextTok->type != TokenType::EndOfInput) {
+        if (nextTok->type == TokenType::Signature) subroutine.signature = nextTok->data;
+        if (nextTok->type == TokenType::Prototype) subroutine.prototype = nextTok->data;
+        nextTok = &tokenIter.next();
     }
 
-    auto currentPackage = findPackageAtPos(packages, subroutine.location.from);
+    const auto &currentPackage = packages.packageAt(subroutine.location.from);
     if (unnamed) {
         subroutine.package = currentPackage;
     } else {
@@ -223,9 +224,9 @@ Subroutine handleSub(TokenIterator &tokenIter, FilePos subStart, std::vector<Pac
 
 std::shared_ptr<Variable>
 makeVariable(int id, TokenType type, std::string name, FilePos declaration, FilePos symbolEnd, FilePos scopeEnd,
-             const std::vector<PackageSpan> &packages) {
+             const PackageIndex &packages) {
     if (type == TokenType::Our) {
-        auto package = findPackageAtPos(packages, declaration);
+        const auto &package = packages.packageAt(declaration);
         return std::make_shared<OurVariable>(id, name, declaration, symbolEnd, scopeEnd, package);
     } else if (type == TokenType::My || type == TokenType::State) {
         return std::make_shared<ScopedVariable>(id, name, declaration, symbolEnd, scopeEnd);
@@ -238,16 +239,16 @@ makeVariable(int id, TokenType type, std::string name, FilePos declaration, File
 
 
 std::vector<std::shared_ptr<Variable>>
-handleVariableTokens(TokenIterator &tokensIter, TokenType varKwdTokenType, const std::vector<PackageSpan> &packages,
+handleVariableTokens(TokenIterator &tokensIter, TokenType varKwdTokenType, const PackageIndex &packages,
                      FilePos parentEnd, int &id) {
     std::vector<std::shared_ptr<Variable>> variables;
 
-    auto nextToken = tokensIter.next();
+    const Token *nextToken = &tokensIter.next();
 
-    if (nextToken.type == TokenType::ScalarVariable || nextToken.type == TokenType::HashVariable ||
-        nextToken.type == TokenType::ArrayVariable) {
+    if (nextToken->type == TokenType::ScalarVariable || nextToken->type == TokenType::HashVariable ||
+        nextToken->type == TokenType::ArrayVariable) {
         // We've got a definition!
-        if (auto var = makeVariable(id, varKwdTokenType, nextToken.data, nextToken.startPos, nextToken.endPos,
+        if (auto var = makeVariable(id, varKwdTokenType, std::string(nextToken->data), nextToken->startPos, nextToken->endPos,
                                     parentEnd,
                                     packages)) {
             variables.emplace_back(var);
@@ -256,23 +257,23 @@ handleVariableTokens(TokenIterator &tokensIter, TokenType varKwdTokenType, const
 
         // Finally, if combined assignment then skip past Assignment token to prevent confusion with
         // package variables below
-        nextToken = tokensIter.next();
-        if (nextToken.type == TokenType::Assignment) {
-            nextToken = tokensIter.next();
+        nextToken = &tokensIter.next();
+        if (nextToken->type == TokenType::Assignment) {
+            nextToken = &tokensIter.next();
         }
-    } else if (nextToken.type == TokenType::LParen) {
+    } else if (nextToken->type == TokenType::LParen) {
         // my ($x, $y) syntax - combined declaration. Consider every variable inside
-        while (nextToken.type != TokenType::RParen && nextToken.type != TokenType::EndOfInput) {
-            if (nextToken.type == TokenType::ScalarVariable || nextToken.type == TokenType::HashVariable ||
-                nextToken.type == TokenType::ArrayVariable) {
+        while (nextToken->type != TokenType::RParen && nextToken->type != TokenType::EndOfInput) {
+            if (nextToken->type == TokenType::ScalarVariable || nextToken->type == TokenType::HashVariable ||
+                nextToken->type == TokenType::ArrayVariable) {
                 // Variable!
-                if (auto var = makeVariable(id, varKwdTokenType, nextToken.data, nextToken.startPos, nextToken.endPos,
+                if (auto var = makeVariable(id, varKwdTokenType, std::string(nextToken->data), nextToken->startPos, nextToken->endPos,
                                             parentEnd, packages)) {
                     variables.emplace_back(var);
                     id++;
                 }
             }
-            nextToken = tokensIter.next();
+            nextToken = &tokensIter.next();
         }
 
     }
@@ -288,122 +289,253 @@ std::optional<Import> handleRequire(TokenIterator &tokenIter, FilePos location)
                       std::vector<std::string>());
     }
 
-    Token next = tokenIter.next();
+    const Token &next = tokenIter.next();
     if (next.type == TokenType::Name) {
         // require Math::Calc;
-        return Import(location, ImportType::Module, ImportMechanism::Require, next.data, std::vector<std::string>());
+        return Import(location, ImportType::Module, ImportMechanism::Require, std::string(next.data), std::vector<std::string>());
     }
 
     return std::optional<Import>();
 }
 
+// use lib "dir", qw(more dirs). The directories are kept as the export list
+static std::optional<Import> handleUseLib(TokenIterator &tokenIter, FilePos location) {
+    std::vector<std::string> directories;
+    while (true) {
+        bool quoteWords = tokenIter.peek().type == TokenType::QuoteIdent && tokenIter.peek().data == "qw";
+        auto maybeString = tokenIter.tryGetString();
+        if (!maybeString.has_value()) break;
+
+        if (quoteWords) {
+            std::istringstream words(maybeString.value());
+            std::string word;
+            while (words >> word) directories.emplace_back(word);
+        } else {
+            directories.emplace_back(maybeString.value());
+        }
+
+        if (tokenIter.peek().type == TokenType::StringEnd) tokenIter.next();
+        if (tokenIter.peek().type != TokenType::Comma) break;
+        tokenIter.next();
+    }
+
+    if (directories.empty()) return std::optional<Import>();
+    return Import(location, ImportType::Lib, ImportMechanism::Use, "lib", directories);
+}
+
 std::optional<Import> handleUse(TokenIterator &tokenIter, FilePos location) {
-    Token token = tokenIter.next();
+    const Token *token = &tokenIter.next();
     std::string moduleName;
     std::vector<std::string> exportList;
-    moduleName = token.data;
-    if (token.type == TokenType::Name) {
+    moduleName = token->data;
+    if (token->type == TokenType::Name) {
+        if (moduleName == "lib") return handleUseLib(tokenIter, location);
+
         // Check if module name is pragmatic
-        for (const auto &pragmatic : constant::PRAGMATIC_MODULES) {
-            if (moduleName == pragmatic) return std::optional<Import>();
-        }
+        if (lexicon::PRAGMATIC_MODULES.contains(moduleName)) return std::optional<Import>();
     } else {
         return std::optional<Import>();
     }
 
-    token = tokenIter.next();
-    if (token.type == TokenType::NumericLiteral || token.type == TokenType::VersionLiteral) {
-        token = tokenIter.next();
+    token = &tokenIter.next();
+    if (token->type == TokenType::NumericLiteral || token->type == TokenType::VersionLiteral) {
+        token = &tokenIter.next();
     }
 
     // At this point we have `use Module Version?`
     // Could have list at the end
-    if (token.type == TokenType::QuoteIdent) token = tokenIter.next();
-    if (token.type == TokenType::StringStart) {
-        token = tokenIter.next();
-        exportList = split(token.data, " ");
+    if (token->type == TokenType::QuoteIdent) token = &tokenIter.next();
+    if (token->type == TokenType::StringStart) {
+        token = &tokenIter.next();
+        exportList = split(std::string(token->data), " ");
     }
 
     return Import(location, ImportType::Module, ImportMechanism::Use, moduleName, exportList);
 }
 
-std::optional<Constant> handleConstant(TokenIterator &tokenIter, const std::vector<PackageSpan> &packages) {
-    Token nextConst = tokenIter.next();
+std::optional<Constant> handleConstant(TokenIterator &tokenIter, const PackageIndex &packages) {
+    const Token &nextConst = tokenIter.next();
     if (nextConst.type != TokenType::Name || nextConst.data != "constant") return {};
-    Token tokenName = tokenIter.next();
+    const Token &tokenName = tokenIter.next();
     if (tokenName.type != TokenType::HashKey || tokenName.data.empty()) return {};
-    auto package = findPackageAtPos(packages, tokenName.startPos);
-    std::string constantName = tokenName.data;
+    const auto &package = packages.packageAt(tokenName.startPos);
+    std::string constantName(tokenName.data);
     std::string canonicalConstantName = getCanonicalPackageName(constantName);
     PackagedSymbol constantSymbol = splitOnPackage(canonicalConstantName, package);
     return Constant(constantSymbol.package, constantSymbol.symbol, tokenName.startPos);
 }
 
-void doParseFirstPass(const std::shared_ptr<BlockNode> &tree, const std::shared_ptr<SymbolNode> &symbolNode,
-                      FileSymbols &fileSymbols, std::vector<std::string> &variables,
-                      int lastId) {
+// Add the declarations in a tokens node to the innermost scope (variables) or fileSymbols (everything else)
+static void parseTokensNode(const ParseTree &tree, int tokensNode, const FilePos &scopeEnd,
+                            std::vector<LexicalScope> &scopes, FileSymbols &fileSymbols, const PackageIndex &packages,
+                            int &lastId) {
+    TokenIterator tokenIter = tree.tokenIterator(tokensNode, TRIVIA_TOKENS);
+    const Token *token = &tokenIter.next();
+
+    while (token->type != TokenType::EndOfInput) {
+        auto tokenType = token->type;
+        if (tokenType == TokenType::My || tokenType == TokenType::Our || tokenType == TokenType::Local ||
+            tokenType == TokenType::State) {
+            auto newVariables = handleVariableTokens(tokenIter, tokenType, packages, scopeEnd, lastId);
+            for (auto &variable : newVariables) scopes.back().addVariable(variable);
+
+        } else if (tokenType == TokenType::Sub) {
+            auto sub = handleSub(tokenIter, token->startPos, packages);
+            fileSymbols.subroutineDeclarations[sub.getFullName()] = std::make_shared<Subroutine>(sub);
+        } else if (tokenType == TokenType::Require) {
+            auto import = handleRequire(tokenIter, token->startPos);
+            if (import.has_value()) {
+                fileSymbols.imports.emplace_back(import.value());
+            }
+        } else if (tokenType == TokenType::Use) {
+            const Token &next = tokenIter.peek();
+            if (next.type == TokenType::Name && next.data == "constant") {
+                if (auto constant = handleConstant(tokenIter, packages)) {
+                    fileSymbols.constants.emplace_back(constant.value());
+                }
+            } else {
+                auto import = handleUse(tokenIter, token->startPos);
+                if (import.has_value()) {
+                    fileSymbols.imports.emplace_back(import.value());
+                }
+            }
+        }
+        token = &tokenIter.next();
+    }
+}
 
-    for (const auto &child : tree->children) {
-        if (std::shared_ptr<BlockNode> blockNode = std::dynamic_pointer_cast<BlockNode>(child)) {
+void doParseFileSymbols(const ParseTree &tree, int block, std::vector<LexicalScope> &scopes,
+                        FileSymbols &fileSymbols, const PackageIndex &packages,
+                        std::vector<std::vector<SymbolUsage>> &usages, int lastId) {
+    const Node &blockNode = tree.nodes[block];
+    auto symbolNode = scopes.back().symbolNode;
+    // Scopes are visited in the same order as the symbol tree, so usages can be added in that order at the end
+    int scopeUsages = usages.size();
+    usages.emplace_back();
+
+    for (int child = tree.firstChild(block); child != -1; child = tree.nextSibling(block, child)) {
+        const Node &childNode = tree.nodes[child];
+        if (childNode.type == NodeType::Block) {
             // Create new child for symbol tree
-            auto symbolChild = std::make_shared<SymbolNode>(blockNode->start, blockNode->end, blockNode);
-            symbolNode->children.emplace_back(symbolChild);
-            doParseFirstPass(blockNode, symbolChild, fileSymbols, variables, lastId);
+            auto symbolChild = std::make_shared<SymbolNode>(childNode.start, childNode.end);
+            symbolNode->addChild(symbolChild);
+            scopes.emplace_back(symbolChild);
+            doParseFileSymbols(tree, child, scopes, fileSymbols, packages, usages, lastId);
+            scopes.pop_back();
         }
 
-        if (std::shared_ptr<TokensNode> tokensNode = std::dynamic_pointer_cast<TokensNode>(child)) {
-            TokenIterator tokenIter(tokensNode->tokens,
-                                    std::vector<TokenType>{TokenType::Whitespace, TokenType::Comment,
-                                                           TokenType::Newline});
-            Token token = tokenIter.next();
-
-            while (token.type != TokenType::EndOfInput) {
-                auto tokenType = token.type;
-                if (tokenType == TokenType::My || tokenType == TokenType::Our || tokenType == TokenType::Local ||
-                    tokenType == TokenType::State) {
-                    auto newVariables = handleVariableTokens(tokenIter, tokenType, fileSymbols.packages, tree->end,
-                                                             lastId);
-                    for (auto &variable : newVariables) {
-                        symbolNode->variables.emplace_back(variable);
-                        variables.emplace_back(variable->name);
-                    }
-
-                } else if (tokenType == TokenType::Sub) {
-                    auto sub = handleSub(tokenIter, token.startPos, fileSymbols.packages);
-                    fileSymbols.subroutineDeclarations[sub.getFullName()] = std::make_shared<Subroutine>(sub);
-                } else if (tokenType == TokenType::Require) {
-                    auto import = handleRequire(tokenIter, token.startPos);
-                    if (import.has_value()) {
-                        fileSymbols.imports.emplace_back(import.value());
-                    }
-                } else if (tokenType == TokenType::Use) {
-                    auto next = tokenIter.peek();
-                    if (next.type == TokenType::Name && next.data == "constant") {
-                        if (auto constant = handleConstant(tokenIter, fileSymbols.packages)) {
-                            fileSymbols.constants.emplace_back(constant.value());
-                        }
-                    } else {
-                        auto import = handleUse(tokenIter, token.startPos);
-                        if (import.has_value()) {
-                            fileSymbols.imports.emplace_back(import.value());
-                        }
-                    }
-                }
-                token = tokenIter.next();
-            }
+        if (childNode.type == NodeType::Tokens) {
+            parseTokensNode(tree, child, blockNode.end, scopes, fileSymbols, packages, lastId);
+
+            // Everything declared up to the end of these tokens is known, which is all a usage in them can refer to
+            findScopeUsages(tree, child, scopes, usages[scopeUsages]);
         }
     }
+
+    symbolNode->indexVariables();
+}
+
+/**
+ * parseFileSymbols for a large file, on several threads.
+ *
+ * A top level block only depends on the file scope declarations before it. So after a walk over just the file scope,
+ * each top level block is analysed on its own and the results are merged back in file order. Lookups only see
+ * declarations made before the usage, so the complete file scope gives a block the same answers as it would have had
+ * partway through a single walk.
+ */
+static void parseFileSymbolsInParallel(const ParseTree &tree, std::vector<LexicalScope> &scopes,
+                                       FileSymbols &fileSymbols, const PackageIndex &packages, int threads) {
+    struct TopLevelBlock {
+        int node;
+        std::shared_ptr<SymbolNode> symbolNode;
+        // Id of the next variable declared in the block
+        int lastId;
+    };
+
+    const Node &root = tree.nodes[ParseTree::ROOT];
+    auto symbolNode = scopes.back().symbolNode;
+    std::vector<TopLevelBlock> blocks;
+    std::vector<std::vector<SymbolUsage>> fileUsages(1);
+    int lastId = 0;
+
+    // Subroutines, imports and constants keep their order by being collected in parts. Part i has those from the file
+    // scope before block i followed by those in block i, and the last part has the ones after the last block
+    std::vector<FileSymbols> declarations(1);
+    for (int child = tree.firstChild(ParseTree::ROOT); child != -1; child = tree.nextSibling(ParseTree::ROOT, child)) {
+        const Node &childNode = tree.nodes[child];
+        if (childNode.type == NodeType::Block) {
+            auto symbolChild = std::make_shared<SymbolNode>(childNode.start, childNode.end);
+            symbolNode->addChild(symbolChild);
+            blocks.emplace_back(TopLevelBlock{child, symbolChild, lastId});
+            declarations.emplace_back();
+        }
+
+        if (childNode.type == NodeType::Tokens) {
+            parseTokensNode(tree, child, root.end, scopes, declarations.back(), packages, lastId);
+            findScopeUsages(tree, child, scopes, fileUsages[0]);
+        }
+    }
+    symbolNode->indexVariables();
+
+    // The file scope is only read from now on, but each thread needs its own stack of scopes below it
+    std::vector<std::vector<LexicalScope>> threadScopes(threads, scopes);
+    std::vector<std::vector<std::vector<SymbolUsage>>> blockUsages(blocks.size());
+    parallelFor(blocks.size(), threads, [&](int i, int thread) {
+        auto &blockScopes = threadScopes[thread];
+        blockScopes.emplace_back(blocks[i].symbolNode);
+        doParseFileSymbols(tree, blocks[i].node, blockScopes, declarations[i], packages, blockUsages[i],
+                           blocks[i].lastId);
+        blockScopes.pop_back();
+    });
+
+    for (auto &part : declarations) mergeFileSymbols(fileSymbols, std::move(part));
+
+    // Subroutines can be used before they are declared, so names are only resolved now they are all known. The file
+    // scope's usages come first, as in the symbol tree
+    std::vector<FileSymbols> usages(blocks.size() + 1);
+    parallelFor(usages.size(), threads, [&](int i, int) {
+        addSymbolUsages(fileSymbols, usages[i], packages, i == 0 ? fileUsages : blockUsages[i - 1]);
+    });
+
+    for (auto &part : usages) mergeFileSymbols(fileSymbols, std::move(part));
+}
+
+// Threads to analyse a file on when the caller leaves it up to parseFileSymbols
+static int analysisThreads(const ParseTree &tree) {
+    if (tree.tokens.size() < constant::PARALLEL_ANALYSIS_MIN_TOKENS) return 1;
+
+    // Files loaded on a pool already have the other threads busy with other files
+    if (ThreadPool::onPoolThread()) return 1;
+    int hardwareThreads = std::thread::hardware_concurrency();
+    return std::max(1, std::min(hardwareThreads, constant::PARALLEL_ANALYSIS_MAX_THREADS));
 }
 
 /**
- * Do first pass parsing on tree structure
+ * Find the packages, symbols and usages in a file. After the packages are known the rest is found in a single walk
+ * over the tree, as the declarations a variable can refer to are all before it
  * @param tree
  * @param fileSymbols
- * @param enableLocalVariables - If set to false, will skip out local variable declarations. Useful for system files
+ * @param threads Threads to use for large files. 0 picks a number from the file's size and the hardware, 1 disables
+ * parallel analysis
  */
-void parseFirstPass(std::shared_ptr<BlockNode> tree, FileSymbols &fileSymbols) {
-    std::vector<std::string> variables;
-    auto symbolNode = std::make_shared<SymbolNode>(tree->start, tree->end, tree);
-    doParseFirstPass(tree, symbolNode, fileSymbols, variables, 0);
+void parseFileSymbols(const ParseTree &tree, FileSymbols &fileSymbols, int threads) {
+    fileSymbols.packages = parsePackages(tree);
+    PackageIndex packages(fileSymbols.packages);
+
+    const Node &root = tree.nodes[ParseTree::ROOT];
+    auto symbolNode = std::make_shared<SymbolNode>(root.start, root.end);
+    std::vector<LexicalScope> scopes{LexicalScope(symbolNode)};
     fileSymbols.symbolTree = symbolNode;
-}
\ No newline at end of file
+
+    if (threads == 0) threads = analysisThreads(tree);
+    if (threads > 1) {
+        parseFileSymbolsInParallel(tree, scopes, fileSymbols, packages, threads);
+        return;
+    }
+
+    std::vector<std::vector<SymbolUsage>> usages;
+    doParseFileSymbols(tree, ParseTree::ROOT, scopes, fileSymbols, packages, usages, 0);
+
+    // Subroutines can be used before they are declared, so names are only resolved now
+    addSymbolUsages(fileSymbols, fileSymbols, packages, usages);
+}
@@ -14,12 +14,12 @@
 #include "Package.h"
 #include "Constants.h"
 
-std::shared_ptr<BlockNode> buildParseTree(std::vector<Token> tokens, int &);
+ParseTree buildParseTree(const std::vector<Token> &tokens, int &);
 
-std::vector<PackageSpan> parsePackages(std::shared_ptr<BlockNode> parent);
+std::vector<PackageSpan> parsePackages(const ParseTree &tree);
 
-void printParseTree(std::shared_ptr<Node> root);
+void printParseTree(const ParseTree &tree);
 
-void parseFirstPass(std::shared_ptr<BlockNode> tree, FileSymbols &fileSymbols);
+void parseFileSymbols(const ParseTree &tree, FileSymbols &fileSymbols, int threads = 0);
 
 #endif //PERLPARSER_PARSER_H
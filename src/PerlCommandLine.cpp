@@ -42,16 +42,23 @@ RunResult runCommand(const std::string &perlPath, const std::string &arguments)
 }
 
 std::vector<std::string> getIncludePaths(const std::string &contextDir) {
-    auto includeCommandRes = runCommand("perl", "-e \"print join('\n', @INC)\"");
+    // @INC only depends on the perl and environment the server was started with, so only start perl the first time
+    static std::vector<std::string> perlIncludePaths;
+    static std::once_flag ranPerl;
+    std::call_once(ranPerl, [] {
+        perlIncludePaths = runCommand("perl", "-e \"print join('\n', @INC)\"").output;
+    });
+
+    auto includePaths = perlIncludePaths;
 
     // TODO Do proper path expansion
-    for (auto &i : includeCommandRes.output) {
+    for (auto &i : includePaths) {
         if (i == ".") {
             i = contextDir;
         }
     }
 
-    return includeCommandRes.output;
+    return includePaths;
 }
 
 std::optional<std::string>
@@ -67,13 +74,9 @@ resolveModulePath(const std::vector<std::string> &includePaths, const std::vecto
 }
 
 std::optional<std::string> resolvePath(const std::vector<std::string> &includePaths, const std::string &path) {
-    for (const auto &includePath : includePaths) {
-        auto fullPath = includePath + "/" + path;
-        std::ifstream f(fullPath);
-        if (f.good()) return fullPath;
-    }
-
-    return std::optional<std::string>();
+    // Shared by every lookup, so each include directory is only listed once
+    static IncludeIndex includeIndex;
+    return includeIndex.resolve(includePaths, path);
 }
 
 std::string RunResult::toStr() {
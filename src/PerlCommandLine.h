@@ -8,10 +8,12 @@
 #include "PerlProject.h"
 #include "../lib/pstreams.h"
 #include "Util.h"
+#include "IncludeIndex.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
 #include <optional>
+#include <mutex>
 
 struct RunResult {
     // Each element represents a new line
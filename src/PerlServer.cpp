@@ -25,7 +25,20 @@ void sendJson(httplib::Response &res, std::string error = "", std::string errorM
     sendJson(res, null, std::move(error), std::move(errorMessage));
 }
 
-void handleAutocompleteVariable(httplib::Response &res, json params, Cache &cache) {
+// Analysis works with offsets into files, while requests and responses have lines and columns. The lines of each file
+// are kept with its cached symbols
+static std::shared_ptr<const LineIndex> linesOf(const std::string &path, Cache &cache) {
+    return analysis::getLineIndex(path, cache);
+}
+
+// Lines of a file positions are given in. Those in the file being edited are in its saved copy at path, rather than its
+// real location (context)
+static std::shared_ptr<const LineIndex>
+linesOf(const std::string &file, const std::string &path, const std::string &context, Cache &cache) {
+    return linesOf(file == context ? path : file, cache);
+}
+
+void handleAutocompleteVariable(httplib::Response &res, json params, Cache &cache, ProjectGraph &projectGraph) {
     if (!params.contains("path") || !params.contains("sigil")) {
         sendJson(res, "BAD_PARAMS", "Bad parameters");
         return;
@@ -42,8 +55,14 @@ void handleAutocompleteVariable(httplib::Response &res, json params, Cache &cach
 
     std::vector<AutocompleteItem> completeItems;
     try {
-        completeItems = analysis::autocompleteVariables(params["path"], params["context"], FilePos(line, col),
-                                                        params["projectFiles"], std::string(params["sigil"])[0], cache);
+        std::string path = params["path"];
+        auto location = linesOf(path, cache)->filePos(line, col);
+        if (location.position == -1) {
+            sendJson(res, "BAD_PARAMS", "Position is outside the file");
+            return;
+        }
+        completeItems = analysis::autocompleteVariables(path, params["context"], location, params["projectFiles"],
+                                                        std::string(params["sigil"])[0], cache, projectGraph);
     } catch (IOException &) {
         sendJson(res, "PATH_NOT_FOUND", "File " + std::string(params["path"]) + " not found");
         return;
@@ -65,7 +84,7 @@ void handleAutocompleteVariable(httplib::Response &res, json params, Cache &cach
     sendJson(res, response);
 }
 
-void handleAutocompleteSubroutine(httplib::Response &res, json params, Cache &cache) {
+void handleAutocompleteSubroutine(httplib::Response &res, json params, Cache &cache, ProjectGraph &projectGraph) {
     std::string path = params["path"];
     int line, col;
     try {
@@ -78,8 +97,13 @@ void handleAutocompleteSubroutine(httplib::Response &res, json params, Cache &ca
 
     std::vector<AutocompleteItem> completeItems;
     try {
-        completeItems = analysis::autocompleteSubs(path, params["context"], FilePos(line, col), params["projectFiles"],
-                                                   cache);
+        auto location = linesOf(path, cache)->filePos(line, col);
+        if (location.position == -1) {
+            sendJson(res, "BAD_PARAMS", "Position is outside the file");
+            return;
+        }
+        completeItems = analysis::autocompleteSubs(path, params["context"], location, params["projectFiles"], cache,
+                                                   projectGraph);
     } catch (IOException &) {
         sendJson(res, "PATH_NOT_FOUND", "File " + path + " not found");
         return;
@@ -101,7 +125,7 @@ void handleAutocompleteSubroutine(httplib::Response &res, json params, Cache &ca
     sendJson(res, response);
 }
 
-void handleFindUsages(httplib::Response &res, json params, Cache &cache) {
+void handleFindUsages(httplib::Response &res, json params, Cache &cache, ProjectGraph &projectGraph) {
     try {
         std::string path = params["path"];
         std::string contextPath = params["context"];
@@ -109,16 +133,27 @@ void handleFindUsages(httplib::Response &res, json params, Cache &cache) {
         int col = params["col"];
         std::vector<std::string> projectFiles = params["projectFiles"];
 
+        auto location = linesOf(path, cache)->filePos(line, col);
+        if (location.position == -1) {
+            sendJson(res, "BAD_PARAMS", "Position is outside the file");
+            return;
+        }
         std::map<std::string, std::vector<std::vector<int>>> jsonFrom;
-        for (const auto &fileWithUsages : analysis::findUsages(path, contextPath, FilePos(line, col),
-                                                               projectFiles, cache)) {
+        for (auto &fileWithUsages : analysis::findUsages(path, contextPath, location, projectFiles, cache,
+                                                         projectGraph)) {
+            auto &usages = fileWithUsages.second;
+            if (usages.empty()) continue;
+
+            // In order, so finding each line is usually just a step on from the last
+            std::sort(usages.begin(), usages.end(), [](const Range &a, const Range &b) { return a.from < b.from; });
+            auto lines = linesOf(fileWithUsages.first, path, contextPath, cache);
+            int lineHint = 0;
             std::vector<std::vector<int>> fileLocations;
-            for (const Range &usage : fileWithUsages.second) {
-                fileLocations.emplace_back(std::vector<int>{usage.from.line, usage.from.col});
+            for (const Range &usage : usages) {
+                auto lineCol = lines->lineCol(usage.from, lineHint);
+                fileLocations.emplace_back(std::vector<int>{lineCol.line, lineCol.col});
             }
-
-            std::sort(fileLocations.begin(), fileLocations.end());
-            if (!fileLocations.empty()) jsonFrom[fileWithUsages.first] = fileLocations;
+            jsonFrom[fileWithUsages.first] = fileLocations;
         }
 
         json response = jsonFrom;
@@ -126,12 +161,15 @@ void handleFindUsages(httplib::Response &res, json params, Cache &cache) {
     } catch (json::exception &) {
         sendJson(res, "BAD_PARAMS", "Bad Params");
         return;
+    } catch (IOException &) {
+        sendJson(res, "PATH_NOT_FOUND", "File not found");
+        return;
     }
 
 }
 
 
-void handleFindDeclaration(httplib::Response &res, json params, Cache &cache) {
+void handleFindDeclaration(httplib::Response &res, json params, Cache &cache, ProjectGraph &projectGraph) {
     std::string path = params["path"];
     std::string context = params["context"];
     std::vector<std::string> projectFiles = params["projectFiles"];
@@ -140,22 +178,38 @@ void handleFindDeclaration(httplib::Response &res, json params, Cache &cache) {
 
     // TODO expand search to multiple files
     json response;
-    auto maybeDecl = analysis::findVariableDeclaration(path, FilePos(line, col));
-    if (maybeDecl.has_value()) {
-        response["exists"] = true;
-        response["file"] = context;
-        response["line"] = maybeDecl.value().line;
-        response["col"] = maybeDecl.value().col;
-    } else {
-        auto maybeSub = analysis::findSubroutineDeclaration(path, context, FilePos(line, col), projectFiles, cache);
-        if (maybeSub.has_value()) {
+    try {
+        auto lines = linesOf(path, cache);
+        auto location = lines->filePos(line, col);
+        if (location.position == -1) {
+            sendJson(res, "BAD_PARAMS", "Position is outside the file");
+            return;
+        }
+
+        auto maybeDecl = analysis::findVariableDeclaration(path, location);
+        if (maybeDecl.has_value()) {
+            auto declaration = lines->lineCol(maybeDecl.value());
             response["exists"] = true;
-            response["file"] = maybeSub.value().path;
-            response["line"] = maybeSub.value().pos.line;
-            response["col"] = maybeSub.value().pos.col;
+            response["file"] = context;
+            response["line"] = declaration.line;
+            response["col"] = declaration.col;
         } else {
-            response["exists"] = false;
+            auto maybeSub = analysis::findSubroutineDeclaration(path, context, location, projectFiles, cache,
+                                                                projectGraph);
+            if (maybeSub.has_value()) {
+                auto subLines = linesOf(maybeSub.value().path, path, context, cache);
+                auto declaration = subLines->lineCol(maybeSub.value().pos);
+                response["exists"] = true;
+                response["file"] = maybeSub.value().path;
+                response["line"] = declaration.line;
+                response["col"] = declaration.col;
+            } else {
+                response["exists"] = false;
+            }
         }
+    } catch (IOException &) {
+        sendJson(res, "PATH_NOT_FOUND", "File not found");
+        return;
     }
 
     sendJson(res, response);
@@ -173,35 +227,57 @@ void handleIndexProject(httplib::Response &res, json params, Cache &cache) {
     sendJson(res, response);
 }
 
-void handleIsSymbol(httplib::Response &res, json params, Cache &cache) {
+void handleIsSymbol(httplib::Response &res, json params, Cache &cache, ProjectGraph &projectGraph) {
     int line = params["line"];
     int col = params["col"];
     std::string path = params["path"];
     std::vector<std::string> projectFiles = params["projectFiles"];
     json response;
 
-    if (auto symbolName = analysis::getSymbolName(path, FilePos(line, col), projectFiles, cache)) {
-        response["exists"] = true;
-        response["name"] = symbolName.value();
-    } else {
-        response["exists"] = false;
+    try {
+        auto location = linesOf(path, cache)->filePos(line, col);
+        if (location.position == -1) {
+            sendJson(res, "BAD_PARAMS", "Position is outside the file");
+            return;
+        }
+
+        if (auto symbolName = analysis::getSymbolName(path, location, projectFiles, cache, projectGraph)) {
+            response["exists"] = true;
+            response["name"] = symbolName.value();
+        } else {
+            response["exists"] = false;
+        }
+    } catch (IOException &) {
+        sendJson(res, "PATH_NOT_FOUND", "File not found");
+        return;
     }
 
     sendJson(res, response);
 }
 
-void handleRenameSymbol(httplib::Response &res, json params, Cache &cache) {
+void handleRenameSymbol(httplib::Response &res, json params, Cache &cache, ProjectGraph &projectGraph) {
     int line = params["line"];
     int col = params["col"];
     std::string path = params["path"];
     std::vector<std::string> projectFiles = params["projectFiles"];
     std::string renameTo = params["renameTo"];
     json response;
-    auto renameRes = analysis::renameSymbol(path, FilePos(line, col), renameTo, projectFiles, cache);
-    if (renameRes.success) {
-        sendJson(res, response);
-    } else {
-        sendJson(res, "BAD_RENAME", renameRes.error);
+    try {
+        auto location = linesOf(path, cache)->filePos(line, col);
+        if (location.position == -1) {
+            sendJson(res, "BAD_PARAMS", "Position is outside the file");
+            return;
+        }
+
+        auto renameRes = analysis::renameSymbol(path, location, renameTo, projectFiles, cache, projectGraph);
+        if (renameRes.success) {
+            sendJson(res, response);
+        } else {
+            sendJson(res, "BAD_RENAME", renameRes.error);
+        }
+    } catch (IOException &) {
+        sendJson(res, "PATH_NOT_FOUND", "File not found");
+        return;
     }
 }
 
@@ -210,6 +286,7 @@ void startAndBlock(int port) {
 
     // Setup cache
     Cache cache;
+    ProjectGraph projectGraph;
     // Mutex to only allow one request at once
     std::mutex mutex;
 
@@ -237,19 +314,19 @@ void startAndBlock(int port) {
         try {
             json params = reqJson["params"];
             if (reqJson["method"] == "autocomplete-var") {
-                handleAutocompleteVariable(res, params, cache);
+                handleAutocompleteVariable(res, params, cache, projectGraph);
             } else if (reqJson["method"] == "autocomplete-sub") {
-                handleAutocompleteSubroutine(res, params, cache);
+                handleAutocompleteSubroutine(res, params, cache, projectGraph);
             } else if (reqJson["method"] == "find-usages") {
-                handleFindUsages(res, params, cache);
+                handleFindUsages(res, params, cache, projectGraph);
             } else if (reqJson["method"] == "find-declaration") {
-                handleFindDeclaration(res, params, cache);
+                handleFindDeclaration(res, params, cache, projectGraph);
             } else if (reqJson["method"] == "index-project") {
                 handleIndexProject(res, params, cache);
             } else if (reqJson["method"] == "is-symbol") {
-                handleIsSymbol(res, params, cache);
+                handleIsSymbol(res, params, cache, projectGraph);
             } else if (reqJson["method"] == "rename") {
-                handleRenameSymbol(res, params, cache);
+                handleRenameSymbol(res, params, cache, projectGraph);
             } else {
                 sendJson(res, "UNKNOWN_METHOD", "Method " + std::string(reqJson["method"]) + " not supported");
                 return;
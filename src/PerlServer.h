@@ -7,6 +7,7 @@
 
 #include "IOException.h"
 #include "FileAnalysis.h"
+#include "LineIndex.h"
 #include "../lib/json.hpp"
 #include "../lib/httplib.h"
 #include "Cache.h"
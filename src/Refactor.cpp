@@ -21,21 +21,33 @@ Replacement::Replacement() {
     this->replacement = "";
 }
 
-std::string doReplacements(std::string str, std::vector<Replacement> replacements) {
-    auto oldContents = str;
-    for (int i = 0; i < replacements.size(); i++) {
-        auto replacement = replacements[i];
-        int len = (replacement.location.to.position - replacement.location.from.position) + 1;
-        str.replace(replacement.location.from.position, len, replacement.replacement);
-
-
-        int delta = replacement.replacement.size() - len;
-        for (int j = i + 1; j < replacements.size(); j++) {
-            replacements[j].location.from.position += delta;
-            replacements[j].location.to.position += delta;
-
-        }
+std::optional<std::string> doReplacements(const std::string &str, std::vector<Replacement> replacements) {
+    // Positions are offsets into str, so the new text can be built in one pass through the replacements in order
+    std::sort(replacements.begin(), replacements.end(), [](const Replacement &a, const Replacement &b) {
+        if (a.location.from == b.location.from) return a.location.to < b.location.to;
+        return a.location.from < b.location.from;
+    });
+
+    // The same usage can be found more than once, e.g. through two imports of a sub
+    replacements.erase(std::unique(replacements.begin(), replacements.end(),
+                                   [](const Replacement &a, const Replacement &b) {
+                                       return a.location.from == b.location.from && a.location.to == b.location.to &&
+                                              a.replacement == b.replacement;
+                                   }), replacements.end());
+
+    std::string replaced;
+    replaced.reserve(str.size());
+    int copied = 0;
+    for (const auto &replacement : replacements) {
+        int from = replacement.location.from.position;
+        int to = replacement.location.to.position + 1;
+        if (from < copied || to < from || to > (int) str.size()) return std::nullopt;
+
+        replaced.append(str, copied, from - copied);
+        replaced += replacement.replacement;
+        copied = to;
     }
 
-    return str;
+    replaced.append(str, copied, std::string::npos);
+    return replaced;
 }
@@ -9,6 +9,8 @@
 #include "Symbols.h"
 #include "Package.h"
 #include "FileAnalysis.h"
+#include <algorithm>
+#include <optional>
 #include <vector>
 #include <unordered_map>
 
@@ -34,7 +36,9 @@ struct Replacement {
     void applyPosDelta(int delta);
 };
 
-std::string doReplacements(std::string str, std::vector<Replacement> replacements);
+// Apply replacements to str, whose positions are all in str as it was before any of them. Exact duplicates are only
+// applied once; if any others overlap, or one isn't inside str, nothing is replaced and nullopt is returned
+std::optional<std::string> doReplacements(const std::string &str, std::vector<Replacement> replacements);
 
 
 #endif //PERLPARSE_REFACTOR_H
@@ -0,0 +1,110 @@
+#include "Scan.h"
+
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+scan::StopChars::StopChars(std::initializer_list<char> chars) {
+    if (chars.size() > MAX_STOP_CHARS) throw std::logic_error("More stop characters than scan::MAX_STOP_CHARS");
+    for (char c : chars) this->chars[size++] = c;
+}
+
+static std::size_t findFirstOfScalar(const char *data, std::size_t from, std::size_t size,
+                                     const scan::StopChars &stop) {
+    for (std::size_t i = from; i < size; i++) {
+        for (int j = 0; j < stop.size; j++) {
+            if (data[i] == stop.chars[j]) return i;
+        }
+    }
+
+    return size;
+}
+
+#ifdef SCAN_X86
+
+static std::size_t findFirstOfSSE2(const char *data, std::size_t from, std::size_t size,
+                                   const scan::StopChars &stop) {
+    __m128i needles[scan::MAX_STOP_CHARS];
+    for (int j = 0; j < stop.size; j++) needles[j] = _mm_set1_epi8(stop.chars[j]);
+
+    std::size_t i = from;
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i matches = _mm_setzero_si128();
+        for (int j = 0; j < stop.size; j++) matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, needles[j]));
+        int mask = _mm_movemask_epi8(matches);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    return findFirstOfScalar(data, i, size, stop);
+}
+
+__attribute__((target("avx2")))
+static std::size_t findFirstOfAVX2(const char *data, std::size_t from, std::size_t size,
+                                   const scan::StopChars &stop) {
+    __m256i needles[scan::MAX_STOP_CHARS];
+    for (int j = 0; j < stop.size; j++) needles[j] = _mm256_set1_epi8(stop.chars[j]);
+
+    std::size_t i = from;
+    for (; i + 32 <= size; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i matches = _mm256_setzero_si256();
+        for (int j = 0; j < stop.size; j++) matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(block, needles[j]));
+        unsigned int mask = _mm256_movemask_epi8(matches);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    return findFirstOfSSE2(data, i, size, stop);
+}
+
+#endif
+
+typedef std::size_t (*FindFirstOf)(const char *, std::size_t, std::size_t, const scan::StopChars &);
+
+static FindFirstOf implementationFunction(scan::Implementation implementation) {
+#ifdef SCAN_X86
+    if (implementation == scan::Implementation::AVX2) return findFirstOfAVX2;
+    if (implementation == scan::Implementation::SSE2) return findFirstOfSSE2;
+#endif
+    return findFirstOfScalar;
+}
+
+static scan::Implementation implementationInUse = scan::bestImplementation();
+static FindFirstOf findFirstOfInUse = implementationFunction(implementationInUse);
+
+std::size_t scan::findFirstOf(std::string_view text, std::size_t from, const StopChars &stop) {
+    if (from >= text.size()) return text.size();
+    return findFirstOfInUse(text.data(), from, text.size(), stop);
+}
+
+scan::Implementation scan::bestImplementation() {
+#ifdef SCAN_X86
+    // Can be called during static initialisation, before the cpu feature data is guaranteed to be set up
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Implementation::AVX2;
+    if (__builtin_cpu_supports("sse2")) return Implementation::SSE2;
+#endif
+    return Implementation::Scalar;
+}
+
+bool scan::setImplementation(Implementation implementation) {
+    if (implementation == Implementation::AVX2 && bestImplementation() != Implementation::AVX2) return false;
+    if (implementation == Implementation::SSE2 && bestImplementation() == Implementation::Scalar) return false;
+
+    implementationInUse = implementation;
+    findFirstOfInUse = implementationFunction(implementation);
+    return true;
+}
+
+scan::Implementation scan::currentImplementation() {
+    return implementationInUse;
+}
+
+std::string scan::implementationName(Implementation implementation) {
+    if (implementation == Implementation::AVX2) return "AVX2";
+    if (implementation == Implementation::SSE2) return "SSE2";
+    return "Scalar";
+}
@@ -0,0 +1,42 @@
+#ifndef PERLPARSER_SCAN_H
+#define PERLPARSER_SCAN_H
+
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+// Fast search for the next "interesting" character in long runs of text (comments, pod, string and heredoc bodies).
+// Uses SSE2/AVX2 when the CPU supports it, picked at runtime, and a plain loop otherwise.
+namespace scan {
+    const int MAX_STOP_CHARS = 6;
+
+    enum class Implementation {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    // Set of characters a scan stops at, of which there can be up to MAX_STOP_CHARS
+    struct StopChars {
+        StopChars(std::initializer_list<char> chars);
+
+        char chars[MAX_STOP_CHARS];
+        int size = 0;
+    };
+
+    // Index of the first character at or after from that is in stop, or text.size() if there is none
+    std::size_t findFirstOf(std::string_view text, std::size_t from, const StopChars &stop);
+
+    // Fastest implementation the current CPU supports
+    Implementation bestImplementation();
+
+    // Change the implementation used by findFirstOf (for tests and benchmarks). Returns false if the CPU doesn't support it
+    bool setImplementation(Implementation implementation);
+
+    Implementation currentImplementation();
+
+    std::string implementationName(Implementation implementation);
+}
+
+#endif //PERLPARSER_SCAN_H
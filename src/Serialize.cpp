@@ -12,13 +12,12 @@ enum VariableTypeCode {
 
 
 json toJson(const FilePos &filePos) {
-    return std::vector<int>{filePos.line, filePos.col, filePos.position};
+    return filePos.position;
 }
 
 
 FilePos filePosFromJson(const json &j) {
-    std::vector<int> jList = j;
-    return FilePos(jList[0], jList[1], jList[2]);
+    return FilePos(j.get<int>());
 }
 
 json toJson(Range &range) {
@@ -120,25 +119,27 @@ json toJson(SymbolNode &rootSymbolNode) {
 }
 
 void doSymbolNodeFromJson(json j, const std::shared_ptr<SymbolNode> &parentSymbolNode) {
-    auto childNode = std::make_shared<SymbolNode>(filePosFromJson(j[1]), filePosFromJson(j[2]), nullptr);
+    auto childNode = std::make_shared<SymbolNode>(filePosFromJson(j[1]), filePosFromJson(j[2]));
     std::vector<std::shared_ptr<Variable>> variables;
     for (const auto &var : j[0]) {
         variables.emplace_back(variableFromJson(var));
     }
     childNode->variables = variables;
+    childNode->indexVariables();
     childNode->children = std::vector<std::shared_ptr<SymbolNode>>();
 
     for (auto child : j[3]) {
         doSymbolNodeFromJson(child, childNode);
     }
 
-    parentSymbolNode->children.emplace_back(childNode);
+    parentSymbolNode->addChild(childNode);
 }
 
 std::shared_ptr<SymbolNode> symbolNodeFromJson(const json &j) {
-    auto parent = std::make_shared<SymbolNode>(FilePos(0, 0, 0), FilePos(0, 0, 0), nullptr);
+    auto parent = std::make_shared<SymbolNode>(FilePos(0), FilePos(0));
     doSymbolNodeFromJson(j, parent);
     if (parent->children.size() > 0) {
+        parent->children[0]->parent = nullptr;
         return parent->children[0];
     }
 
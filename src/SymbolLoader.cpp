@@ -3,6 +3,7 @@
 //
 
 #include "SymbolLoader.h"
+#include "FileAnalysis.h"
 
 std::optional<FileSymbols> loadSymbols(std::string path, Cache &cache) {
     // Try to load each FileSymbols from cache
@@ -24,13 +25,48 @@ std::optional<FileSymbols> loadSymbols(std::string path, Cache &cache) {
         cache.addItem(path, std::make_shared<FileSymbols>(fileSymbols));
     }
     auto end = std::chrono::steady_clock::now();
-    std::cout << "[" << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "ms]"
-              << "Loaded symbols for " << path << std::endl;
+    // One write, so lines from files loaded on different threads don't get mixed up
+    std::cout << "[" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()) +
+                 "ms]Loaded symbols for " + path + "\n" << std::flush;
 
     return fileSymbols;
 }
 
 
+// Include paths for the imports of the file at path: the directories from its `use lib` statements ahead of includes,
+// as perl puts them at the front of @INC. $FindBin::Bin and relative directories are taken from the file's directory,
+// the same as "." in @INC
+static std::vector<std::string>
+includePathsFor(const std::string &path, const FileSymbols &fileSymbols, const std::vector<std::string> &includes) {
+    std::vector<std::string> libDirectories;
+    for (const auto &import : fileSymbols.imports) {
+        if (import.type != ImportType::Lib) continue;
+
+        std::vector<std::string> directories;
+        for (auto directory : import.exports) {
+            for (std::string_view findBin : {"$FindBin::RealBin", "$FindBin::Bin"}) {
+                if (directory.rfind(findBin, 0) == 0) directory = "." + directory.substr(findBin.size());
+            }
+
+            // Anything else interpolated can't be known without running the program
+            if (directory.empty() || directory.find('$') != std::string::npos) continue;
+            if (directory[0] != '/') directory = directoryOf(path) + "/" + directory;
+
+            // So files found through it have the same path as they do through the project and @INC
+            directory = std::filesystem::path(directory).lexically_normal().string();
+            if (directory.size() > 1 && directory.back() == '/') directory.pop_back();
+            directories.emplace_back(directory);
+        }
+
+        // Each use lib goes in front of the ones before it
+        libDirectories.insert(libDirectories.begin(), directories.begin(), directories.end());
+    }
+
+    if (libDirectories.empty()) return includes;
+    libDirectories.insert(libDirectories.end(), includes.begin(), includes.end());
+    return libDirectories;
+}
+
 void doLoadAllSymbols(std::string path, std::vector<std::string> includes, FileSymbolMap &fileSymbolMap, Cache &cache) {
     // Already been processed so done. Probably a cycle somewhere
     if (fileSymbolMap.count(path) > 0) return;
@@ -41,9 +77,12 @@ void doLoadAllSymbols(std::string path, std::vector<std::string> includes, FileS
 
     fileSymbolMap[path] = fileSymbols;
 
+    auto fileIncludes = includePathsFor(path, fileSymbols, includes);
     for (auto &import : fileSymbols.imports) {
-        auto maybePath = (import.type == ImportType::Path) ? resolvePath(includes, import.data) : resolveModulePath(
-                includes, splitPackage(import.data));
+        if (import.type == ImportType::Lib) continue;
+
+        auto maybePath = (import.type == ImportType::Path) ? resolvePath(fileIncludes, import.data) : resolveModulePath(
+                fileIncludes, splitPackage(import.data));
 
         if (!maybePath.has_value()) {
             std::cerr << "Failed to resolve path against @INC - " << import.data << std::endl;
@@ -151,6 +190,25 @@ SubroutineMap buildSubroutineMap(FileSymbolMap &fileSymbolsMap) {
     return subroutineMap;
 }
 
+// Index the occurrences in the root file of the symbols that have been loaded
+static void buildRootFileIndex(Symbols &symbols) {
+    auto &index = symbols.rootFileIndex;
+    for (const auto &variableWithUsages : symbols.rootFileSymbols.variableUsages) {
+        index.addVariable(variableWithUsages.first, variableWithUsages.second);
+    }
+
+    for (const auto &globalWithFiles : symbols.globalVariablesMap.globalsMap) {
+        auto usages = globalWithFiles.second.find(symbols.rootFilePath);
+        if (usages != globalWithFiles.second.end()) index.addGlobal(globalWithFiles.first, usages->second);
+    }
+
+    for (const auto &subWithFiles : symbols.subroutineMap.subsMap) {
+        auto usages = subWithFiles.second.find(symbols.rootFilePath);
+        if (usages != subWithFiles.second.end()) index.addSubroutine(subWithFiles.first, usages->second);
+    }
+
+    index.build();
+}
 
 std::optional<Symbols> buildSymbols(const std::string &rootPath, const std::string &contextPath, Cache &cache) {
     auto fileSymbolsMap = loadAllFileSymbols(rootPath, contextPath, cache);
@@ -172,27 +230,18 @@ std::optional<Symbols> buildSymbols(const std::string &rootPath, const std::stri
 
     std::cout << symbols.subroutineMap.toStr() << std::endl;
 
+    buildRootFileIndex(symbols);
     return symbols;
 }
 
-/**
- * Build all symbols needed to analyse the file `rootFile`
- * @param rootPath - The file the user is currently editing, saved into a /tmp buffer
- * @param contextPath - The actual location of `rootPath` (i.e. not the /tmp one, we only use /tmp for the data)
- * @param projectPaths - The paths of all perl files in the project the user is editing
- * @param cache
- * @return
- */
-std::optional<Symbols>
-buildProjectSymbols(const std::string &rootPath, const std::string &contextPath, std::vector<std::string> projectPaths,
+// Symbols of files, with the root file loaded from rootPath
+static std::optional<Symbols>
+buildSymbolsOfFiles(const std::string &rootPath, const std::string &contextPath, const std::vector<std::string> &files,
                     Cache &cache, bool variableUsages, bool subroutineDecl, bool subroutineUsage) {
-    auto projGraph = loadProjectGraph(projectPaths, getIncludePaths(directoryOf(contextPath)), cache);
-    auto files = relatedFiles(contextPath, projGraph);
-
     FileSymbolMap fileSymbols;
     Symbols symbols;
 
-    for (auto file : files) {
+    for (const auto &file : files) {
         // If the current file is in /tmp, load from there but keep key the same
         std::string path = file == contextPath ? rootPath : file;
         auto maybeFileSymbols = loadSymbols(path, cache);
@@ -223,134 +272,313 @@ buildProjectSymbols(const std::string &rootPath, const std::string &contextPath,
         symbols.subroutineMap = buildSubroutineMap(fileSymbols);
     }
 
+    buildRootFileIndex(symbols);
     return symbols;
 }
 
+/**
+ * Build the symbols needed to analyse the file `rootFile`, from it and the files it imports (directly or not). That is
+ * everything a symbol in the file can refer to
+ * @param rootPath - The file the user is currently editing, saved into a /tmp buffer
+ * @param contextPath - The actual location of `rootPath` (i.e. not the /tmp one, we only use /tmp for the data)
+ * @param projectPaths - The paths of all perl files in the project the user is editing
+ * @param cache
+ * @param projectGraph - Import graph of the project, kept up to date between calls
+ * @return
+ */
+std::optional<Symbols>
+buildProjectSymbols(const std::string &rootPath, const std::string &contextPath, std::vector<std::string> projectPaths,
+                    Cache &cache, ProjectGraph &projectGraph, bool variableUsages, bool subroutineDecl,
+                    bool subroutineUsage) {
+    projectGraph.update(projectPaths, getIncludePaths(directoryOf(contextPath)), cache);
+    return buildSymbolsOfFiles(rootPath, contextPath, projectGraph.importsOf(contextPath), cache, variableUsages,
+                               subroutineDecl, subroutineUsage);
+}
+
+std::optional<Symbols>
+buildUsageSymbols(const std::string &rootPath, const std::string &contextPath, FilePos location,
+                  std::vector<std::string> projectPaths, Cache &cache, ProjectGraph &projectGraph) {
+    auto symbols = buildProjectSymbols(rootPath, contextPath, std::move(projectPaths), cache, projectGraph, true, false,
+                                       true);
+    if (!symbols.has_value() || symbols->rootFileIndex.variableAt(location) != nullptr) return symbols;
+
+    // Files the symbol is declared in. Globals have no single declaration, so take every file using it that the root
+    // file can see
+    std::vector<std::string> declaringFiles;
+    if (auto global = symbols->rootFileIndex.globalAt(location)) {
+        for (const auto &fileUsages : symbols->globalVariablesMap.globalsMap[global.value()]) {
+            declaringFiles.emplace_back(fileUsages.first);
+        }
+    } else if (auto subroutine = symbols->rootFileIndex.subroutineAt(location)) {
+        declaringFiles.emplace_back(subroutine->path);
+    } else {
+        return symbols;
+    }
+
+    return buildSymbolsOfFiles(rootPath, contextPath, projectGraph.importersOf(declaringFiles), cache, true, false,
+                               true);
+}
+
 std::optional<Symbols> buildSymbols(std::string rootPath, std::string contextPath) {
     Cache cache;
     return buildSymbols(rootPath, contextPath, cache);
 }
 
-std::set<std::string> doBuildGraphWithFile(const std::string &path, std::vector<std::string> includes,
-                                           std::unordered_map<std::string, PathNode> &importGraph, Cache &cache) {
+// Paths of the files that the file at path imports, or nothing if it couldn't be loaded
+static std::set<std::string> importedPaths(const std::string &path, const std::vector<std::string> &includes,
+                                           Cache &cache) {
     auto maybeFileSymbols = loadSymbols(path, cache);
-
-    // Now start to build the graph
-    if (importGraph.count(path) == 0) {
-        importGraph[path] = PathNode();
-    }
+    if (!maybeFileSymbols.has_value()) return {};
 
     // For the children, we need the full path
-    if (maybeFileSymbols.has_value()) {
-        std::set<std::string> childPaths;
-
-        for (const auto &import : maybeFileSymbols.value().imports) {
-            std::optional<std::string> maybeChildPath;
-            if (import.type == ImportType::Path) {
-                maybeChildPath = resolvePath(includes, import.data);
-            } else {
-                maybeChildPath = resolveModulePath(includes, splitPackage(import.data));
-            }
+    auto fileIncludes = includePathsFor(path, maybeFileSymbols.value(), includes);
+    std::set<std::string> childPaths;
+    for (const auto &import : maybeFileSymbols.value().imports) {
+        std::optional<std::string> maybeChildPath;
+        if (import.type == ImportType::Lib) {
+            continue;
+        } else if (import.type == ImportType::Path) {
+            maybeChildPath = resolvePath(fileIncludes, import.data);
+        } else {
+            maybeChildPath = resolveModulePath(fileIncludes, splitPackage(import.data));
+        }
 
-            if (!maybeChildPath.has_value()) continue;
-            auto childPath = maybeChildPath.value();
+        if (maybeChildPath.has_value()) childPaths.insert(maybeChildPath.value());
+    }
 
-            childPaths.insert(childPath);
-            importGraph[path].children.insert(childPath);
+    return childPaths;
+}
 
-            // Now update parent for this path's parents
-            if (importGraph.count(childPath) == 0) {
-                importGraph[childPath] = PathNode();
-            }
+// Size and modification time of a file, to tell cheaply whether it has changed
+static FileVersion fileVersion(const std::string &path) {
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time(path, error);
+    if (error) return FileVersion{};
+    auto size = std::filesystem::file_size(path, error);
+    if (error) return FileVersion{};
+    return FileVersion{true, modified, size};
+}
 
-            importGraph[childPath].parents.insert(path);
+struct LoadedFile {
+    std::string path;
+    FileVersion version;
+    std::set<std::string> children;
+};
+
+// Load paths and everything they import that isn't in visited yet, returning each file loaded with its imports
+static std::vector<LoadedFile>
+loadImportsOf(const std::vector<std::string> &paths, std::unordered_set<std::string> visited,
+              const std::vector<std::string> &includes, Cache &cache, int threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Files that have been queued to load, so each is only loaded once. Guarded by a mutex, as that is nothing next to
+    // loading a file
+    std::mutex visitedMutex;
+
+    std::vector<LoadedFile> loaded;
+    std::mutex loadedMutex;
+
+    // Loading a file queues the files it imports, so the pool works through the whole import graph
+    ThreadPool pool(threads);
+    std::function<void(const std::string &)> visit = [&](const std::string &path) {
+        {
+            std::lock_guard<std::mutex> lock(visitedMutex);
+            if (!visited.insert(path).second) return;
         }
 
-        return childPaths;
-    }
+        pool.submit([&, path] {
+            // Before loading, so a change made while loading is picked up next time
+            auto version = fileVersion(path);
+            auto children = importedPaths(path, includes, cache);
+            for (const auto &child : children) visit(child);
 
-    return std::set<std::string>{};
+            std::lock_guard<std::mutex> lock(loadedMutex);
+            loaded.push_back(LoadedFile{path, version, std::move(children)});
+        });
+    };
+
+    for (const auto &path : paths) visit(path);
+    pool.wait();
+    return loaded;
 }
 
 std::unordered_map<std::string, PathNode>
-loadProjectGraph(const std::vector<std::string> &projectFiles, std::vector<std::string> includes, Cache &cache) {
-    // First load every file, along with every file that the file includes
-    // Caching ensures that we don't double load anything
-    FileSymbolMap fileSymbolsMap;
+loadProjectGraph(const std::vector<std::string> &projectFiles, const std::vector<std::string> &includes, Cache &cache,
+                 int threads) {
+    auto loaded = loadImportsOf(projectFiles, {}, includes, cache, threads);
 
-    // Import graph of all the files. Directed, disconnected, cyclic graph
+    // Import graph of all the files. Directed, disconnected, cyclic graph. Built once everything is loaded, so it is
+    // the same whatever order the files were loaded in
     std::unordered_map<std::string, PathNode> importGraph;
+    for (const auto &file : loaded) {
+        auto &node = importGraph[file.path];
+        for (const auto &childPath : file.children) {
+            node.children.insert(childPath);
+            importGraph[childPath].parents.insert(file.path);
+        }
+    }
 
-    std::vector<std::string> processedFiles;
-    std::queue<std::string> workList;
+    return importGraph;
+}
 
-    for (const auto &path : projectFiles) workList.push(path);
+bool FileVersion::operator==(const FileVersion &other) const {
+    return exists == other.exists && modified == other.modified && size == other.size;
+}
 
-    while (!workList.empty()) {
-        std::string path = workList.front();
-        workList.pop();
-        // Already processed this file
-        if (std::find(processedFiles.begin(), processedFiles.end(), path) != processedFiles.end()) continue;
+bool FileVersion::operator!=(const FileVersion &other) const {
+    return !(*this == other);
+}
+
+void ProjectGraph::update(const std::vector<std::string> &projectFiles, const std::vector<std::string> &includes,
+                          Cache &cache, int threads) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // Anything could resolve differently, so start again
+    std::set<std::string> projectFileSet(projectFiles.begin(), projectFiles.end());
+    if (includes != this->includes || projectFileSet != this->projectFiles) {
+        this->graph.clear();
+        this->versions.clear();
+        this->importGraph = ImportGraph();
+        this->includes = includes;
+        this->projectFiles = std::move(projectFileSet);
+    }
 
-        auto children = doBuildGraphWithFile(path, includes, importGraph, cache);
-        processedFiles.emplace_back(path);
-        for (auto child : children) {
-            workList.push(child);
+    std::vector<std::string> toLoad;
+    std::unordered_set<std::string> unchanged;
+    if (this->versions.empty()) {
+        toLoad.assign(this->projectFiles.begin(), this->projectFiles.end());
+    } else {
+        for (const auto &pathVersion : this->versions) {
+            if (fileVersion(pathVersion.first) != pathVersion.second) {
+                toLoad.emplace_back(pathVersion.first);
+            } else {
+                unchanged.insert(pathVersion.first);
+            }
         }
     }
 
-    return importGraph;
-}
+    if (toLoad.empty()) return;
 
+    bool removedImports = false;
+    for (auto &file : loadImportsOf(toLoad, std::move(unchanged), includes, cache, threads)) {
+        this->versions[file.path] = file.version;
+        auto &children = this->graph[file.path].children;
 
-void doFindPathsConnectedTo(std::string currentPath, std::unordered_map<std::string, PathNode> &importGraph,
-                            std::set<std::string> &connectedList) {
-    if (importGraph.count(currentPath) == 0) return;
+        for (const auto &oldChild : children) {
+            if (file.children.count(oldChild) > 0) continue;
+            this->graph[oldChild].parents.erase(file.path);
+            removedImports = true;
+        }
 
-    for (auto child : importGraph[currentPath].children) {
-        if (std::find(connectedList.begin(), connectedList.end(), child) != connectedList.end()) {
-            // child is in list already, so stop at this branch
-            continue;
+        for (const auto &child : file.children) {
+            if (children.count(child) == 0) this->graph[child].parents.insert(file.path);
         }
-        connectedList.insert(child);
-        doFindPathsConnectedTo(child, importGraph, connectedList);
+
+        // graph may have rehashed, so look the node up again
+        this->graph[file.path].children = std::move(file.children);
     }
 
-    for (auto parent : importGraph[currentPath].parents) {
-        if (std::find(connectedList.begin(), connectedList.end(), parent) != connectedList.end()) {
-            // child is in list already, so stop at this branch
+    if (removedImports) this->removeUnreachable();
+    this->importGraph = ImportGraph(this->graph);
+}
+
+// Drop files that nothing in the project imports any more, as loading the graph from scratch wouldn't find them
+void ProjectGraph::removeUnreachable() {
+    std::unordered_set<std::string> reachable;
+    std::vector<std::string> stack(this->projectFiles.begin(), this->projectFiles.end());
+    while (!stack.empty()) {
+        auto path = std::move(stack.back());
+        stack.pop_back();
+        if (!reachable.insert(path).second) continue;
+
+        auto node = this->graph.find(path);
+        if (node == this->graph.end()) continue;
+        for (const auto &child : node->second.children) stack.emplace_back(child);
+    }
+
+    for (auto node = this->graph.begin(); node != this->graph.end();) {
+        if (reachable.count(node->first) > 0) {
+            ++node;
             continue;
         }
-        connectedList.insert(parent);
-        doFindPathsConnectedTo(parent, importGraph, connectedList);
+
+        for (const auto &child : node->second.children) {
+            auto childNode = this->graph.find(child);
+            if (childNode != this->graph.end()) childNode->second.parents.erase(node->first);
+        }
+        this->versions.erase(node->first);
+        node = this->graph.erase(node);
     }
 }
 
-std::set<std::string> pathsConnectedTo(std::string path, std::unordered_map<std::string, PathNode> &importGraph) {
-    std::set<std::string> connectedList = std::set<std::string>{path};
-    doFindPathsConnectedTo(path, importGraph, connectedList);
-    return connectedList;
+// Ids are in order of path, so sorting them sorts the paths
+static std::vector<std::string> sortedPaths(const ImportGraph &graph, std::vector<int> files) {
+    std::sort(files.begin(), files.end());
+    std::vector<std::string> paths;
+    paths.reserve(files.size());
+    for (int file : files) paths.emplace_back(graph.path(file));
+    return paths;
 }
 
-void doFindDescendentsOf(std::string currentPath, std::unordered_map<std::string, PathNode> &importGraph,
-                         std::set<std::string> &seen) {
-    if (importGraph.count(currentPath) == 0) return;
+std::vector<std::string> ProjectGraph::importsOf(const std::string &path) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto id = this->importGraph.id(path);
+    if (!id.has_value()) return std::vector<std::string>{path};
 
-    for (const auto &child : importGraph[currentPath].children) {
-        if (std::find(seen.begin(), seen.end(), child) != seen.end()) continue;
-        seen.insert(child);
-        doFindDescendentsOf(child, importGraph, seen);
+    auto files = this->importGraph.descendentsOf(id.value());
+    if (std::find(files.begin(), files.end(), id.value()) == files.end()) files.emplace_back(id.value());
+    return sortedPaths(this->importGraph, std::move(files));
+}
+
+std::vector<std::string> ProjectGraph::importersOf(const std::vector<std::string> &paths) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::vector<int> ids;
+    std::vector<std::string> missing;
+    for (const auto &path : paths) {
+        if (auto id = this->importGraph.id(path)) {
+            ids.emplace_back(id.value());
+        } else {
+            missing.emplace_back(path);
+        }
     }
+
+    auto importers = sortedPaths(this->importGraph, this->importGraph.importersOf(ids));
+    if (missing.empty()) return importers;
+
+    importers.insert(importers.end(), missing.begin(), missing.end());
+    std::sort(importers.begin(), importers.end());
+    importers.erase(std::unique(importers.begin(), importers.end()), importers.end());
+    return importers;
 }
 
+std::unordered_map<std::string, PathNode> ProjectGraph::nodes() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->graph;
+}
+
+
+static std::set<std::string> pathsOf(const ImportGraph &graph, const std::vector<int> &files) {
+    std::set<std::string> paths;
+    for (int file : files) paths.insert(graph.path(file));
+    return paths;
+}
+
+std::set<std::string>
+pathsConnectedTo(const std::string &path, const std::unordered_map<std::string, PathNode> &importGraph) {
+    ImportGraph graph(importGraph);
+    auto id = graph.id(path);
+    if (!id.has_value()) return std::set<std::string>{path};
+    return pathsOf(graph, graph.connectedTo(id.value()));
+}
 
-std::set<std::string> descendentsOf(std::string path, std::unordered_map<std::string, PathNode> graph) {
-    auto seen = std::set<std::string>();
-    doFindDescendentsOf(path, graph, seen);
-    return seen;
+std::set<std::string> descendentsOf(const std::string &path, const std::unordered_map<std::string, PathNode> &graph) {
+    ImportGraph importGraph(graph);
+    auto id = importGraph.id(path);
+    if (!id.has_value()) return {};
+    return pathsOf(importGraph, importGraph.descendentsOf(id.value()));
 }
 
-std::set<std::string> relatedFiles(std::string path, std::unordered_map<std::string, PathNode> graph) {
+std::set<std::string> relatedFiles(const std::string &path, const std::unordered_map<std::string, PathNode> &graph) {
     // TODO can we refine this anymore?
     return pathsConnectedTo(path, graph);
 }
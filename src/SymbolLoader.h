@@ -10,12 +10,16 @@
 #include <queue>
 #include <chrono>
 #include <set>
+#include <unordered_set>
+#include <filesystem>
+#include <mutex>
 #include "Util.h"
-#include "FileAnalysis.h"
 #include "PerlCommandLine.h"
 #include "Symbols.h"
 #include "Cache.h"
 #include "IOException.h"
+#include "ThreadPool.h"
+#include "ImportGraph.h"
 
 FileSymbolMap loadAllFileSymbols(std::string path, std::string contextPath, Cache &cache);
 
@@ -27,18 +31,87 @@ std::optional<Symbols> buildSymbols(std::string rootPath, std::string contextPat
 
 std::optional<Symbols> buildSymbols(const std::string &rootPath, const std::string &contextPath, Cache &cache);
 
+/**
+ * Load every project file and everything they import, as a graph of which files import which
+ *
+ * @param threads - Files to load at once. 0 uses every hardware thread
+ */
 std::unordered_map<std::string, PathNode>
-loadProjectGraph(const std::vector<std::string> &projectFiles, std::vector<std::string> includes, Cache &cache);
+loadProjectGraph(const std::vector<std::string> &projectFiles, const std::vector<std::string> &includes, Cache &cache,
+                 int threads = 0);
 
 std::string projGraphToDot(const std::unordered_map<std::string, PathNode> &graph, bool showParents = false);
 
-std::set<std::string> pathsConnectedTo(std::string path, std::unordered_map<std::string, PathNode> &importGraph);
+std::set<std::string>
+pathsConnectedTo(const std::string &path, const std::unordered_map<std::string, PathNode> &importGraph);
 
-std::set<std::string> relatedFiles(std::string path, std::unordered_map<std::string, PathNode> graph);
+std::set<std::string> relatedFiles(const std::string &path, const std::unordered_map<std::string, PathNode> &graph);
+
+std::set<std::string> descendentsOf(const std::string &path, const std::unordered_map<std::string, PathNode> &graph);
+
+// What a file on disk looked like when it was loaded
+struct FileVersion {
+    bool exists = false;
+    std::filesystem::file_time_type modified;
+    std::uintmax_t size = 0;
+
+    bool operator==(const FileVersion &other) const;
+
+    bool operator!=(const FileVersion &other) const;
+};
+
+/**
+ * Import graph of a project that is kept between requests, rather than loaded from scratch for each one.
+ *
+ * Updating checks the size and modification time of each file in the graph, and only reloads the files that have
+ * changed, replacing their edges with their new imports. Changing the project files or include paths loads the whole
+ * graph again, as any import could resolve differently. A file created on an include path that an unchanged file
+ * already failed to import isn't noticed until then.
+ *
+ * Safe to use from several threads at once.
+ */
+class ProjectGraph {
+public:
+    void update(const std::vector<std::string> &projectFiles, const std::vector<std::string> &includes, Cache &cache,
+                int threads = 0);
+
+    // The file at path and every file it imports, directly or not, sorted
+    std::vector<std::string> importsOf(const std::string &path);
+
+    // The files at paths and every file that imports them, directly or not, sorted
+    std::vector<std::string> importersOf(const std::vector<std::string> &paths);
+
+    std::unordered_map<std::string, PathNode> nodes();
+
+private:
+    void removeUnreachable();
+
+    std::unordered_map<std::string, PathNode> graph;
+
+    // Copy of graph for searching, made after each update that changes it
+    ImportGraph importGraph;
+
+    // Version of each file in the graph when its imports were loaded
+    std::unordered_map<std::string, FileVersion> versions;
+
+    std::set<std::string> projectFiles;
+    std::vector<std::string> includes;
+
+    std::mutex mutex;
+};
 
 std::optional<Symbols>
 buildProjectSymbols(const std::string &rootPath, const std::string &contextPath, std::vector<std::string> projectPaths,
-                    Cache &cache, bool variableUsages = false, bool subroutineDecl = false,
-                    bool subroutineUsage = false);
+                    Cache &cache, ProjectGraph &projectGraph, bool variableUsages = false,
+                    bool subroutineDecl = false, bool subroutineUsage = false);
+
+/**
+ * Build the symbols needed to find the usages of the symbol at location in the root file: the files it is declared in
+ * and every file that imports them, which are the only files that can use it. Falls back to the symbols from
+ * buildProjectSymbols if there is no symbol there or it is a lexical variable
+ */
+std::optional<Symbols>
+buildUsageSymbols(const std::string &rootPath, const std::string &contextPath, FilePos location,
+                  std::vector<std::string> projectPaths, Cache &cache, ProjectGraph &projectGraph);
 
 #endif //PERLPARSE_SYMBOLLOADER_H
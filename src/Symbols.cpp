@@ -4,8 +4,86 @@
 
 #include "Symbols.h"
 
-SymbolNode::SymbolNode(const FilePos &startPos, const FilePos &endPos, std::shared_ptr<BlockNode> blockNode) :
-        startPos(startPos), endPos(endPos), blockNode(blockNode) {}
+SymbolNode::SymbolNode(const FilePos &startPos, const FilePos &endPos) : startPos(startPos), endPos(endPos) {}
+
+// Move the usages in from into to, appending to the usages of symbols already in to
+template<typename Usages>
+static void mergeUsages(Usages &to, Usages &from) {
+    if (to.empty()) {
+        to = std::move(from);
+        return;
+    }
+
+    // Symbols new to `to` have their nodes moved across without copying, leaving the ones both have in from
+    to.merge(from);
+    for (auto &usages : from) {
+        auto &merged = to[usages.first];
+        merged.insert(merged.end(), std::make_move_iterator(usages.second.begin()),
+                      std::make_move_iterator(usages.second.end()));
+    }
+}
+
+void mergeFileSymbols(FileSymbols &fileSymbols, FileSymbols &&part) {
+    auto append = [](auto &to, auto &from) {
+        to.insert(to.end(), std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+    };
+
+    // A later declaration of the same subroutine replaces the earlier one
+    for (auto &sub : part.subroutineDeclarations) {
+        fileSymbols.subroutineDeclarations[sub.first] = std::move(sub.second);
+    }
+
+    // Globals are keyed by their first usage, which is the one from the earliest part that has the global
+    mergeUsages(fileSymbols.globals, part.globals);
+    mergeUsages(fileSymbols.fileSubroutineUsages, part.fileSubroutineUsages);
+    mergeUsages(fileSymbols.variableUsages, part.variableUsages);
+
+    append(fileSymbols.possibleSubroutineUsages, part.possibleSubroutineUsages);
+    append(fileSymbols.imports, part.imports);
+    append(fileSymbols.constants, part.constants);
+}
+
+void SymbolNode::addChild(const std::shared_ptr<SymbolNode> &child) {
+    child->parent = this;
+    children.emplace_back(child);
+}
+
+void SymbolNode::indexVariables() {
+    scopeVariables = variables;
+
+    // Stable, so the declarations of a name stay in order and the last one can be kept
+    std::stable_sort(scopeVariables.begin(), scopeVariables.end(),
+                     [](const std::shared_ptr<Variable> &a, const std::shared_ptr<Variable> &b) {
+                         return a->name < b->name;
+                     });
+    auto last = scopeVariables.begin();
+    for (auto it = scopeVariables.begin(); it != scopeVariables.end(); it++) {
+        if (last != scopeVariables.begin() && (*(last - 1))->name == (*it)->name) {
+            *(last - 1) = *it;
+        } else {
+            *last++ = *it;
+        }
+    }
+    scopeVariables.erase(last, scopeVariables.end());
+}
+
+const SymbolNode *SymbolNode::innermostScope(const FilePos &pos) const {
+    const SymbolNode *node = this;
+    bool descended = true;
+    while (descended) {
+        descended = false;
+        // Children are in order and don't overlap, so at most one contains pos
+        for (const auto &child : node->children) {
+            if (child->startPos <= pos && pos <= child->endPos) {
+                node = child.get();
+                descended = true;
+                break;
+            }
+        }
+    }
+
+    return node;
+}
 
 Import::Import(const FilePos &location, ImportType type, ImportMechanism mechanism, const std::string &data,
                const std::vector<std::string> &exports) : location(location), type(type), mechanism(mechanism),
@@ -130,3 +208,75 @@ std::string SubroutineUsage::toStr() {
 }
 
 SubroutineCode::SubroutineCode(const Range &location, const std::string &code) : location(location), code(code) {}
+
+void SymbolIndex::Occurrences::add(const Range &range, int symbol) {
+    occurrences.emplace_back(Occurrence{range.from.position, range.to.position, symbol});
+}
+
+void SymbolIndex::Occurrences::build() {
+    std::sort(occurrences.begin(), occurrences.end(), [](const Occurrence &a, const Occurrence &b) {
+        return a.from < b.from;
+    });
+
+    furthestEnd.clear();
+    for (const auto &occurrence : occurrences) {
+        furthestEnd.emplace_back(furthestEnd.empty() ? occurrence.to : std::max(furthestEnd.back(), occurrence.to));
+    }
+}
+
+int SymbolIndex::Occurrences::find(const FilePos &pos) const {
+    int key = pos.position;
+    auto after = std::upper_bound(occurrences.begin(), occurrences.end(), key, [](int key, const Occurrence &o) {
+        return key < o.from;
+    });
+
+    // Occurrences almost never overlap, so this is usually just the one before
+    for (int i = (int) (after - occurrences.begin()) - 1; i >= 0 && furthestEnd[i] >= key; i--) {
+        if (occurrences[i].to >= key) return occurrences[i].symbol;
+    }
+
+    return -1;
+}
+
+void SymbolIndex::addVariable(const std::shared_ptr<Variable> &variable, const std::vector<Range> &usages) {
+    int symbol = variables.size();
+    variables.emplace_back(variable);
+    variableOccurrences.add(Range(variable->declaration, variable->symbolEnd), symbol);
+    for (const auto &usage : usages) variableOccurrences.add(usage, symbol);
+}
+
+void SymbolIndex::addGlobal(const GlobalVariable &global, const std::vector<GlobalVariable> &usages) {
+    int symbol = globals.size();
+    globals.emplace_back(global);
+    for (const auto &usage : usages) globalOccurrences.add(usage.getLocation(), symbol);
+}
+
+void SymbolIndex::addSubroutine(const SubroutineDecl &subroutine, const std::vector<SubroutineCode> &usages) {
+    int symbol = subroutines.size();
+    subroutines.emplace_back(subroutine);
+    for (const auto &usage : usages) subroutineOccurrences.add(usage.location, symbol);
+}
+
+void SymbolIndex::build() {
+    variableOccurrences.build();
+    globalOccurrences.build();
+    subroutineOccurrences.build();
+}
+
+std::shared_ptr<Variable> SymbolIndex::variableAt(const FilePos &pos) const {
+    int symbol = variableOccurrences.find(pos);
+    if (symbol == -1) return nullptr;
+    return variables[symbol];
+}
+
+std::optional<GlobalVariable> SymbolIndex::globalAt(const FilePos &pos) const {
+    int symbol = globalOccurrences.find(pos);
+    if (symbol == -1) return {};
+    return globals[symbol];
+}
+
+std::optional<SubroutineDecl> SymbolIndex::subroutineAt(const FilePos &pos) const {
+    int symbol = subroutineOccurrences.find(pos);
+    if (symbol == -1) return {};
+    return subroutines[symbol];
+}
@@ -9,15 +9,19 @@
 #include <string>
 #include <unordered_map>
 #include <set>
+#include <optional>
 #include "Util.h"
 #include "Variable.h"
 #include "Subroutine.h"
 #include "Node.h"
 #include "Package.h"
+#include "LineIndex.h"
 
 
 enum class ImportType {
-    Module, Path
+    Module, Path,
+    // use lib, adding the directories in its export list to @INC
+    Lib
 };
 
 enum class ImportMechanism {
@@ -50,19 +54,30 @@ struct Import {
 
 class SymbolNode {
 public:
-    SymbolNode(const FilePos &startPos, const FilePos &endPos, std::shared_ptr<BlockNode> blockNode);
-
-    // Reference to tokens
-    std::shared_ptr<BlockNode> blockNode;
+    SymbolNode(const FilePos &startPos, const FilePos &endPos);
 
     // Variables declared in this scope
     std::vector<std::shared_ptr<Variable>> variables;
 
+    // The last declaration of each name in variables, sorted by name. Along with those of the parents, these are the
+    // variables visible in the scope. Set by indexVariables once the scope is complete
+    std::vector<std::shared_ptr<Variable>> scopeVariables;
+
     // References to scoping start and end positions
     FilePos startPos;
     FilePos endPos;
 
     std::vector<std::shared_ptr<SymbolNode>> children;
+
+    // Scope this is in, nullptr for the file. Parents own their children so this is valid as long as the node is
+    SymbolNode *parent = nullptr;
+
+    void addChild(const std::shared_ptr<SymbolNode> &child);
+
+    void indexVariables();
+
+    // Deepest scope under this one containing pos, or this if no child does
+    const SymbolNode *innermostScope(const FilePos &pos) const;
 };
 
 struct SubroutineUsage {
@@ -100,6 +115,9 @@ struct FileSymbols {
     // variables
     std::vector<PackageSpan> packages;
 
+    // Where each line of the file starts, to give positions in it to the editor as lines and columns
+    std::shared_ptr<const LineIndex> lines;
+
     // Subroutine declarations in this file
     // Map from full name -> Subroutine (i.e. main::func -> Subroutine{...})
     std::unordered_map<std::string, std::shared_ptr<Subroutine>> subroutineDeclarations;
@@ -135,6 +153,10 @@ struct FileSymbols {
     std::vector<Constant> constants;
 };
 
+// Move the declarations and usages found in part of a file into fileSymbols, after those already there. Parts merged
+// in file order give the same symbols as analysing the whole file at once
+void mergeFileSymbols(FileSymbols &fileSymbols, FileSymbols &&part);
+
 // Map from <file path> of a perl file to the parsed symbol table for that specific file
 typedef std::unordered_map<std::string, FileSymbols> FileSymbolMap;
 
@@ -161,6 +183,64 @@ struct SubroutineMap {
 };
 
 
+/**
+ * Where each symbol occurs in a single file, sorted so the symbol at a position can be found with a binary search
+ * rather than checking every usage of every symbol
+ */
+class SymbolIndex {
+public:
+    // Symbols must be added with all of their occurrences in the file, then build called before looking them up
+    void addVariable(const std::shared_ptr<Variable> &variable, const std::vector<Range> &usages);
+
+    void addGlobal(const GlobalVariable &global, const std::vector<GlobalVariable> &usages);
+
+    void addSubroutine(const SubroutineDecl &subroutine, const std::vector<SubroutineCode> &usages);
+
+    void build();
+
+    // Each returns the symbol with an occurrence at pos, if there is one
+    std::shared_ptr<Variable> variableAt(const FilePos &pos) const;
+
+    std::optional<GlobalVariable> globalAt(const FilePos &pos) const;
+
+    std::optional<SubroutineDecl> subroutineAt(const FilePos &pos) const;
+
+private:
+    // Ranges of one kind of symbol, each with the index of the symbol it belongs to
+    class Occurrences {
+    public:
+        void add(const Range &range, int symbol);
+
+        void build();
+
+        // Symbol of the innermost occurrence containing pos, -1 if there isn't one
+        int find(const FilePos &pos) const;
+
+    private:
+        struct Occurrence {
+            int from;
+            int to;
+            int symbol;
+        };
+
+        // Sorted by start
+        std::vector<Occurrence> occurrences;
+
+        // Furthest any occurrence up to and including each one reaches, so searching back for an occurrence
+        // containing a position can stop once none could
+        std::vector<int> furthestEnd;
+    };
+
+    std::vector<std::shared_ptr<Variable>> variables;
+    Occurrences variableOccurrences;
+
+    std::vector<GlobalVariable> globals;
+    Occurrences globalOccurrences;
+
+    std::vector<SubroutineDecl> subroutines;
+    Occurrences subroutineOccurrences;
+};
+
 struct Symbols {
     // Root file is the file that the analysis started from
     // So if a.pl imports B.pm and C.pm, then we have a graph with a at the root with children {B, C}
@@ -177,6 +257,9 @@ struct Symbols {
 
     // Subroutines defined across all files
     std::vector<Subroutine> subroutines;
+
+    // Lexical variables, globals and subroutines in the root file by where they are used
+    SymbolIndex rootFileIndex;
 };
 
 // Directed graph of files with dependencies
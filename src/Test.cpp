@@ -4,6 +4,61 @@
 
 #include "Test.h"
 
+static std::regex NUMERIC_REGEX(R"(^(\+|-)?((\d+|_)\.?(\d|_){0,}(e(\+|-)?(\d|_)+?)?|0x[\dabcdefABCDEF]+|0b[01]+|)$)");
+static std::regex VERSION_REGEX(R"(v?\d([_|\.]?\d){0,})");
+
+bool regexIsNumericLiteral(std::string_view str) {
+    return std::regex_match(str.begin(), str.end(), NUMERIC_REGEX);
+}
+
+bool regexIsVersionString(std::string_view str) {
+    return std::regex_match(str.begin(), str.end(), VERSION_REGEX);
+}
+
+static void addAllStrings(std::vector<std::string> &corpus, const std::string &alphabet, std::string &current,
+                          int maxLength) {
+    corpus.emplace_back(current);
+    if ((int) current.size() == maxLength) return;
+    for (char c : alphabet) {
+        current.push_back(c);
+        addAllStrings(corpus, alphabet, current, maxLength);
+        current.pop_back();
+    }
+}
+
+/**
+ * Compare isNumericLiteral and isVersionString against the regexes they replaced. Every short string over the
+ * characters that matter is checked, plus longer random ones.
+ */
+bool runNumericLiteralTest() {
+    std::vector<std::string> corpus;
+    std::string current;
+    addAllStrings(corpus, "019afAEFxbev._+-", current, 4);
+    addAllStrings(corpus, "01x.e_+-v", current, 5);
+
+    std::mt19937 random(42);
+    std::string randomAlphabet = "0123456789000111abcdefABCDEFxbev...___++--";
+    for (int i = 0; i < 20000; i++) {
+        std::string str;
+        int length = 6 + (int) (random() % 12);
+        for (int j = 0; j < length; j++) str += randomAlphabet[random() % randomAlphabet.size()];
+        corpus.emplace_back(str);
+    }
+
+    for (const auto &str : corpus) {
+        bool numericMismatch = isNumericLiteral(str) != regexIsNumericLiteral(str);
+        if (numericMismatch || isVersionString(str) != regexIsVersionString(str)) {
+            std::cout << console::bold << console::red << "[numeric literals] FAILED - "
+                      << (numericMismatch ? "isNumericLiteral" : "isVersionString") << " disagrees with regex on `"
+                      << str << "`" << console::clear << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << "[numeric literals] passed (" << corpus.size() << " strings)" << std::endl;
+    return true;
+}
+
 
 bool runTest(std::string &testFile) {
     auto testName = fileName(testFile);
@@ -41,8 +96,9 @@ bool runTest(std::string &testFile) {
     for (int i = 0; i < numTokens; i++) {
         std::string actualTokenString = tokens[i].toStr(false);
         if (expectedTokens[i] != actualTokenString) {
+            LineIndex lines(Tokeniser::withoutByteOrderMark(perlFileContents));
             std::cout << console::bold << console::red << "[" << testName << "] FAILED - Mismatched token at "
-                      << tokens[i].endPos.toStr() << " expected row = " << i + 1 << console::clear << console::red
+                      << lines.lineCol(tokens[i].endPos).toStr() << " expected row = " << i + 1 << console::clear << console::red
                       << std::endl;
 
             std::cout << "\tExpected: " << expectedTokens[i] << std::endl << "\tActual:  " << actualTokenString
@@ -63,9 +119,766 @@ bool runTest(std::string &testFile) {
     return true;
 }
 
+/**
+ * Check the SIMD scan kernels find the same character as the scalar version. Stop characters are placed at every
+ * offset around the 16 and 32 byte block boundaries.
+ */
+bool runScanTest() {
+    std::vector<scan::Implementation> implementations;
+    for (auto implementation : {scan::Implementation::SSE2, scan::Implementation::AVX2}) {
+        if (scan::setImplementation(implementation)) implementations.emplace_back(implementation);
+    }
+    scan::setImplementation(scan::Implementation::Scalar);
+
+    std::mt19937 random(42);
+    scan::StopChars stopChars{'\n', '\r', '\\', '"', (char) EOF};
+    std::vector<std::string> texts;
+    for (int length = 0; length < 100; length++) {
+        for (int stopAt = 0; stopAt <= length; stopAt++) {
+            std::string text;
+            for (int i = 0; i < length; i++) text += (char) ('a' + random() % 26);
+            if (stopAt < length) text[stopAt] = stopChars.chars[random() % stopChars.size];
+            texts.emplace_back(text);
+        }
+    }
+
+    bool passed = true;
+    for (const auto &text : texts) {
+        for (int from = 0; from <= (int) text.size() && passed; from++) {
+            scan::setImplementation(scan::Implementation::Scalar);
+            auto expected = scan::findFirstOf(text, from, stopChars);
+            for (auto implementation : implementations) {
+                scan::setImplementation(implementation);
+                auto actual = scan::findFirstOf(text, from, stopChars);
+                if (actual != expected) {
+                    std::cout << console::bold << console::red << "[scan] FAILED - "
+                              << scan::implementationName(implementation) << " found " << actual << " expected "
+                              << expected << " (length " << text.size() << " from " << from << ")"
+                              << console::clear << std::endl;
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    scan::setImplementation(scan::bestImplementation());
+
+    // A set can't be made with more characters than it holds
+    bool threw = false;
+    try {
+        scan::StopChars tooMany{'a', 'b', 'c', 'd', 'e', 'f', 'g'};
+    } catch (std::logic_error &) {
+        threw = true;
+    }
+    if (passed && !threw) {
+        std::cout << console::bold << console::red << "[scan] FAILED - stop characters past MAX_STOP_CHARS were kept"
+                  << console::clear << std::endl;
+        passed = false;
+    }
+
+    if (passed) std::cout << "[scan] passed" << std::endl;
+    return passed;
+}
+
+static bool sameTokens(const std::vector<Token> &actual, const std::vector<Token> &expected, std::string &difference) {
+    for (int i = 0; i < (int) actual.size() && i < (int) expected.size(); i++) {
+        const auto &a = actual[i];
+        const auto &e = expected[i];
+        if (a.type != e.type || a.data != e.data || !(a.startPos == e.startPos) || !(a.endPos == e.endPos) ||
+            a.isRestartPoint != e.isRestartPoint) {
+            difference = "token " + std::to_string(i) + " is " + Token(a).toStr(true) + " expected " +
+                         Token(e).toStr(true);
+            return false;
+        }
+    }
+
+    if (actual.size() != expected.size()) {
+        difference = std::to_string(actual.size()) + " tokens, expected " + std::to_string(expected.size());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Apply random edits to each test program, checking that incremental tokenisation of each edit gives the same tokens
+ * as tokenising the edited program from scratch. Edits are chained, so the previous tokens are usually incremental too
+ */
+bool runIncrementalTest() {
+    std::vector<std::string> snippets{"\n", "\r\n", " ", "{", "}", "(", ")", "[", "]", ";", "#", "\"", "'", "/", "$",
+                                      "@", "%", "->", "=>", "<<", "<<EOF\n", "\nEOF\n", "\n=pod\n", "\n=cut\n",
+                                      "q(", "qw/", "s{", "sub ", "x", "my $y = 1;\n", "$h->{key}", "$h{a, b}",
+                                      "key => 1", "__END__"};
+    std::mt19937 random(42);
+    bool passed = true;
+
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        std::string program = readFile(perlFile);
+        Tokeniser tokeniser(program);
+        auto tokens = tokeniser.tokenise();
+        auto source = tokeniser.getSource();
+
+        for (int n = 0; n < 200 && passed; n++) {
+            int position = random() % (program.size() + 1);
+            int length = random() % 3 == 0 ? random() % std::min<int>(20, program.size() - position + 1) : 0;
+            std::string replacement = random() % 4 == 0 ? "" : snippets[random() % snippets.size()];
+            std::string edited = program;
+            edited.replace(position, length, replacement);
+
+            Tokeniser fullTokeniser(edited);
+            std::vector<Token> expected;
+            try {
+                expected = fullTokeniser.tokenise();
+            } catch (TokeniseException &ex) {
+                continue;
+            }
+
+            Tokeniser incrementalTokeniser(edited);
+            std::string difference;
+            try {
+                auto actual = incrementalTokeniser.tokenise(tokens, *source, TextEdit(position, length, replacement));
+                if (!sameTokens(actual, expected, difference)) passed = false;
+                tokens = actual;
+            } catch (TokeniseException &ex) {
+                difference = "threw " + ex.reason;
+                passed = false;
+            }
+
+            if (!passed) {
+                std::cout << console::bold << console::red << "[incremental] FAILED - " << fileName(perlFile)
+                          << " edit " << n << " at " << position << " replacing " << length << " chars with `"
+                          << replace(replacement, "\n", "\\n") << "`: " << difference << console::clear
+                          << std::endl;
+            }
+
+            program = edited;
+            source = incrementalTokeniser.getSource();
+        }
+    }
+
+    if (passed) std::cout << "[incremental] passed" << std::endl;
+    return passed;
+}
+
+/**
+ * Check that tokenising with trivia moved into a side table gives back the full token stream once it is put back
+ */
+bool runTriviaTest() {
+    bool passed = true;
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        Tokeniser fullTokeniser(readFile(perlFile));
+        auto expected = fullTokeniser.tokenise();
+
+        Tokeniser tokeniser(readFile(perlFile));
+        std::vector<Token> tokens;
+        TriviaTable trivia;
+        tokeniser.tokenise(tokens, trivia);
+
+        std::string difference;
+        for (auto &token : tokens) {
+            if (token.isWhitespaceNewlineOrComment()) difference = "trivia in tokens " + token.toStr(true);
+        }
+
+        if (difference.empty() && !sameTokens(trivia.withTrivia(tokens), expected, difference)) passed = false;
+        if (!difference.empty()) {
+            passed = false;
+            std::cout << console::bold << console::red << "[trivia] FAILED - " << fileName(perlFile) << ": "
+                      << difference << console::clear << std::endl;
+        }
+    }
+
+    if (passed) std::cout << "[trivia] passed" << std::endl;
+    return passed;
+}
+
+/**
+ * Check line and column from the LineIndex against counting them character by character, for each test program and
+ * a few made up ones with every kind of newline
+ */
+bool runLineIndexTest() {
+    std::vector<std::string> programs{"", "\n", "a\r\nb\rc\n\nd", "\r\n\r\n  x\r", "my $x;\n\r\n\n"};
+    for (auto &perlFile : globglob("../test/pl/*.pl")) programs.emplace_back(readFile(perlFile));
+    bool passed = true;
+    auto fail = [&](const std::string &message) {
+        std::cout << console::bold << console::red << "[lines] FAILED - " << message << console::clear << std::endl;
+        passed = false;
+    };
+
+    for (auto &program : programs) {
+        LineIndex lines(program);
+        int line = 1;
+        int col = 1;
+        int hint = 0;
+        for (int position = 0; position <= (int) program.size() && passed; position++) {
+            auto lineCol = lines.lineCol(FilePos(position));
+            auto hinted = lines.lineCol(FilePos(position), hint);
+            if (lineCol.line != line || lineCol.col != col || hinted.line != line || hinted.col != col ||
+                !(lines.filePos(line, col) == FilePos(position))) {
+                fail("position " + std::to_string(position) + " is " + lineCol.toStr() + " expected " +
+                     LineCol{line, col}.toStr());
+            }
+
+            // Line starts after \n, or before the \n of \r\n
+            if (position < (int) program.size() && ((program[position] == '\r' && program[position + 1] == '\n') ||
+                                                   (program[position] == '\n' &&
+                                                    (position == 0 || program[position - 1] != '\r')))) {
+                if (lines.filePos(line, col + 1).position != -1) {
+                    fail(LineCol{line, col + 1}.toStr() + " is past the end of the line");
+                }
+                line++;
+                col = 1;
+            } else {
+                col++;
+            }
+        }
+
+        if (lines.numLines() != line && passed) {
+            fail(std::to_string(lines.numLines()) + " lines, expected " + std::to_string(line));
+        }
+
+        if (passed && (lines.filePos(line, col).position != -1 || lines.filePos(line + 1, 1).position != -1 ||
+                       lines.filePos(0, 1).position != -1 || lines.filePos(1, 0).position != -1)) {
+            fail("found a position outside of the program");
+        }
+    }
+
+    if (passed) std::cout << "[lines] passed" << std::endl;
+    return passed;
+}
+
+#ifdef PERLPARSER_ALLOCATION_TEST
+/**
+ * Tokenising a program again with a reused tokeniser and token vector should not allocate at all, as long as no token
+ * needs owned data (see SourceBuffer::own). Needs the counting operator new, so only runs in PerlParserTests
+ */
+bool runAllocationTest() {
+    bool passed = true;
+    Tokeniser tokeniser("");
+    std::vector<Token> tokens;
+
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        std::string program = readFile(perlFile);
+        tokeniser.reset(program);
+        tokeniser.tokenise(tokens);
+        if (!tokeniser.getSource()->ownedData.empty()) continue;
+
+        tokeniser.reset(program);
+        allocationCounter::count = 0;
+        allocationCounter::counting = true;
+        tokeniser.tokenise(tokens);
+        allocationCounter::counting = false;
+
+        if (allocationCounter::count > 0) {
+            std::cout << console::bold << console::red << "[allocations] FAILED - " << fileName(perlFile) << " made "
+                      << allocationCounter::count << " allocations for " << tokens.size() << " tokens" << console::clear
+                      << std::endl;
+            passed = false;
+        }
+    }
+
+    if (passed) std::cout << "[allocations] passed" << std::endl;
+    return passed;
+}
+#endif
+
+/**
+ * Check the bracket index against finding each bracket's match by walking the tokens, for each test program with some
+ * unmatched brackets added
+ */
+bool runBracketIndexTest() {
+    bool passed = true;
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        for (auto &extra : std::vector<std::string>{"", "{", "}\n", "{ {\n"}) {
+            Tokeniser tokeniser(extra + readFile(perlFile) + extra);
+            auto tokens = tokeniser.tokenise();
+            BracketIndex index(tokens);
+
+            for (int i = 0; i < (int) tokens.size() && passed; i++) {
+                int expectedMatch = -1;
+                int expectedDepth = 0;
+                int level = 0;
+                if (tokens[i].type == TokenType::LBracket) {
+                    for (int j = i + 1; j < (int) tokens.size() && expectedMatch == -1; j++) {
+                        if (tokens[j].type == TokenType::LBracket) level++;
+                        if (tokens[j].type == TokenType::RBracket && level-- == 0) expectedMatch = j;
+                    }
+                    for (int j = 0; j < i; j++) {
+                        if (tokens[j].type == TokenType::LBracket) expectedDepth++;
+                        if (tokens[j].type == TokenType::RBracket && expectedDepth > 0) expectedDepth--;
+                    }
+                    int pair = index.enclosingPair(i);
+                    if (pair == -1 || index.open[pair] != i || index.depth[pair] != expectedDepth) passed = false;
+                } else if (tokens[i].type == TokenType::RBracket) {
+                    for (int j = i - 1; j >= 0 && expectedMatch == -1; j--) {
+                        if (tokens[j].type == TokenType::RBracket) level++;
+                        if (tokens[j].type == TokenType::LBracket && level-- == 0) expectedMatch = j;
+                    }
+                    // Brackets before an unmatched '}' are all closed, so it can't match one of them
+                    if (expectedMatch != -1 && index.matching(expectedMatch) != i) expectedMatch = -1;
+                } else {
+                    continue;
+                }
+
+                if (index.matching(i) != expectedMatch || !passed) {
+                    std::cout << console::bold << console::red << "[brackets] FAILED - " << fileName(perlFile)
+                              << " token " << i << " matches " << index.matching(i) << " expected " << expectedMatch
+                              << console::clear << std::endl;
+                    passed = false;
+                }
+            }
+        }
+    }
+
+    if (passed) std::cout << "[brackets] passed" << std::endl;
+    return passed;
+}
+
+bool runPackageIndexTest() {
+    bool passed = true;
+    auto check = [&](const std::vector<PackageSpan> &packages, const FilePos &pos, const std::string &source) {
+        auto expected = findPackageAtPos(packages, pos);
+        auto actual = PackageIndex(packages).packageAt(pos);
+        if (passed && actual != expected) {
+            std::cout << console::bold << console::red << "[packages] FAILED - " << source << " at " << pos.toStr()
+                      << " got " << actual << " expected " << expected << console::clear << std::endl;
+            passed = false;
+        }
+    };
+
+    // Inverted spans cover nothing and earlier spans win where they overlap
+    std::vector<PackageSpan> spans{PackageSpan(FilePos(0), FilePos(25), "A"),
+                                   PackageSpan(FilePos(25), FilePos(28), "B"),
+                                   PackageSpan(FilePos(52), FilePos(31), "C"),
+                                   PackageSpan(FilePos(22), FilePos(74), "B"),
+                                   PackageSpan(FilePos(), FilePos(80), "D")};
+    for (int position = -2; position < 90; position++) check(spans, FilePos(position), "spans");
+
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        for (auto &extra : std::vector<std::string>{"", "package A;\n{ package B {\n", "}\npackage C; package D;"}) {
+            Tokeniser tokeniser(extra + readFile(perlFile) + extra);
+            std::vector<Token> tokens;
+            TriviaTable trivia;
+            tokeniser.tokenise(tokens, trivia);
+            int partial = -1;
+            auto packages = parsePackages(buildParseTree(tokens, partial));
+            for (const auto &token : tokens) {
+                check(packages, token.startPos, fileName(perlFile));
+                check(packages, FilePos(token.startPos.position - 1), fileName(perlFile));
+            }
+        }
+    }
+
+    if (passed) std::cout << "[packages] passed" << std::endl;
+    return passed;
+}
+
+bool runSymbolIndexTest() {
+    bool passed = true;
+    auto fail = [&](const std::string &perlFile, const Range &range, const std::string &symbol) {
+        if (passed) {
+            std::cout << console::bold << console::red << "[symbols] FAILED - " << fileName(perlFile) << " "
+                      << symbol << " not found at " << range.from.toStr() << console::clear << std::endl;
+        }
+        passed = false;
+    };
+
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        auto fileSymbols = analysis::getFileSymbols(perlFile);
+        SymbolIndex index;
+        for (const auto &variable : fileSymbols.variableUsages) index.addVariable(variable.first, variable.second);
+        for (const auto &global : fileSymbols.globals) index.addGlobal(global.first, global.second);
+        for (const auto &sub : fileSymbols.fileSubroutineUsages) {
+            index.addSubroutine(SubroutineDecl(sub.first, perlFile), sub.second);
+        }
+        index.build();
+
+        // Every occurrence should find its symbol from its first and last character
+        for (const auto &variable : fileSymbols.variableUsages) {
+            for (const auto &usage : variable.second) {
+                if (index.variableAt(usage.from) != variable.first || index.variableAt(usage.to) != variable.first) {
+                    fail(perlFile, usage, variable.first->name);
+                }
+            }
+        }
+
+        for (const auto &global : fileSymbols.globals) {
+            for (const auto &usage : global.second) {
+                auto found = index.globalAt(usage.getLocation().to);
+                if (!found.has_value() || !(found.value() == global.first)) {
+                    fail(perlFile, usage.getLocation(), global.first.getFullName());
+                }
+            }
+        }
+
+        for (const auto &sub : fileSymbols.fileSubroutineUsages) {
+            for (const auto &usage : sub.second) {
+                auto found = index.subroutineAt(usage.location.from);
+                if (!found.has_value() || found.value().subroutine.getFullName() != sub.first.getFullName()) {
+                    fail(perlFile, usage.location, sub.first.getFullName());
+                }
+            }
+        }
+
+        if (index.variableAt(FilePos()) != nullptr || index.globalAt(FilePos(INT32_MAX)).has_value()) {
+            fail(perlFile, Range(FilePos(), FilePos()), "nothing");
+        }
+    }
+
+    if (passed) std::cout << "[symbols] passed" << std::endl;
+    return passed;
+}
+
+// Variables visible at pos by walking every scope containing it, later declarations replacing earlier ones
+static void addScopeVariables(const SymbolNode &node, const FilePos &pos,
+                              std::map<std::string, std::shared_ptr<Variable>> &visible) {
+    for (const auto &variable : node.variables) visible[variable->name] = variable;
+    for (const auto &child : node.children) {
+        if (child->startPos <= pos && pos <= child->endPos) {
+            addScopeVariables(*child, pos, visible);
+        }
+    }
+}
+
+bool runVisibleVariablesTest() {
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        auto fileSymbols = analysis::getFileSymbols(perlFile);
+        FileSymbols loaded = fileSymbols;
+        loaded.symbolTree = symbolNodeFromJson(toJson(*fileSymbols.symbolTree));
+
+        for (const auto &variable : fileSymbols.variableUsages) {
+            for (const auto &usage : variable.second) {
+                std::map<std::string, std::shared_ptr<Variable>> expected;
+                addScopeVariables(*fileSymbols.symbolTree, usage.from, expected);
+
+                for (const auto *symbols : {&fileSymbols, &loaded}) {
+                    auto visible = getVisibleVariables(*symbols, usage.from);
+                    bool same = visible.size() == expected.size();
+                    auto it = expected.begin();
+                    for (int i = 0; same && i < (int) visible.size(); i++, it++) {
+                        same = visible[i]->name == it->second->name &&
+                               visible[i]->declaration == it->second->declaration;
+                    }
+
+                    if (!same || findVisibleVariable(visible, variable.first->name) == nullptr) {
+                        std::cout << console::bold << console::red << "[scopes] FAILED - " << fileName(perlFile)
+                                  << " variables at " << usage.from.toStr() << console::clear << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "[scopes] passed" << std::endl;
+    return true;
+}
+
+// FileSymbols as JSON, with the symbols from unordered maps sorted so that it doesn't depend on the order they were added
+static std::string fileSymbolsDump(FileSymbols &fileSymbols) {
+    json j = toJson(fileSymbols);
+    for (auto key : {"globals", "subroutineDeclarations", "variableUsages"}) {
+        std::vector<std::string> items;
+        for (const auto &item : j[key]) items.emplace_back(item.dump());
+        std::sort(items.begin(), items.end());
+        j[key] = items;
+    }
+
+    std::vector<std::string> subroutineUsages;
+    for (const auto &usages : fileSymbols.fileSubroutineUsages) {
+        for (const auto &code : usages.second) {
+            subroutineUsages.emplace_back(usages.first.getFullName() + " " + code.code + " " +
+                                          code.location.from.toStr() + " " + code.location.to.toStr());
+        }
+    }
+    std::sort(subroutineUsages.begin(), subroutineUsages.end());
+    j["fileSubroutineUsages"] = subroutineUsages;
+    return j.dump();
+}
+
+bool runParallelAnalysisTest() {
+    for (auto &perlFile : globglob("../test/pl/*.pl")) {
+        auto program = readFile(perlFile);
+        Tokeniser tokeniser(program);
+        std::vector<Token> tokens;
+        TriviaTable trivia;
+        tokeniser.tokenise(tokens, trivia);
+        int partial = -1;
+        auto tree = buildParseTree(tokens, partial);
+
+        FileSymbols single;
+        parseFileSymbols(tree, single, 1);
+        auto expected = fileSymbolsDump(single);
+        for (int threads : {2, 5}) {
+            FileSymbols parallel;
+            parseFileSymbols(tree, parallel, threads);
+            if (fileSymbolsDump(parallel) != expected) {
+                std::cout << console::bold << console::red << "[parallel] FAILED - " << fileName(perlFile) << " on "
+                          << threads << " threads" << console::clear << std::endl;
+                return false;
+            }
+        }
+    }
+
+    std::cout << "[parallel] passed" << std::endl;
+    return true;
+}
+
+// Output that is thrown away, for hiding the logs of loading files. They can be loaded on several threads, so this
+// can't be a stringstream
+struct DiscardBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+// Each file in the graph with its imports and importers, sorted
+static std::string graphDump(const std::unordered_map<std::string, PathNode> &graph) {
+    std::map<std::string, std::string> nodes;
+    for (const auto &node : graph) {
+        std::string edges;
+        for (const auto &child : node.second.children) edges += " >" + fileName(child);
+        for (const auto &parent : node.second.parents) edges += " <" + fileName(parent);
+        nodes[fileName(node.first)] = edges;
+    }
+
+    std::string dump;
+    for (const auto &node : nodes) dump += node.first + ":" + node.second + "\n";
+    return dump;
+}
+
+// Edit files in a project and check that the graph kept between edits matches one loaded from scratch
+bool runProjectGraphTest() {
+    auto directory = std::filesystem::temp_directory_path() / "perlparser-graph-test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    auto write = [&](const std::string &name, const std::string &contents) {
+        std::ofstream((directory / name).string()) << contents;
+    };
+
+    write("main.pl", "use A;\n");
+    write("Other.pm", "package Other;\nuse D;\n1;\n");
+    write("A.pm", "package A;\nuse B;\nuse C;\n1;\n");
+    write("B.pm", "package B;\nuse C;\n1;\n");
+    write("C.pm", "package C;\n1;\n");
+    write("D.pm", "package D;\n1;\n");
+
+    std::vector<std::string> projectFiles{(directory / "main.pl").string(), (directory / "Other.pm").string()};
+    std::vector<std::string> includes{directory.string()};
+
+    // Each step is files to rewrite before updating
+    std::vector<std::vector<std::pair<std::string, std::string>>> edits{
+            {},
+            {{"A.pm", "package A;\nuse C;\nuse D;\n1;\n"}},
+            {{"C.pm", "package C;\nuse B;\n1;\n"},     {"Other.pm", "package Other;\n1;\n"}},
+            {{"D.pm", "package D;\nuse Missing;\n1;\n"}},
+    };
+
+    // Loading logs every file, from several threads
+    DiscardBuffer discarded;
+    auto original = std::cout.rdbuf(&discarded);
+    Cache cache;
+    ProjectGraph projectGraph;
+    bool passed = true;
+    std::string difference;
+    for (int step = 0; step < (int) edits.size() && passed; step++) {
+        for (const auto &edit : edits[step]) write(edit.first, edit.second);
+
+        projectGraph.update(projectFiles, includes, cache, 2);
+        auto expected = graphDump(loadProjectGraph(projectFiles, includes, cache, 2));
+        auto actual = graphDump(projectGraph.nodes());
+        if (actual != expected) {
+            passed = false;
+            difference = "after edit " + std::to_string(step) + "\nexpected:\n" + expected + "actual:\n" + actual;
+        }
+    }
+    std::cout.rdbuf(original);
+    std::filesystem::remove_all(directory);
+
+    if (!passed) {
+        std::cout << console::bold << console::red << "[graph] FAILED - " << difference << console::clear << std::endl;
+        return false;
+    }
+
+    std::cout << "[graph] passed" << std::endl;
+    return true;
+}
+
+// Files reachable from path along children and/or parents, found the simplest way
+static std::set<std::string> reachableFrom(const std::unordered_map<std::string, PathNode> &graph,
+                                           const std::string &path, bool children, bool parents) {
+    std::set<std::string> seen;
+    std::vector<std::string> stack{path};
+    while (!stack.empty()) {
+        auto current = stack.back();
+        stack.pop_back();
+        auto node = graph.find(current);
+        if (node == graph.end()) continue;
+
+        std::vector<std::string> next;
+        if (children) next.insert(next.end(), node->second.children.begin(), node->second.children.end());
+        if (parents) next.insert(next.end(), node->second.parents.begin(), node->second.parents.end());
+        for (const auto &file : next) {
+            if (seen.insert(file).second) stack.emplace_back(file);
+        }
+    }
+
+    return seen;
+}
+
+// Searches of an ImportGraph against the map it was made from, on random graphs with cycles and separate parts
+bool runImportGraphTest() {
+    std::mt19937 random(7);
+    for (int round = 0; round < 20; round++) {
+        int files = 1 + (int) (random() % 300);
+        int imports = (int) (random() % (files * 2));
+        std::unordered_map<std::string, PathNode> graph;
+        for (int i = 0; i < imports; i++) {
+            auto parent = "/lib/" + std::to_string(random() % files) + ".pm";
+            auto child = "/lib/" + std::to_string(random() % files) + ".pm";
+            graph[parent].children.insert(child);
+            graph[child].parents.insert(parent);
+        }
+
+        ImportGraph importGraph(graph);
+        for (const auto &node : graph) {
+            auto id = importGraph.id(node.first);
+            if (!id.has_value() || importGraph.path(id.value()) != node.first) {
+                std::cout << console::bold << console::red << "[import graph] FAILED - no id for " << node.first
+                          << console::clear << std::endl;
+                return false;
+            }
+
+            auto connected = reachableFrom(graph, node.first, true, true);
+            connected.insert(node.first);
+            auto descendents = reachableFrom(graph, node.first, true, false);
+            auto importers = reachableFrom(graph, node.first, false, true);
+            importers.insert(node.first);
+            std::vector<std::tuple<std::string, std::vector<int>, std::set<std::string>>> searches{
+                    {"connected to ",   importGraph.connectedTo(id.value()),   connected},
+                    {"descendents of ", importGraph.descendentsOf(id.value()), descendents},
+                    {"importers of ",   importGraph.importersOf({id.value()}), importers},
+            };
+
+            for (const auto &search : searches) {
+                std::set<std::string> actual;
+                for (int file : std::get<1>(search)) actual.insert(importGraph.path(file));
+                if (actual.size() != std::get<1>(search).size() || actual != std::get<2>(search)) {
+                    std::cout << console::bold << console::red << "[import graph] FAILED - " << std::get<0>(search)
+                              << node.first << " in round " << round << console::clear << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    std::cout << "[import graph] passed" << std::endl;
+    return true;
+}
+
+// Files found through an IncludeIndex and through use lib, in a temporary project
+bool runIncludesTest() {
+    auto directory = std::filesystem::temp_directory_path() / "perlparser-includes-test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "lib" / "My");
+    std::filesystem::create_directories(directory / "script");
+    auto write = [&](const std::string &name, const std::string &contents) {
+        std::ofstream((directory / name).string()) << contents;
+    };
+
+    write("lib/My/Module.pm", "package My::Module;\n1;\n");
+    write("lib/My/Other.pm", "package My::Other;\n1;\n");
+    write("script/main.pl", "use FindBin;\nuse lib \"$FindBin::Bin/../lib\";\nuse My::Module;\n");
+    write("top.pl", "use lib qw(lib);\nuse My::Other;\nuse My::Missing;\n");
+
+    std::string failure;
+    IncludeIndex includeIndex(std::chrono::hours(1));
+    IncludeIndex recheckingIndex(std::chrono::milliseconds(0));
+    std::vector<std::string> includes{(directory / "script").string(), (directory / "lib").string(),
+                                      directory.string()};
+    for (const char *path : {"My/Module.pm", "My/Missing.pm", "Missing/Module.pm", "main.pl", "My",
+                                    "script/main.pl", "script/../lib/My/Other.pm"}) {
+        std::optional<std::string> expected;
+        for (const auto &include : includes) {
+            if (std::filesystem::is_regular_file(include + "/" + path)) {
+                expected = include + "/" + path;
+                break;
+            }
+        }
+
+        if (includeIndex.resolve(includes, path) != expected) failure = std::string("resolving ") + path;
+        if (recheckingIndex.resolve(includes, path) != expected) failure = std::string("resolving ") + path;
+    }
+
+    // Directories are listed as they are looked through, so a module made afterwards isn't found until they're checked.
+    // The directory's modification time is moved on, as it may not change if the module is made soon after the listing
+    write("lib/My/Missing.pm", "package My::Missing;\n1;\n");
+    auto modified = std::filesystem::last_write_time(directory / "lib" / "My");
+    std::filesystem::last_write_time(directory / "lib" / "My", modified + std::chrono::seconds(1));
+    if (failure.empty() && includeIndex.resolve(includes, "My/Missing.pm").has_value()) failure = "cached miss";
+    if (failure.empty() && recheckingIndex.resolve(includes, "My/Missing.pm") !=
+                           std::optional<std::string>((directory / "lib/My/Missing.pm").string())) {
+        failure = "rechecked miss";
+    }
+
+    DiscardBuffer discarded;
+    auto original = std::cout.rdbuf(&discarded);
+    Cache cache;
+    auto graph = loadProjectGraph({(directory / "top.pl").string(), (directory / "script/main.pl").string()}, {},
+                                  cache, 1);
+    std::cout.rdbuf(original);
+
+    std::set<std::string> topImports{(directory / "lib/My/Other.pm").string(),
+                                     (directory / "lib/My/Missing.pm").string()};
+    std::set<std::string> mainImports{(directory / "lib/My/Module.pm").string()};
+    if (failure.empty() && graph[(directory / "top.pl").string()].children != topImports) failure = "use lib qw(lib)";
+    if (failure.empty() && graph[(directory / "script/main.pl").string()].children != mainImports) {
+        failure = "use lib with $FindBin::Bin";
+    }
+    std::filesystem::remove_all(directory);
+
+    if (!failure.empty()) {
+        std::cout << console::bold << console::red << "[includes] FAILED - " << failure << console::clear << std::endl;
+        return false;
+    }
+
+    std::cout << "[includes] passed" << std::endl;
+    return true;
+}
+
+// Duplicated replacements are made once, and any other overlap, or one past the end, fails without replacing anything
+bool runReplacementsTest() {
+    std::string text = "my $foo = $foo + 1;";
+    auto replace = [](int from, int to, const std::string &replacement) {
+        return Replacement(Range(FilePos(from), FilePos(to)), replacement);
+    };
+
+    std::string failure;
+    auto replaced = doReplacements(text, {replace(10, 13, "$bar"), replace(3, 6, "$bar"), replace(10, 13, "$bar")});
+    if (replaced != std::optional<std::string>("my $bar = $bar + 1;")) failure = "duplicated replacement";
+    if (failure.empty() && doReplacements(text, {replace(3, 6, "$bar"), replace(5, 8, "x")}).has_value()) {
+        failure = "overlapping replacements";
+    }
+    if (failure.empty() && doReplacements(text, {replace(3, 6, "$bar"), replace(3, 6, "$baz")}).has_value()) {
+        failure = "different replacements of the same range";
+    }
+    if (failure.empty() && doReplacements(text, {replace(18, 19, ";")}).has_value()) {
+        failure = "replacement past the end";
+    }
+
+    if (!failure.empty()) {
+        std::cout << console::bold << console::red << "[replacements] FAILED - " << failure << console::clear
+                  << std::endl;
+        return false;
+    }
+
+    std::cout << "[replacements] passed" << std::endl;
+    return true;
+}
+
 void runTests() {
     auto tokenFiles = globglob("../test/expected/*");
-    int total = tokenFiles.size();
+    int total = tokenFiles.size() + 14;
+#ifdef PERLPARSER_ALLOCATION_TEST
+    total++;
+#endif
     int success = 0;
 
     for (auto &testFile : tokenFiles) {
@@ -74,6 +887,24 @@ void runTests() {
         }
     }
 
+    if (runNumericLiteralTest()) success++;
+    if (runScanTest()) success++;
+    if (runIncrementalTest()) success++;
+    if (runTriviaTest()) success++;
+    if (runLineIndexTest()) success++;
+#ifdef PERLPARSER_ALLOCATION_TEST
+    if (runAllocationTest()) success++;
+#endif
+    if (runBracketIndexTest()) success++;
+    if (runPackageIndexTest()) success++;
+    if (runSymbolIndexTest()) success++;
+    if (runVisibleVariablesTest()) success++;
+    if (runParallelAnalysisTest()) success++;
+    if (runProjectGraphTest()) success++;
+    if (runImportGraphTest()) success++;
+    if (runIncludesTest()) success++;
+    if (runReplacementsTest()) success++;
+
     std::cout << std::endl << console::clear << console::bold;
     if (success == total) {
         std::cout << "All tests passed!";
@@ -97,10 +928,9 @@ void makeTest(std::string &name) {
 
     Tokeniser tokeniser(perlContents);
     auto tokens = tokeniser.tokenise();
-    TokenIterator tokenIterator(tokens,
-                                std::vector<TokenType>{TokenType::Whitespace, TokenType::Newline});
+    TokenIterator tokenIterator(tokens, TokenTypeSet{TokenType::Whitespace, TokenType::Newline});
 
-    Token token(TokenType::Newline, FilePos(0, 0, 0));
+    Token token(TokenType::Newline, FilePos(0));
     do {
         token = tokenIterator.next();
 
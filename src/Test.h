@@ -7,11 +7,29 @@
 
 #include "Token.h"
 #include "Tokeniser.h"
+#include "LineIndex.h"
+#include "Scan.h"
+#include "BracketIndex.h"
+#include "Parser.h"
+#include "FileAnalysis.h"
+#include "Refactor.h"
+#include "Serialize.h"
 #include "IOException.h"
 #include "Util.h"
+#ifdef PERLPARSER_ALLOCATION_TEST
+#include "AllocationCounter.h"
+#endif
 #include <fstream>
+#include <map>
+#include <random>
+#include <regex>
+#include <tuple>
 
 void runTests();
 void makeTest(std::string &name);
 
+// Reference implementations of the numeric and version string checks, using the regexes the tokeniser used to use
+bool regexIsNumericLiteral(std::string_view str);
+bool regexIsVersionString(std::string_view str);
+
 #endif //PERLPARSER_TEST_H
@@ -0,0 +1,101 @@
+#include "ThreadPool.h"
+
+// Pool and queue of the current thread, if it belongs to a pool
+static thread_local ThreadPool *currentPool = nullptr;
+static thread_local int currentQueue = -1;
+
+ThreadPool::ThreadPool(int threads) {
+    threads = std::max(1, threads);
+    for (int i = 0; i < threads; i++) queues.emplace_back(std::make_unique<WorkQueue>());
+    for (int i = 0; i < threads; i++) this->threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    taskAdded.notify_all();
+    for (auto &thread : threads) thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    int queue = currentPool == this ? currentQueue : (int) (nextQueue++ % queues.size());
+    unfinished++;
+    {
+        std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+        queues[queue]->tasks.emplace_back(std::move(task));
+    }
+    queued++;
+
+    // Taking the lock means a thread can't miss this between checking for tasks and going to sleep
+    { std::lock_guard<std::mutex> lock(stateMutex); }
+    taskAdded.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    allFinished.wait(lock, [&] { return unfinished == 0; });
+    if (error) {
+        auto thrown = error;
+        error = nullptr;
+        std::rethrow_exception(thrown);
+    }
+}
+
+int ThreadPool::size() const {
+    return threads.size();
+}
+
+bool ThreadPool::onPoolThread() {
+    return currentPool != nullptr;
+}
+
+bool ThreadPool::takeTask(int queue, std::function<void()> &task) {
+    for (int i = 0; i < (int) queues.size(); i++) {
+        auto &workQueue = *queues[(queue + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(workQueue.mutex);
+        if (workQueue.tasks.empty()) continue;
+
+        // Newest from our own queue, oldest from anyone else's
+        if (i == 0) {
+            task = std::move(workQueue.tasks.back());
+            workQueue.tasks.pop_back();
+        } else {
+            task = std::move(workQueue.tasks.front());
+            workQueue.tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::run(int queue) {
+    currentPool = this;
+    currentQueue = queue;
+
+    std::function<void()> task;
+    while (true) {
+        if (takeTask(queue, task)) {
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (!error) error = std::current_exception();
+            }
+            task = nullptr;
+
+            if (--unfinished == 0) {
+                { std::lock_guard<std::mutex> lock(stateMutex); }
+                allFinished.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        taskAdded.wait(lock, [&] { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
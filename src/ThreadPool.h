@@ -0,0 +1,73 @@
+#ifndef PERLPARSER_THREADPOOL_H
+#define PERLPARSER_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of threads that run tasks, with a queue per thread.
+ *
+ * A task submitted from one of the pool's threads goes on that thread's queue, which it runs newest first so work that
+ * fans out (like following imports) stays on the thread that found it. A thread with nothing left to run steals the
+ * oldest task from another thread's queue. Tasks submitted from outside the pool are spread over the queues.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads);
+
+    // Finishes every task that has been submitted before returning
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> task);
+
+    // Block until every task has finished, including ones submitted by other tasks. If a task threw, the first
+    // exception is rethrown here
+    void wait();
+
+    int size() const;
+
+    // True on a thread belonging to any pool, so work done there can avoid starting threads of its own
+    static bool onPoolThread();
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(int queue);
+
+    // Take a task from the back of queue, or the front of any other, returning false if they are all empty
+    bool takeTask(int queue, std::function<void()> &task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+
+    // Tasks submitted that haven't finished, and tasks waiting in a queue
+    std::atomic<int> unfinished{0};
+    std::atomic<int> queued{0};
+
+    // Guards sleeping and waking threads, stopping and error
+    std::mutex stateMutex;
+    std::condition_variable taskAdded;
+    std::condition_variable allFinished;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    std::atomic<unsigned> nextQueue{0};
+};
+
+
+#endif //PERLPARSER_THREADPOOL_H
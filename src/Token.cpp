@@ -4,18 +4,25 @@
 
 #include "Token.h"
 
+SourceBuffer::SourceBuffer(std::string text) : text(std::move(text)) {}
+
+std::string_view SourceBuffer::own(std::string data) {
+    return this->ownedData.emplace_back(std::move(data));
+}
+
 bool Token::isWhitespaceNewlineOrComment() {
     return type == TokenType::Whitespace || type == TokenType::Newline || type == TokenType::Comment;
 }
 
-Token::Token(const TokenType &type, FilePos start, int endCol, const std::string &data) {
-    this->type = type;
-    this->data = data;
-    this->startPos = start;
-    this->endPos = FilePos(start.line, endCol, startPos.position + (endCol - start.col));
+TokenType Token::rawType() const {
+    if (!isSecondPassType) return type;
+    if (type == TokenType::HashKey) return TokenType::Name;
+    if (type == TokenType::HashSubStart || type == TokenType::HashDerefStart) return TokenType::LBracket;
+    if (type == TokenType::HashSubEnd || type == TokenType::HashDerefEnd) return TokenType::RBracket;
+    return type;
 }
 
-Token::Token(const TokenType &type, FilePos start, FilePos end, const std::string &data) {
+Token::Token(const TokenType &type, FilePos start, FilePos end, std::string_view data) {
     this->type = type;
     this->data = data;
     this->startPos = start;
@@ -24,15 +31,15 @@ Token::Token(const TokenType &type, FilePos start, FilePos end, const std::strin
     this->endPos = end;
 }
 
-Token::Token(const TokenType &type, FilePos start, const std::string &data) {
+Token::Token(const TokenType &type, FilePos start, std::string_view data) {
     this->type = type;
     this->data = data;
     this->startPos = start;
 
     if (data.size() > 0) {
-        this->endPos = FilePos(start.line, start.col + (int) data.size() - 1, startPos.position + data.size() - 1);
+        this->endPos = FilePos(start.position + (int) data.size() - 1);
     } else {
-        this->endPos = FilePos(start.line, start.col, start.position);
+        this->endPos = start;
     }
 }
 
@@ -46,7 +53,7 @@ std::string Token::toStr(bool includeLocation) {
     tokenStr += tokenTypeToString(this->type);
 
     if (!this->data.empty()) {
-        auto d1 = replace(this->data, "\n", "\\n");
+        auto d1 = replace(std::string(this->data), "\n", "\\n");
         auto d2 = replace(d1, "\r", "\\r");
         tokenStr += "(" + d2 + ")";
     }
@@ -54,6 +61,38 @@ std::string Token::toStr(bool includeLocation) {
     return tokenStr;
 }
 
+void TriviaTable::clear() {
+    trivia.clear();
+    before.clear();
+    program = std::string_view();
+}
+
+Token TriviaTable::toToken(const Trivia &item) const {
+    Token token(item.type, item.start, program.substr(item.start.position, item.length));
+    token.isRestartPoint = item.isRestartPoint;
+    return token;
+}
+
+std::vector<Token> TriviaTable::triviaBefore(int i) const {
+    std::vector<Token> tokens;
+    for (int j = before[i]; j < before[i + 1]; j++) tokens.emplace_back(toToken(trivia[j]));
+    return tokens;
+}
+
+std::vector<Token> TriviaTable::withTrivia(const std::vector<Token> &tokens) const {
+    std::vector<Token> allTokens;
+    allTokens.reserve(tokens.size() + trivia.size());
+    for (int i = 0; i < (int) tokens.size(); i++) {
+        for (int j = before[i]; j < before[i + 1]; j++) allTokens.emplace_back(toToken(trivia[j]));
+        allTokens.emplace_back(tokens[i]);
+    }
+
+    // Anything after the last significant token
+    for (int j = before[tokens.size()]; j < (int) trivia.size(); j++) allTokens.emplace_back(toToken(trivia[j]));
+
+    return allTokens;
+}
+
 std::string tokenTypeToString(const TokenType &t) {
     if (t == TokenType::String) return "String";
     if (t == TokenType::ScalarVariable) return "ScalarVariable";
@@ -134,68 +173,58 @@ bool isWhitespaceNewlineComment(const TokenType &tokenType) {
     return tokenType == TokenType::Whitespace || tokenType == TokenType::Newline || tokenType == TokenType::Comment;
 }
 
+static const Token END_OF_INPUT(TokenType::EndOfInput, FilePos());
+
 int TokenIterator::getIndex() { return i; }
 
-TokenIterator::TokenIterator(const std::vector<Token> &tokens, std::vector<TokenType> ignoreTokens, int offset)
-        : tokens(tokens) {
-    this->ignoreTokens = ignoreTokens;
-    this->i = offset;
-}
-
-TokenIterator::TokenIterator(const std::vector<Token> &tokens, std::vector<TokenType> ignoreTokens) : tokens(tokens) {
-    this->ignoreTokens = ignoreTokens;
-    this->i = 0;
-}
-
-Token TokenIterator::next() {
-    while (i < tokens.size()) {
-        bool shouldIgnore = false;
-        for (auto ignore: ignoreTokens) {
-            if (tokens[i].type == ignore) {
-                // Try next token
-                i++;
-                shouldIgnore = true;
-                break;
-            }
-        }
-
-        if (shouldIgnore) continue;
-        auto token = tokens[i];
-        i++;
-        return token;
-    }
+TokenIterator::TokenIterator(const std::vector<Token> &tokens, TokenTypeSet ignoreTokens, int offset)
+        : TokenIterator(tokens, ignoreTokens, offset, tokens.size()) {}
+
+TokenIterator::TokenIterator(const std::vector<Token> &tokens, TokenTypeSet ignoreTokens)
+        : TokenIterator(tokens, ignoreTokens, 0, tokens.size()) {}
 
-    return Token(TokenType::EndOfInput, FilePos(0, 0));
+TokenIterator::TokenIterator(const std::vector<Token> &tokens, TokenTypeSet ignoreTokens, int begin, int end)
+        : tokens(tokens), ignoreTokens(ignoreTokens), i(begin), end(end) {
+    skipIgnored();
 }
 
-Token TokenIterator::peek() {
-    int currentI = this->i;
-    auto next = this->next();
-    this->i = currentI;
-    return next;
+void TokenIterator::skipIgnored() {
+    while (i < end && ignoreTokens.contains(tokens[i].type)) i++;
+}
+
+const Token &TokenIterator::next() {
+    if (i >= end) return END_OF_INPUT;
+    const Token &token = tokens[i];
+    i++;
+    skipIgnored();
+    return token;
+}
+
+const Token &TokenIterator::peek() const {
+    return i < end ? tokens[i] : END_OF_INPUT;
 }
 
 
 std::optional<std::string> TokenIterator::tryGetString() {
     // TODO this probably should be in a different place
     int currentI = this->i;
-    Token next = this->next();
+    const Token *next = &this->next();
 
     // Quote ident is start of a string
-    if (next.type == TokenType::QuoteIdent) {
+    if (next->type == TokenType::QuoteIdent) {
         // Don't support transliteration/subsitution
-        if (next.data == "tr" || next.data == "y") return std::optional<std::string>();
+        if (next->data == "tr" || next->data == "y") return std::optional<std::string>();
 
-        next = this->next();
-        if (next.type != TokenType::StringStart) return std::optional<std::string>();
+        next = &this->next();
+        if (next->type != TokenType::StringStart) return std::optional<std::string>();
 
-        next = this->next();
-        if (next.type == TokenType::String) return next.data;
+        next = &this->next();
+        if (next->type == TokenType::String) return std::string(next->data);
     }
 
-    if (next.type == TokenType::StringStart) {
-        next = this->next();
-        if (next.type == TokenType::String) return next.data;
+    if (next->type == TokenType::StringStart) {
+        next = &this->next();
+        if (next->type == TokenType::String) return std::string(next->data);
     }
 
     // Failed to find a string - go back to starting location
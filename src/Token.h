@@ -6,7 +6,12 @@
 #define PERLPARSER_TOKEN_H
 
 #include <vector>
+#include <cstdint>
+#include <initializer_list>
+#include <deque>
+#include <memory>
 #include <optional>
+#include <string_view>
 #include "FilePos.h"
 #include "Util.h"
 
@@ -80,53 +85,146 @@ enum class TokenType {
     HashKey
 };
 
+/**
+ * Owns the program text that Token::data points into.
+ *
+ * Tokens don't own their data, it is a view into the program. So anything that keeps tokens around after the
+ * tokeniser has gone (such as the parse tree) must also hold on to the SourceBuffer they came from. FileSymbols copy
+ * the names they need out of the tokens, so don't.
+ */
+struct SourceBuffer {
+    explicit SourceBuffer(std::string text);
+
+    std::string text;
+
+    // Storage for the rare token whose data does not appear verbatim in the program (e.g. a string containing an
+    // escaped backslash). Deque so that views into existing items stay valid as more are added.
+    std::deque<std::string> ownedData;
+
+    std::string_view own(std::string data);
+};
+
 class Token {
 
 public:
     // When data is identical to code
-    Token(const TokenType &type, FilePos start, const std::string &data = "");
-
-    Token(const TokenType &type, FilePos start, int endCol, const std::string &data = "");
+    Token(const TokenType &type, FilePos start, std::string_view data = {});
 
-    Token(const TokenType &type, FilePos start, FilePos end, const std::string &data = "");
+    Token(const TokenType &type, FilePos start, FilePos end, std::string_view data = {});
 
     std::string toStr(bool includeLocation = false);
 
     bool isWhitespaceNewlineOrComment();
 
+    // Type the token had before the tokeniser's second pass reclassified it (e.g. HashKey -> Name)
+    TokenType rawType() const;
+
     TokenType type;
     // Position of token in file
     FilePos startPos;
     FilePos endPos;
+    // First token of a top level lexer step, so lexing can be restarted from here with no other state
+    bool isRestartPoint = false;
+    // type was set by the second pass rather than the lexer
+    bool isSecondPassType = false;
     // Readable name used in tostring
     // Optional data used. e.g. $ident has 'ident' as it's data, but keyword my has no data
-    std::string data;
+    // View into the SourceBuffer of the tokeniser that produced this token (or a string literal)
+    std::string_view data;
 
 
 private:
 
 };
 
+/**
+ * Whitespace, newline or comment token kept out of the main token stream. Its data is always the program text at
+ * start, so only the length is kept
+ */
+struct Trivia {
+    TokenType type;
+    FilePos start;
+    int length;
+    bool isRestartPoint;
+};
+
+/**
+ * Side table for the trivia removed from a token stream (see Tokeniser::tokenise(tokens, trivia)), so that the full
+ * stream can still be rebuilt for things like renaming and formatting
+ */
+struct TriviaTable {
+    std::vector<Trivia> trivia;
+
+    // Trivia directly before significant token i is trivia[before[i]] up to trivia[before[i + 1]], and anything
+    // after the last significant token is from trivia[before.back()]
+    std::vector<int> before;
+
+    // Program text the trivia is in
+    std::string_view program;
+
+    void clear();
+
+    Token toToken(const Trivia &item) const;
+
+    // Trivia directly before significant token i
+    std::vector<Token> triviaBefore(int i) const;
+
+    // Token stream with trivia put back in between the significant tokens
+    std::vector<Token> withTrivia(const std::vector<Token> &tokens) const;
+};
+
+/**
+ * Set of token types as a bit mask, so checking a token against it is a couple of instructions. There are more than 64
+ * token types, so it takes two words
+ */
+class TokenTypeSet {
+public:
+    constexpr TokenTypeSet() : bits{0, 0} {}
+
+    constexpr TokenTypeSet(std::initializer_list<TokenType> types) : bits{0, 0} {
+        for (auto type : types) bits[static_cast<int>(type) / 64] |= uint64_t(1) << (static_cast<int>(type) % 64);
+    }
+
+    constexpr bool contains(TokenType type) const {
+        return (bits[static_cast<int>(type) / 64] >> (static_cast<int>(type) % 64)) & 1;
+    }
+
+private:
+    uint64_t bits[2];
+};
+
+static_assert(static_cast<int>(TokenType::HashKey) < 128, "TokenTypeSet holds up to 128 token types");
+
+// Tokens that are only trivia. Token streams from Tokeniser::tokenise(tokens, trivia) have none of these
+constexpr TokenTypeSet TRIVIA_TOKENS{TokenType::Whitespace, TokenType::Newline, TokenType::Comment};
 
 // TODO make this an actual iterator
 class TokenIterator {
 public:
-    TokenIterator(const std::vector<Token> &tokens, std::vector<TokenType> ignoreTokens);
+    TokenIterator(const std::vector<Token> &tokens, TokenTypeSet ignoreTokens);
+
+    TokenIterator(const std::vector<Token> &tokens, TokenTypeSet ignoreTokens, int offset);
 
-    TokenIterator(const std::vector<Token> &tokens, std::vector<TokenType> ignoreTokens, int offset);
+    // Only iterate tokens[begin] up to tokens[end]
+    TokenIterator(const std::vector<Token> &tokens, TokenTypeSet ignoreTokens, int begin, int end);
 
-    Token next();
+    // Returned tokens are references into the token vector, or to a shared EndOfInput token once there are no more
+    const Token &next();
 
-    Token peek();
+    const Token &peek() const;
 
     int getIndex();
 
     std::optional<std::string> tryGetString();
 
 private:
+    // Move i on to the next token that isn't ignored, so that it always points at what next will return
+    void skipIgnored();
+
     const std::vector<Token> &tokens;
-    std::vector<TokenType> ignoreTokens;
+    TokenTypeSet ignoreTokens;
     int i;
+    int end;
 };
 
 
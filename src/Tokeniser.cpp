@@ -3,335 +3,73 @@
 //
 
 #include "Tokeniser.h"
+#include "Lexicon.h"
 
-static std::regex NUMERIC_REGEX(R"(^(\+|-)?((\d+|_)\.?(\d|_){0,}(e(\+|-)?(\d|_)+?)?|0x[\dabcdefABCDEF]+|0b[01]+|)$)");
-static std::regex VERSION_REGEX(R"(v?\d([_|\.]?\d){0,})");
+static const scan::StopChars LINE_END_CHARS{'\n', '\r', (char) EOF};
 
 Tokeniser::Tokeniser(std::string perl, bool doSecondPass) {
-    this->program = std::move(perl);
+    this->source = std::make_shared<SourceBuffer>(std::move(perl));
+    this->program = withoutByteOrderMark(this->source->text);
     this->doSecondPass = doSecondPass;
+}
+
+void Tokeniser::reset(std::string_view program, bool doSecondPass) {
+    // Tokens from the last program point into the source, so only reuse it if nothing else has hold of it
+    if (this->source.use_count() == 1) {
+        this->source->text.assign(program);
+        this->source->ownedData.clear();
+    } else {
+        this->source = std::make_shared<SourceBuffer>(std::string(program));
+    }
+    this->program = withoutByteOrderMark(this->source->text);
+    this->doSecondPass = doSecondPass;
+
+    this->_position = -1;
+    this->furthestRead = -1;
+    this->lineStart = 0;
+    this->pendingHereDocs.clear();
+    this->secondPassIndex = 0;
+    this->openBrackets.clear();
+}
+
+// Remove any unicode Byte Order Mark (e.g. 0xEFBBBF). Only the view is moved on, the text isn't copied
+std::string_view Tokeniser::withoutByteOrderMark(std::string_view text) {
+    if (text.size() >= 3 && text[0] == '\xEF' && text[1] == '\xBB' && text[2] == '\xBF') {
+        return text.substr(3, text.size() - 3);
+    } else if (text.size() >= 2 && text[0] == '\xFF' && text[1] == '\xFE') {
+        return text.substr(2, text.size() - 3);
+    } else if (text.size() >= 2 && text[0] == '\xFE' && text[1] == '\xFF') {
+        return text.substr(2, text.size() - 3);
+    } else if (text.size() >= 4 && text[0] == '\xFF' && text[1] == '\xFE' && text[2] == '\x00' && text[3] == '\x00') {
+        return text.substr(4, text.size() - 3);
+    } else if (text.size() >= 4 && text[0] == '\x00' && text[1] == '\x00' && text[2] == '\xFE' && text[3] == '\xFF') {
+        return text.substr(4, text.size() - 3);
+    }
+
+    return text;
+}
 
-    this->keywordMap = {{"use",      TokenType::Use},
-                        {"if",       TokenType::If},
-                        {"else",     TokenType::Else},
-                        {"elsif",    TokenType::ElsIf},
-                        {"unless",   TokenType::Unless},
-                        {"while",    TokenType::While},
-                        {"until",    TokenType::Until},
-                        {"for",      TokenType::For},
-                        {"foreach",  TokenType::Foreach},
-                        {"when",     TokenType::When},
-                        {"do",       TokenType::Do},
-                        {"next",     TokenType::Next},
-                        {"redo",     TokenType::Redo},
-                        {"last",     TokenType::Last},
-                        {"my",       TokenType::My},
-                        {"state",    TokenType::State},
-                        {"local",    TokenType::Local},
-                        {"our",      TokenType::Our},
-                        {"break",    TokenType::Break},
-                        {"continue", TokenType::Continue},
-                        {"given",    TokenType::Given},
-                        {"sub",      TokenType::Sub},
-                        {"package",  TokenType::Package},
-                        {"state",    TokenType::State},
-                        {"use",      TokenType::Use},
-                        {"require",  TokenType::Require}};
-
-    // Built in perl functions, from https://perldoc.perl.org/5.30.0/index-functions.html
-    this->builtinSubMap = {{"abs",              1},
-                           {"accept",           1},
-                           {"alarm",            1},
-                           {"and",              1},
-                           {"atan2",            1},
-                           {"bind",             1},
-                           {"binmode",          1},
-                           {"bless",            1},
-                           {"break",            1},
-                           {"caller",           1},
-                           {"chdir",            1},
-                           {"chmod",            1},
-                           {"chomp",            1},
-                           {"chop",             1},
-                           {"chown",            1},
-                           {"chr",              1},
-                           {"chroot",           1},
-                           {"close",            1},
-                           {"closedir",         1},
-                           {"cmp",              1},
-                           {"connect",          1},
-                           {"continue",         1},
-                           {"cos",              1},
-                           {"crypt",            1},
-                           {"__DATA__",         1},
-                           {"dbmclose",         1},
-                           {"dbmopen",          1},
-                           {"default",          1},
-                           {"defined",          1},
-                           {"delete",           1},
-                           {"die",              1},
-                           {"do",               1},
-                           {"dump",             1},
-                           {"each",             1},
-                           {"else",             1},
-                           {"elseif",           1},
-                           {"elsif",            1},
-                           {"endgrent",         1},
-                           {"endhostent",       1},
-                           {"endnetent",        1},
-                           {"endprotoent",      1},
-                           {"endpwent",         1},
-                           {"endservent",       1},
-                           {"eof",              1},
-                           {"eq",               1},
-                           {"eval",             1},
-                           {"evalbytes",        1},
-                           {"exec",             1},
-                           {"exists",           1},
-                           {"exit",             1},
-                           {"exp",              1},
-                           {"fc",               1},
-                           {"fcntl",            1},
-                           {"fileno",           1},
-                           {"flock",            1},
-                           {"for",              1},
-                           {"foreach",          1},
-                           {"fork",             1},
-                           {"format",           1},
-                           {"formline",         1},
-                           {"ge",               1},
-                           {"getc",             1},
-                           {"getgrent",         1},
-                           {"getgrgid",         1},
-                           {"getgrnam",         1},
-                           {"gethostbyaddr",    1},
-                           {"gethostbyname",    1},
-                           {"gethostent",       1},
-                           {"getlogin",         1},
-                           {"getnetbyaddr",     1},
-                           {"getnetbyname",     1},
-                           {"getnetent",        1},
-                           {"getpeername",      1},
-                           {"getpgrp",          1},
-                           {"getppid",          1},
-                           {"getpriority",      1},
-                           {"getprotobyname",   1},
-                           {"getprotobynumber", 1},
-                           {"getprotoent",      1},
-                           {"getpwent",         1},
-                           {"getpwnam",         1},
-                           {"getpwuid",         1},
-                           {"getservbyname",    1},
-                           {"getservbyport",    1},
-                           {"getservent",       1},
-                           {"getsockname",      1},
-                           {"getsockopt",       1},
-                           {"given",            1},
-                           {"glob",             1},
-                           {"gmtime",           1},
-                           {"goto",             1},
-                           {"grep",             1},
-                           {"gt",               1},
-                           {"hex",              1},
-                           {"INIT",             1},
-                           {"if",               1},
-                           {"import",           1},
-                           {"index",            1},
-                           {"int",              1},
-                           {"ioctl",            1},
-                           {"join",             1},
-                           {"keys",             1},
-                           {"kill",             1},
-                           {"last",             1},
-                           {"lc",               1},
-                           {"lcfirst",          1},
-                           {"le",               1},
-                           {"length",           1},
-                           {"link",             1},
-                           {"listen",           1},
-                           {"local",            1},
-                           {"localtime",        1},
-                           {"lock",             1},
-                           {"log",              1},
-                           {"lstat",            1},
-                           {"lt",               1},
-                           {"m",                1},
-                           {"map",              1},
-                           {"mkdir",            1},
-                           {"msgctl",           1},
-                           {"msgget",           1},
-                           {"msgrcv",           1},
-                           {"msgsnd",           1},
-                           {"my",               1},
-                           {"ne",               1},
-                           {"next",             1},
-                           {"no",               1},
-                           {"not",              1},
-                           {"oct",              1},
-                           {"open",             1},
-                           {"opendir",          1},
-                           {"or",               1},
-                           {"ord",              1},
-                           {"our",              1},
-                           {"pack",             1},
-                           {"package",          1},
-                           {"pipe",             1},
-                           {"pop",              1},
-                           {"pos",              1},
-                           {"print",            1},
-                           {"printf",           1},
-                           {"prototype",        1},
-                           {"push",             1},
-                           {"q",                1},
-                           {"qq",               1},
-                           {"qr",               1},
-                           {"quotemeta",        1},
-                           {"qw",               1},
-                           {"qx",               1},
-                           {"rand",             1},
-                           {"read",             1},
-                           {"readdir",          1},
-                           {"readline",         1},
-                           {"readlink",         1},
-                           {"readpipe",         1},
-                           {"recv",             1},
-                           {"redo",             1},
-                           {"ref",              1},
-                           {"rename",           1},
-                           {"require",          1},
-                           {"reset",            1},
-                           {"return",           1},
-                           {"reverse",          1},
-                           {"rewinddir",        1},
-                           {"rindex",           1},
-                           {"rmdir",            1},
-                           {"s",                1},
-                           {"say",              1},
-                           {"scalar",           1},
-                           {"seek",             1},
-                           {"seekdir",          1},
-                           {"select",           1},
-                           {"semctl",           1},
-                           {"semget",           1},
-                           {"semop",            1},
-                           {"send",             1},
-                           {"setgrent",         1},
-                           {"sethostent",       1},
-                           {"setnetent",        1},
-                           {"setpgrp",          1},
-                           {"setpriority",      1},
-                           {"setprotoent",      1},
-                           {"setpwent",         1},
-                           {"setservent",       1},
-                           {"setsockopt",       1},
-                           {"shift",            1},
-                           {"shmctl",           1},
-                           {"shmget",           1},
-                           {"shmread",          1},
-                           {"shmwrite",         1},
-                           {"shutdown",         1},
-                           {"sin",              1},
-                           {"sleep",            1},
-                           {"socket",           1},
-                           {"socketpair",       1},
-                           {"sort",             1},
-                           {"splice",           1},
-                           {"split",            1},
-                           {"sprintf",          1},
-                           {"sqrt",             1},
-                           {"srand",            1},
-                           {"stat",             1},
-                           {"state",            1},
-                           {"study",            1},
-                           {"sub",              1},
-                           {"substr",           1},
-                           {"symlink",          1},
-                           {"syscall",          1},
-                           {"sysopen",          1},
-                           {"sysread",          1},
-                           {"sysseek",          1},
-                           {"system",           1},
-                           {"syswrite",         1},
-                           {"tell",             1},
-                           {"telldir",          1},
-                           {"tie",              1},
-                           {"tied",             1},
-                           {"time",             1},
-                           {"times",            1},
-                           {"tr",               1},
-                           {"truncate",         1},
-                           {"UNITCHECK",        1},
-                           {"uc",               1},
-                           {"ucfirst",          1},
-                           {"umask",            1},
-                           {"undef",            1},
-                           {"unless",           1},
-                           {"unlink",           1},
-                           {"unpack",           1},
-                           {"unshift",          1},
-                           {"untie",            1},
-                           {"until",            1},
-                           {"use",              1},
-                           {"utime",            1},
-                           {"values",           1},
-                           {"vec",              1},
-                           {"wait",             1},
-                           {"waitpid",          1},
-                           {"wantarray",        1},
-                           {"warn",             1},
-                           {"when",             1},
-                           {"while",            1},
-                           {"write",            1},
-                           {"-X",               1},
-                           {"x",                1},
-                           {"xor",              1}};
-
-    // Remove any unicode Byte Order Mark (e.g. 0xEFBBBF)
-    if (this->program.size() >= 3 && this->program[0] == '\xEF' && this->program[1] == '\xBB' &&
-        this->program[2] == '\xBF') {
-        this->program = this->program.substr(3, this->program.size() - 3);
-    } else if (this->program.size() >= 2 && this->program[0] == '\xFF' && this->program[1] == '\xFE') {
-        this->program = this->program.substr(2, this->program.size() - 3);
-    } else if (this->program.size() >= 2 && this->program[0] == '\xFE' && this->program[1] == '\xFF') {
-        this->program = this->program.substr(2, this->program.size() - 3);
-    } else if (this->program.size() >= 4 && this->program[0] == '\xFF' && this->program[1] == '\xFE' &&
-               this->program[2] == '\x00' && this->program[3] == '\x00') {
-        this->program = this->program.substr(4, this->program.size() - 3);
-    } else if (this->program.size() >= 4 && this->program[0] == '\x00' && this->program[1] == '\x00' &&
-               this->program[2] == '\xFE' && this->program[3] == '\xFF') {
-        this->program = this->program.substr(4, this->program.size() - 3);
-    }
-
-}
-
-int Tokeniser::nextLine() {
-    this->currentLine += 1;
-    this->currentCol = 1;
-    return this->currentLine;
-}
-
-void Tokeniser::advancePositionSameLine(int i) {
+void Tokeniser::advancePosition(int i) {
     this->_position += i;
-    this->currentCol += i;
+}
+
+/**
+ * Advance up to (but not including) the next character in stopChars. stopChars must contain '\n' and '\r' so that
+ * newlines are still matched as tokens.
+ */
+void Tokeniser::skipUntil(const scan::StopChars &stopChars) {
+    int next = scan::findFirstOf(this->program, this->_position + 1, stopChars);
+    if (next > this->furthestRead) this->furthestRead = next;
+    this->advancePosition(next - (this->_position + 1));
 }
 
 /**
  * Gets and consumes next character from input
- * Also updates file position, line and column information
  * @return
  */
 char Tokeniser::nextChar() {
-    if (this->_position == this->program.length() - 1) {
-        return EOF;
-    }
-
-    if ((this->peek() == '\r' && this->peekAhead(2) == '\n') ||
-        (this->peek() == '\n' && this->peekAhead(0) != '\r')) {
-        // Newline coming up, other code will handle token
-        this->nextLine();
-    } else {
-        this->currentCol += 1;
-    }
+    if (this->_position + 1 > this->furthestRead) this->furthestRead = this->_position + 1;
+    if (this->_position == this->program.length() - 1) return EOF;
 
     this->_position += 1;
     return this->program[this->_position];
@@ -343,6 +81,7 @@ char Tokeniser::nextChar() {
  * @return
  */
 char Tokeniser::peekAhead(int i) {
+    if (this->_position + i > this->furthestRead) this->furthestRead = this->_position + i;
     if (this->_position + i > this->program.length() - 1) {
         return EOF;
     }
@@ -351,8 +90,6 @@ char Tokeniser::peekAhead(int i) {
 }
 
 void Tokeniser::backtrack(FilePos pos) {
-    this->currentLine = pos.line;
-    this->currentCol = pos.col;
     this->_position = pos.position - 1;
 }
 
@@ -373,16 +110,17 @@ char Tokeniser::peek() {
 }
 
 bool Tokeniser::isEof() {
+    if (this->_position + 1 > this->furthestRead) this->furthestRead = this->_position + 1;
     return this->_position > (int) this->program.length() - 1;
 }
 
-std::string Tokeniser::getWhile(const std::function<bool(char)> &nextCharTest) {
-    std::string acc;
-    while (nextCharTest(this->peek()) && !this->isEof()) {
-        acc += this->nextChar();
-    }
+std::string_view Tokeniser::sliceFrom(const FilePos &start) {
+    int from = start.position - this->positionOffset;
+    return this->program.substr(from, this->_position + 1 - from);
+}
 
-    return acc;
+std::shared_ptr<SourceBuffer> Tokeniser::getSource() {
+    return this->source;
 }
 
 bool Tokeniser::isWhitespace(char c) {
@@ -406,31 +144,7 @@ bool Tokeniser::isNameBody(char c) {
            c != ')' && c != '[' && c != ']' && c != ':' && c != '=' && c != '"' && c != '/';
 }
 
-/**
- * Given a list of possible strings, will try to match that string and consume the input
- * @param options
- * @param requireTrailingNonAN - Require a non alpha numeric character to follow the string
- * @return
- */
-std::string Tokeniser::matchStringOption(const std::vector<std::string> &options, bool requireTrailingNonAN) {
-    for (const std::string &option : options) {
-        bool match = true;  // Assume match until proven otherwise
-        for (int i = 0; i < (int) option.length(); i++) {
-            match = match && (this->peekAhead(i + 1) == option[i]);
-        }
-
-        // If requireTrailingNonAN check next char is not alphanumeric
-        // This fixes issues with `sub length() {...}` being translated to NAME(SUB) OP(LE) NAME(GTH) ...
-        if (match && (!requireTrailingNonAN || !isalnum(this->peekAhead((int) option.length() + 1)))) {
-            this->advancePositionSameLine(option.length());
-            return option;
-        }
-    }
-
-    return "";
-}
-
-bool Tokeniser::matchKeyword(const std::string &keyword) {
+bool Tokeniser::matchKeyword(std::string_view keyword) {
     for (int i = 0; i < (int) keyword.size(); i++) {
         if (this->peekAhead(i + 1) != keyword[i]) {
             return false;
@@ -443,18 +157,17 @@ bool Tokeniser::matchKeyword(const std::string &keyword) {
     if (isalnum(nextChar)) return false;
 
     // We have the keyword
-    this->advancePositionSameLine(keyword.size());
+    this->advancePosition(keyword.size());
     return true;
 }
 
-std::string Tokeniser::matchName() {
-    std::string acc;
+std::string_view Tokeniser::matchName() {
+    auto start = currentPos();
     while (this->isNameBody(this->peek())) {
-        acc += this->peek();
         this->nextChar();
     }
 
-    return acc;
+    return sliceFrom(start);
 }
 
 /**
@@ -462,14 +175,13 @@ std::string Tokeniser::matchName() {
  * @param letters
  * @return
  */
-std::string Tokeniser::matchStringContainingOnlyLetters(const std::string &letters) {
-    std::string str;
-    while (letters.find(peek()) != std::string::npos) {
-        str += peek();
+std::string_view Tokeniser::matchStringContainingOnlyLetters(std::string_view letters) {
+    auto start = currentPos();
+    while (letters.find(peek()) != std::string_view::npos) {
         nextChar();
     }
 
-    return str;
+    return sliceFrom(start);
 }
 
 /**
@@ -486,6 +198,37 @@ bool Tokeniser::matchSimpleString(std::vector<Token> &tokens) {
     return false;
 }
 
+/**
+ * String contents keep escapes as they are written in the code, apart from an escaped backslash (`\\`) which is
+ * collapsed into a single backslash. Escaped delimiters are left alone.
+ * @param raw String contents as they appear in the program
+ * @param delim Delimiter (or opening bracket)
+ * @param endDelim Closing delimiter, same as delim for non bracketed strings
+ * @return
+ */
+static std::string collapseEscapedBackslashes(std::string_view raw, char delim, char endDelim) {
+    std::string contents;
+    contents.reserve(raw.size());
+    for (int i = 0; i < (int) raw.size(); i++) {
+        if (raw[i] == '\\' && i + 1 < (int) raw.size()) {
+            if (raw[i + 1] == delim || raw[i + 1] == endDelim) {
+                contents += raw[i];
+                contents += raw[i + 1];
+                i++;
+                continue;
+            } else if (raw[i + 1] == '\\') {
+                contents += '\\';
+                i++;
+                continue;
+            }
+        }
+
+        contents += raw[i];
+    }
+
+    return contents;
+}
+
 /**
  * Match a string deliminated by any character. e.g. qq HWorld!H uses deliminator of 'H'
  * IMPORTANT does not support bracket deliminators with matching, use matchBracketedStringLiteral for that
@@ -497,42 +240,45 @@ bool Tokeniser::matchSimpleString(std::vector<Token> &tokens) {
  *                     ending deliminator. The delims will not be included in the returned string: world
  * @return
  */
-std::string Tokeniser::matchStringLiteral(char delim, bool includeDelim) {
-    std::string contents;
-    if (this->peek() == delim || !includeDelim) {
-        if (includeDelim) this->nextChar();
-        while (this->peek() != EOF) {
-            if (this->peek() == '\\') {
-                if (this->peekAhead(2) == delim) {
-                    // Escaped deliminator (e.g. \")
-                    contents += '\\';
-                    contents += delim;
-                    this->nextChar();
-                    this->nextChar();
-                    continue;
-                } else if (this->peekAhead(2) == '\\') {
-                    // Escaped backslash (i.e. \\)
-                    contents += '\\';
-                    this->nextChar();
-                    this->nextChar();
-                    continue;
-                }
-            } else if (this->peek() == delim) {
-                // Deliminator without escape => Done
-                break;
-            }
-            contents += this->peek();
-            this->nextChar();
-            if (this->peek() == EOF) break;
-        }
+std::string_view Tokeniser::matchStringLiteral(char delim, bool includeDelim) {
+    if (this->peek() != delim && includeDelim) return {};
 
-        if (includeDelim) {
-            this->nextChar();
-            contents = delim + contents + delim;
+    auto start = currentPos();
+    if (includeDelim) this->nextChar();
+    auto contentsStart = currentPos();
+    bool hasEscapedBackslash = false;
+    scan::StopChars stopChars{delim, '\\', '\n', '\r', (char) EOF};
+    while (this->peek() != EOF) {
+        this->skipUntil(stopChars);
+        if (this->peek() == EOF) break;
+
+        if (this->peek() == '\\') {
+            if (this->peekAhead(2) == delim) {
+                // Escaped deliminator (e.g. \")
+                this->nextChar();
+                this->nextChar();
+                continue;
+            } else if (this->peekAhead(2) == '\\') {
+                // Escaped backslash (i.e. \\)
+                hasEscapedBackslash = true;
+                this->nextChar();
+                this->nextChar();
+                continue;
+            }
+        } else if (this->peek() == delim) {
+            // Deliminator without escape => Done
+            break;
         }
+        this->nextChar();
+        if (this->peek() == EOF) break;
     }
 
-    return contents;
+    auto contents = sliceFrom(contentsStart);
+    if (includeDelim) this->nextChar();
+    if (!hasEscapedBackslash) return includeDelim ? sliceFrom(start) : contents;
+
+    auto collapsed = collapseEscapedBackslashes(contents, delim, delim);
+    return this->source->own(includeDelim ? delim + collapsed + delim : collapsed);
 }
 
 /**
@@ -543,35 +289,31 @@ std::string Tokeniser::matchStringLiteral(char delim, bool includeDelim) {
  * @param bracket The starting bracket.
  * @return
  */
-std::string Tokeniser::matchBracketedStringLiteral(char bracket) {
-    std::string contents;
+std::string_view Tokeniser::matchBracketedStringLiteral(char bracket) {
     char endBracket;
     if (bracket == '(') endBracket = ')';
     else if (bracket == '[') endBracket = ']';
     else if (bracket == '{') endBracket = '}';
     else if (bracket == '<') endBracket = '>';
-    else return contents;
+    else return {};
 
+    auto start = currentPos();
+    bool hasEscapedBackslash = false;
     int bracketCount = 1;
+    scan::StopChars stopChars{bracket, endBracket, '\\', '\n', '\r', (char) EOF};
     while (bracketCount > 0 && peek() != EOF) {
+        this->skipUntil(stopChars);
+        if (this->peek() == EOF) break;
 
         if (this->peek() == '\\') {
-            if (this->peekAhead(2) == bracket) {
-                contents += '\\';
-                contents += bracket;
-                this->nextChar();
-                this->nextChar();
-                continue;
-            } else if (this->peekAhead(2) == endBracket) {
-                // Escaped end bracket (e.g. `\}`)
-                contents += '\\';
-                contents += endBracket;
+            if (this->peekAhead(2) == bracket || this->peekAhead(2) == endBracket) {
+                // Escaped bracket (e.g. `\}`)
                 this->nextChar();
                 this->nextChar();
                 continue;
             } else if (this->peekAhead(2) == '\\') {
                 // Escaped backslash (i.e. \\)
-                contents += '\\';
+                hasEscapedBackslash = true;
                 this->nextChar();
                 this->nextChar();
                 continue;
@@ -582,12 +324,13 @@ std::string Tokeniser::matchBracketedStringLiteral(char bracket) {
             bracketCount++;
         }
 
-        if (bracketCount == 0) return contents;
-        contents += peek();
+        if (bracketCount == 0) break;
         nextChar();
     }
 
-    return contents;
+    auto contents = sliceFrom(start);
+    if (!hasEscapedBackslash) return contents;
+    return this->source->own(collapseEscapedBackslashes(contents, bracket, endBracket));
 }
 
 /**
@@ -599,43 +342,40 @@ void Tokeniser::matchDelimString(std::vector<Token> &tokens) {
     char quoteChar = this->peek();
     auto start = currentPos();
     this->nextChar();
-    std::string contents;
+    std::string_view contents;
     if (quoteChar == '{' || quoteChar == '(' || quoteChar == '<' || quoteChar == '[') {
-        tokens.emplace_back(Token(TokenType::StringStart, start, std::string(1, quoteChar)));
+        tokens.emplace_back(Token(TokenType::StringStart, start, sliceFrom(start)));
         start = currentPos();
         contents = matchBracketedStringLiteral(quoteChar);
 
         if (!contents.empty()) {
             auto endPos = currentPos();
             endPos.position -= 1;
-            endPos.col = endPos.col == 0 ? 0 : endPos.col - 1;   // FIXME
             tokens.emplace_back(Token(TokenType::String, start, endPos, contents));
         }
 
         start = currentPos();
-        auto endChar = peek();
         nextChar();
-        tokens.emplace_back(Token(TokenType::StringEnd, start, std::string(1, endChar)));
+        tokens.emplace_back(Token(TokenType::StringEnd, start, sliceFrom(start)));
     } else {
-        tokens.emplace_back(Token(TokenType::StringStart, start, std::string(1, quoteChar)));
+        tokens.emplace_back(Token(TokenType::StringStart, start, sliceFrom(start)));
         start = currentPos();
         contents = matchStringLiteral(quoteChar, false);
 
         if (!contents.empty()) {
             auto endPos = currentPos();
             endPos.position -= 1;
-            endPos.col = endPos.col == 0 ? 0 : endPos.col - 1;   // FIXME
             tokens.emplace_back(Token(TokenType::String, start, endPos, contents));
         }
 
         start = currentPos();
-        auto endChar = peek();
         nextChar();
-        tokens.emplace_back(Token(TokenType::StringEnd, start, std::string(1, endChar)));
+        tokens.emplace_back(Token(TokenType::StringEnd, start, sliceFrom(start)));
     }
 }
 
-std::string Tokeniser::matchQuoteOperator() {
+std::string_view Tokeniser::matchQuoteOperator() {
+    auto start = currentPos();
     auto p1 = peek();
     auto p2 = peekAhead(2);
 
@@ -643,20 +383,16 @@ std::string Tokeniser::matchQuoteOperator() {
         (p1 == 'q' && p2 == 'r')) {
         this->nextChar();
         this->nextChar();
-        return std::string(1, p1) + p2;
     } else if (p1 == 'q' || p1 == 'm') {
         this->nextChar();
-        return std::string(1, p1);
     } else if (p1 == 's' || p1 == 'y') {
         this->nextChar();
-        return std::string(1, p1);
     } else if (p1 == 't' && p2 == 'r') {
         this->nextChar();
         this->nextChar();
-        return "tr";
-    } else {
-        return "";
     }
+
+    return sliceFrom(start);
 }
 
 
@@ -667,8 +403,9 @@ std::string Tokeniser::matchQuoteOperator() {
  */
 bool Tokeniser::matchQuoteLiteral(std::vector<Token> &tokens) {
     int tokensSize = tokens.size(); // So we can backtrack to this
+    int lineStart = this->lineStart;
     auto startPos = currentPos();
-    std::string quoteOperator = matchQuoteOperator();
+    auto quoteOperator = matchQuoteOperator();
     if (quoteOperator.empty()) return false;
 
     bool isMultipleLiteral = quoteOperator == "s" || quoteOperator == "y" || quoteOperator == "tr";
@@ -683,6 +420,7 @@ bool Tokeniser::matchQuoteLiteral(std::vector<Token> &tokens) {
             // Must have whitespace for alphanumeric quote char
             backtrack(startPos);
             tokens.erase(tokens.begin() + tokensSize, tokens.end());
+            this->lineStart = lineStart;
             return false;
         }
     }
@@ -693,6 +431,7 @@ bool Tokeniser::matchQuoteLiteral(std::vector<Token> &tokens) {
         // `qq #Hello# -> 'qq' followed by comment`
         backtrack(startPos);
         tokens.erase(tokens.begin() + tokensSize, tokens.end());
+        this->lineStart = lineStart;
         return false;
     }
 
@@ -714,19 +453,19 @@ bool Tokeniser::matchQuoteLiteral(std::vector<Token> &tokens) {
         } else {
             // Match more string then followed by ending string
             start = currentPos();
-            std::string contents = matchStringLiteral(quoteChar, false);
+            auto contents = matchStringLiteral(quoteChar, false);
             if (!contents.empty()) {
                 auto endPos = currentPos();
                 endPos.position -= 1;
-                endPos.col = endPos.col == 0 ? 0 : endPos.col - 1;   // FIXME
                 tokens.emplace_back(Token(TokenType::String, start, endPos, contents));
             }
-            tokens.emplace_back(Token(TokenType::StringEnd, currentPos(), std::string(1, quoteChar)));
+            start = currentPos();
             nextChar();
+            tokens.emplace_back(Token(TokenType::StringEnd, start, sliceFrom(start)));
         }
     }
     // Finally to match ending part of string for certain types
-    std::string modifiers;
+    std::string_view modifiers;
     start = currentPos();
     if (quoteOperator == "s") {
         modifiers = matchStringContainingOnlyLetters("msixpodualngcer");
@@ -749,26 +488,23 @@ bool Tokeniser::matchQuoteLiteral(std::vector<Token> &tokens) {
  * Simple numeric matching. Should be comprehensive for literals, uses regex after quick heuristic
  * @return
  */
-std::string Tokeniser::matchNumeric() {
-    std::string testString;
+std::string_view Tokeniser::matchNumeric() {
     int i = 0;
     while (isalnum(peekAhead(i + 1)) || peekAhead(i + 1) == '.' || peekAhead(i + 1) == '+' ||
            peekAhead(i + 1) == '-' || peekAhead(i + 1) == '_') {
-        testString += peekAhead(i + 1);
         i += 1;
     }
-    if (testString.empty()) return "";
-    // Do quick check before we use expensive regex
-    if (!isdigit(testString[0]) && testString[0] != '+' && testString[0] != '-') return "";
-
-    std::smatch regexMatch;
+    if (i == 0) return {};
+    auto testString = this->program.substr(this->_position + 1, i);
+    // Quick check before running the full scanner
+    if (!isdigit(testString[0]) && testString[0] != '+' && testString[0] != '-') return {};
 
-    if (std::regex_match(testString, regexMatch, NUMERIC_REGEX)) {
-        this->advancePositionSameLine(testString.size());
+    if (isNumericLiteral(testString)) {
+        this->advancePosition(testString.size());
         return testString;
     }
 
-    return "";
+    return {};
 }
 
 /**
@@ -782,75 +518,72 @@ std::string Tokeniser::matchNumeric() {
  * but I am yet to find it.
  * @return Version literal or empty string
  */
-std::string Tokeniser::matchVersionString() {
-    if (peek() != 'v' && !isdigit(peek())) return "";
-    std::string versionString;
+std::string_view Tokeniser::matchVersionString() {
+    if (peek() != 'v' && !isdigit(peek())) return {};
     int i = 0;
     if (peek() == 'v') {
-        versionString += 'v';
         i++;
     }
 
     while (isdigit(peekAhead(i + 1)) || peekAhead(i + 1) == '.' || peekAhead(i + 1) == '_') {
-        versionString += peekAhead(i + 1);
         i += 1;
     }
 
-    std::smatch regexMatch;
-
-    if (std::regex_match(versionString, regexMatch, VERSION_REGEX)) {
-        this->advancePositionSameLine(versionString.size());
+    auto versionString = this->program.substr(this->_position + 1, i);
+    if (isVersionString(versionString)) {
+        this->advancePosition(versionString.size());
         return versionString;
     }
 
-    return "";
+    return {};
 }
 
-std::string Tokeniser::matchComment() {
-    std::string comment;
+std::string_view Tokeniser::matchComment() {
+    auto start = currentPos();
     if (this->peek() == '#') {
-        comment += this->nextChar();
-        while (this->peek() != '\n' && this->peek() != '\r' && this->peek() != EOF) {
-            comment += this->nextChar();
-        }
+        this->nextChar();
+        this->skipUntil(LINE_END_CHARS);
     }
 
-    return comment;
+    return sliceFrom(start);
 }
 
-std::string Tokeniser::matchPod() {
+std::string_view Tokeniser::matchPod() {
     char prevChar = this->prevChar(0);
-    std::string pod;
+    auto start = currentPos();
     if (prevChar == 0 || prevChar == '\n' || prevChar == '\r') {
         // Valid place to put a pod, now check if there is one
         if (this->peek() == '=' && !isWhitespace(this->peekAhead(2))) {
             // Yes
-            pod += this->nextChar();
+            this->nextChar();
 
             // Consume until end of line (we can't start and end POD on same line)
-            pod += this->getWhile(isNewline);
+            this->getWhile(isNewline);
 
             // Now consume until ending
             while (this->peek() != EOF) {
+                // Only a newline can start the =cut
+                this->skipUntil(LINE_END_CHARS);
+                if (this->peek() == EOF) break;
+
                 char c0 = this->peek();
                 char c1 = this->peekAhead(2);
                 char c2 = this->peekAhead(3);
                 char c3 = this->peekAhead(4);
                 char c4 = this->peekAhead(5);
-                pod += this->nextChar();
+                this->nextChar();
                 if (c0 == '\n' && c1 == '=' && c2 == 'c' && c3 == 'u' && c4 == 't') {
                     this->nextChar();
                     this->nextChar();
                     this->nextChar();
                     this->nextChar();
-                    pod += "cut";
                     break;
                 }
             }
         }
     }
 
-    return pod;
+    return sliceFrom(start);
 }
 
 
@@ -870,7 +603,7 @@ int Tokeniser::peekPackageTokens(int i) {
 }
 
 // Too complicated to use regex (could do it but regex would be horrible to write and debug)
-std::string Tokeniser::matchVariable() {
+std::string_view Tokeniser::matchVariable() {
     int i = 1;
     // Must start with sigil
     if (peekAhead(i) != '$' && peekAhead(i) != '@' && peekAhead(i) != '%') return "";
@@ -952,113 +685,143 @@ std::string Tokeniser::matchVariable() {
     // If nothing after sigil matched, then don't match as a variable
     if (i == 2) return "";
 
-    std::string var = this->program.substr(this->_position + 1, i - 1);
-    this->advancePositionSameLine(i - 1);
+    auto var = this->program.substr(this->_position + 1, i - 1);
+    this->advancePosition(i - 1);
     return var;
 }
 
 // This is defined https://perldoc.perl.org/perldata.html#Identifier-parsing
 // TODO can normal regex be faster?
-std::string Tokeniser::matchBasicIdentifier(int &i) {
+bool Tokeniser::matchBasicIdentifier(int &i) {
     // First char can't be a number
-    if (isdigit(this->peekAhead(i))) return "";
+    if (isdigit(this->peekAhead(i))) return false;
     // Now we can just match alpha numerics
-    std::string contents;
-    while (isNameBody(this->peekAhead(i))) contents += this->peekAhead(i++);
-    return contents;
+    int start = i;
+    while (isNameBody(this->peekAhead(i))) i++;
+    return i != start;
 }
 
 // https://perldoc.perl.org/perldata.html#Identifier-parsing
 // Matches identifiers with packages
 // No sigil though (so not a variable/glob)
-std::string Tokeniser::doMatchNormalIdentifier(int &i) {
-    std::string contents;
+// Everything matched is contiguous, so this only advances i and the caller slices the identifier out of the program
+void Tokeniser::doMatchNormalIdentifier(int &i) {
     // (?: :: )* '?
     while (peekAhead(i) == ':') {
         // Only match colons in groups of 2
-        if (peekAhead(i + 1) != ':') return contents;
-        contents += "::";
+        if (peekAhead(i + 1) != ':') return;
         i += 2;
     }
 
     if (peekAhead(i) == '\'') {
-        contents += '\'';
         i++;
     }
 
     // (?&basic_identifier)
-    auto basic = matchBasicIdentifier(i);
-    if (basic.empty()) {
-        return contents;
+    if (!matchBasicIdentifier(i)) {
+        return;
     }
 
-    contents += basic;
-
     while (peekAhead(i) == ':') {
         if (peekAhead(i + 1) != ':') {
-            return contents;
+            return;
         }
-        contents += "::";
         i += 2;
     }
 
     if (peekAhead(i) == '\'') {
-        contents += '\'';
         i++;
     }
 
-    auto normalRecurse = doMatchNormalIdentifier(i);
-    contents += normalRecurse;
+    doMatchNormalIdentifier(i);
     while (peekAhead(i) == ':') {
         if (peekAhead(i + 1) != ':') {
-            return contents;
+            return;
         }
-        contents += "::";
         i += 2;
     }
-
-    return contents;
 }
 
-std::string Tokeniser::matchIdentifier() {
+std::string_view Tokeniser::matchIdentifier() {
     int i = 1;
-    auto ident = doMatchNormalIdentifier(i);
-    this->advancePositionSameLine(i - 1);
+    doMatchNormalIdentifier(i);
+    auto ident = this->program.substr(this->_position + 1, i - 1);
+    this->advancePosition(i - 1);
     return ident;
 }
 
 std::optional<Token> Tokeniser::tryMatchKeywords(FilePos startPos) {
-    std::string possibleKeyword = "";
     int i = 1;
     while (isalpha(this->peekAhead(i))) {
-        possibleKeyword += this->peekAhead(i);
         i++;
     }
+    auto possibleKeyword = this->program.substr(this->_position + 1, i - 1);
 
     // Keyword must be followed by non a-zA-Z0-9 character
     if (possibleKeyword.empty() || isalnum(peekAhead(i))) {
         return std::optional<Token>();
     }
 
-    if (this->keywordMap.count(possibleKeyword) == 0) {
+    auto keyword = lexicon::KEYWORDS.find(possibleKeyword);
+    if (keyword == nullptr) {
         return std::optional<Token>();
     }
 
-    this->advancePositionSameLine(possibleKeyword.size());
-    return Token(this->keywordMap[possibleKeyword], startPos, startPos.col + (int) possibleKeyword.size() - 1);
+    this->advancePosition(possibleKeyword.size());
+    return Token(*keyword, startPos, FilePos(startPos.position + (int) possibleKeyword.size() - 1));
 }
 
-std::string Tokeniser::matchWhitespace() {
+std::string_view Tokeniser::matchWhitespace() {
     return this->getWhile(this->isWhitespace);
 }
 
-void Tokeniser::matchHereDocBody(std::vector<Token> &tokens, const std::string &hereDocDelim, bool hasTilde) {
+/**
+ * If the << operator at tokens[start] is followed by a heredoc delimiter, match the heredoc body
+ * @param lineEnd Index of the newline ending the line the heredoc started on
+ * @return true if a heredoc was matched
+ */
+bool Tokeniser::matchHereDoc(std::vector<Token> &tokens, int start, int lineEnd) {
+    int i = start;
+    bool hasWhitespace = i + 1 < tokens.size() && tokens[i + 1].type == TokenType::Whitespace;
+    if (hasWhitespace) i++;
+
+    bool hasTilde = i + 1 < tokens.size() && tokens[i + 1].type == TokenType::Operator && tokens[i + 1].data == "~";
+    if (hasTilde) i++;
+
+    // Here doc deliminator must be a string or a bareword, before the newline
+    i++;
+    if (i >= lineEnd) return false;
+    std::string_view delim;
+    if (tokens[i].type == TokenType::Name) {
+        if (hasWhitespace) return false;    // Whitespace not allowed with barewords
+        delim = tokens[i].data;
+    } else if (tokens[i].type == TokenType::StringStart) {
+        // Strings have the format StringStart(..) String(..) StringEnd(..)
+        // But empty strings don't include a String(..)
+        if (tokens[i + 1].type == TokenType::String) {
+            delim = tokens[i + 1].data;
+        } else if (tokens[i + 1].type != TokenType::StringEnd) {
+            // Something has gone wrong, don't parse as heredoc
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    matchHereDocBody(tokens, delim, hasTilde);
+    return true;
+}
+
+void Tokeniser::matchHereDocBody(std::vector<Token> &tokens, std::string_view hereDocDelim, bool hasTilde) {
     auto start = currentPos();
     FilePos bodyEnd = currentPos();
     FilePos lineStart;
-    std::string hereDocContents;
-    std::string line;
+    bool hasContents = false;
+    int contentsIndex = this->_position + 1;
+    int lineIndex = contentsIndex;
+    std::string_view line;
     while (this->peek() != EOF) {
+        line = this->program.substr(lineIndex, this->_position + 1 - lineIndex);
         if (this->peek() == '\n' || this->peek() == '\r') {
             if (line == hereDocDelim) {
                 break;
@@ -1074,28 +837,25 @@ void Tokeniser::matchHereDocBody(std::vector<Token> &tokens, const std::string &
 
             bodyEnd = currentPos();
             if (this->peek() == '\n') {
-                line += '\n';
                 this->nextChar();
             } else if (this->peek() == '\r' && this->peek() == '\n') {
-                line += "\r\n";
                 this->nextChar();
                 this->nextChar();
             } else if (this->peek() == '\r') {
-                line += '\r';
                 this->nextChar();
             }
-            hereDocContents += line;
-            line = "";
+            hasContents = true;
+            lineIndex = this->_position + 1;
             lineStart = currentPos();
         } else {
-            line += this->peek();
-            this->nextChar();
+            this->skipUntil(LINE_END_CHARS);
         }
     }
+    line = this->program.substr(lineIndex, this->_position + 1 - lineIndex);
 
     done:
     // Finally add our heredoc token
-    if (!hereDocContents.empty()) tokens.emplace_back(Token(TokenType::HereDoc, start, bodyEnd, hereDocContents));
+    if (hasContents) tokens.emplace_back(Token(TokenType::HereDoc, start, bodyEnd, this->program.substr(contentsIndex, lineIndex - contentsIndex)));
     tokens.emplace_back(Token(TokenType::HereDocEnd, lineStart, line));
 }
 
@@ -1161,16 +921,19 @@ bool Tokeniser::matchNewline(std::vector<Token> &tokens) {
         // Linux/mac newline
         this->nextChar();
         tokens.emplace_back(Token(TokenType::Newline, start, "\n"));
+        this->lineStart = tokens.size();
         return true;
     } else if (this->peek() == '\r' && this->peekAhead(2) == '\n') {
         // windows
         this->nextChar();
         this->nextChar();
         tokens.emplace_back(Token(TokenType::Newline, start, "\r\n"));
+        this->lineStart = tokens.size();
         return true;
     } else if (this->peek() == '\r') {
         this->nextChar();
         tokens.emplace_back(Token(TokenType::Newline, start, "\r"));
+        this->lineStart = tokens.size();
         return true;
     }
 
@@ -1228,6 +991,24 @@ void Tokeniser::matchDereferenceBrackets(std::vector<Token> &tokens) {
     }
 }
 
+// Markers that end the program (anything after is data)
+static constexpr std::string_view END_MARKERS[]{"__DATA__", "__END__"};
+
+// Perl has so many operators...
+// Thankfully we don't actually care what the do, just need to recognise them
+static constexpr std::string_view OPERATORS[]{
+        "+=", "++", "+", "--", "-=", "**=", "*=", "**", "*", "!=", "!~", "!", "~", "\\", "==", "=~",
+        "//=", "=>", "//", "%=", "%", "x=", "x", ">>=", ">>", ">", ">=", "<=>", "<<=", "<<", "<",
+        ">=",
+        "~~", "&=", "&.=", "&&=", "&&", "&", "||=", "|.=", "|=", "||",
+        "~", "^=", "^.=", "^", "...", "..", "?:", ":", ".=", "?"
+};
+
+// These operators must be followed by a non alphanumeric
+static constexpr std::string_view WORD_OPERATORS[]{
+        "lt", "gt", "le", "ge", "eq", "ne", "cmp", "and", "or", "not", "xor"
+};
+
 /**
  * Next run of the tokeniser. Produces only as many new tokens as needed to progress input
  *
@@ -1247,65 +1028,31 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
     }
 
     // Search for __DATA__ and end program if reached
-    if (!this->matchStringOption(std::vector<std::string>{"__DATA__", "__END__"}, true).empty()) {
+    if (!this->matchStringOption(END_MARKERS, true).empty()) {
         tokens.emplace_back(Token(TokenType::EndOfInput, startPos, startPos));
         return;
     }
 
     // Devour any whitespace
-    std::string whitespace = matchWhitespace();
+    auto whitespace = matchWhitespace();
     if (whitespace.length() > 0) {
         tokens.emplace_back(Token(TokenType::Whitespace, startPos, whitespace));
         return;
     }
 
     // Now for newlines
+    int lineStart = this->lineStart;
     if (matchNewline(tokens)) {
-        // Check this line for a possible heredoc starter
-        for (int idx = tokens.size() - 2; idx >= 0; idx--) {
-            int i = idx;
-            if (tokens[i].type == TokenType::Newline) break;
-            if (tokens[i].type == TokenType::Operator && tokens[i].data == "<<") {
-                // got a <<, see if it could be a heredoc
-                bool hasWhitespace = i + 1 < tokens.size() && tokens[i + 1].type == TokenType::Whitespace;
-                if (hasWhitespace) i++;
-
-                bool hasTilde =
-                        i + 1 < tokens.size() && tokens[i + 1].type == TokenType::Operator &&
-                        tokens[i + 1].data == "~";
-                if (hasTilde) i++;
-
-                // Now consider if we have ok identifier
-                i++;
-                if (i >= tokens.size() - 1) continue;
-                // Here doc deliminator must be a string or a bareword
-                if (tokens[i].type != TokenType::Name && tokens[i].type != TokenType::StringStart) {
-                    continue;
-                } else {
-                    std::string delim;
-                    if (tokens[i].type == TokenType::Name && hasWhitespace) {
-                        continue;    // Whitesapce not allowed with barewords
-                    }
-                    // Now finally we can confirm a valid heredoc.
-                    if (tokens[i].type == TokenType::Name) {
-                        delim = tokens[i].data;
-                    } else if (tokens[i].type == TokenType::StringStart) {
-                        if (i + 1 >= tokens.size()) continue;
-                        // Strings have the format StringStart(..) String(..) StringEnd(..)
-                        // But empty strings don't include a String(..)
-                        if (tokens[i + 1].type == TokenType::String) {
-                            delim = tokens[i + 1].data;
-                        } else if (tokens[i + 1].type != TokenType::StringEnd) {
-                            // Something has gone wrong, don't parse as heredoc
-                            continue;
-                        }
-                    }
-                    matchHereDocBody(tokens, delim, hasTilde);
-                    break;
-                }
-            }
+        // Bodies of any heredocs started on this line follow it, in the order they were started
+        int lineEnd = tokens.size() - 1;
+        bool matchedHereDoc = false;
+        for (int hereDocStart : this->pendingHereDocs) {
+            if (hereDocStart < lineStart) continue;
+            // Newline after the previous heredoc's terminator
+            if (matchedHereDoc) matchNewline(tokens);
+            matchedHereDoc = matchHereDoc(tokens, hereDocStart, lineEnd) || matchedHereDoc;
         }
-
+        this->pendingHereDocs.clear();
         return;
     }
 
@@ -1326,9 +1073,8 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
         // Dereference can ONLY be of a scalar as references are always scalars
         if (this->peekAhead(i) == '$') {
             auto pos = this->currentPos();
-            auto sigil = this->peek();
             this->nextChar();
-            tokens.emplace_back(Token(TokenType::Deref, pos, std::string(1, sigil)));
+            tokens.emplace_back(Token(TokenType::Deref, pos, sliceFrom(pos)));
             return;
         }
     }
@@ -1354,37 +1100,22 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
             testChar == 'A' || testChar == 'C') {
             this->nextChar();
             this->nextChar();
-            tokens.emplace_back(Token(TokenType::FileTest, startPos, "-" + std::string(1, testChar)));
+            tokens.emplace_back(Token(TokenType::FileTest, startPos, sliceFrom(startPos)));
             return;
         }
     }
 
-    // Perl has so many operators...
-    // Thankfully we don't actually care what the do, just need to recognise them
-    auto operators = std::vector<std::string>{
-            "+=", "++", "+", "--", "-=", "**=", "*=", "**", "*", "!=", "!~", "!", "~", "\\", "==", "=~",
-            "//=", "=>", "//", "%=", "%", "x=", "x", ">>=", ">>", ">", ">=", "<=>", "<<=", "<<", "<",
-            ">=",
-            "~~", "&=", "&.=", "&&=", "&&", "&", "||=", "|.=", "|=", "||",
-            "~", "^=", "^.=", "^", "...", "..", "?:", ":", ".=", "?"
-    };
-
-    // These operators must be followed by a non alphanumeric
-    auto wordOperators = std::vector<std::string>{
-            "lt", "gt", "le", "ge", "eq", "ne", "cmp", "and", "or", "not", "xor"
-    };
-
-
     if (!isalnum(this->peek())) {
-        std::string op = matchStringOption(operators);
+        auto op = matchStringOption(OPERATORS);
         if (!op.empty()) {
+            if (op == "<<") this->pendingHereDocs.emplace_back(tokens.size());
             tokens.emplace_back(Token(TokenType::Operator, startPos, op));
             return;
         }
     }
 
 
-    std::string op2 = matchStringOption(wordOperators, true);
+    auto op2 = matchStringOption(WORD_OPERATORS, true);
     if (!op2.empty()) {
         tokens.emplace_back(Token(TokenType::Operator, startPos, op2));
         return;
@@ -1395,12 +1126,12 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
 
     if (peek == ';') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::Semicolon, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::Semicolon, startPos, startPos));
         return;
     }
     if (peek == ',') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::Comma, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::Comma, startPos, startPos));
         return;
     }
 
@@ -1452,38 +1183,38 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
         }
 
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::LBracket, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::LBracket, startPos, startPos));
         return;
 
     }
     if (peek == '}') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::RBracket, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::RBracket, startPos, startPos));
         return;
     }
     if (peek == '(') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::LParen, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::LParen, startPos, startPos));
         return;
     }
     if (peek == ')') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::RParen, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::RParen, startPos, startPos));
         return;
     }
     if (peek == '[') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::LSquareBracket, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::LSquareBracket, startPos, startPos));
         return;
     }
     if (peek == ']') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::RSquareBracket, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::RSquareBracket, startPos, startPos));
         return;
     }
     if (peek == '.') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::Dot, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::Dot, startPos, startPos));
         return;
     }
 
@@ -1548,14 +1279,14 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
     auto pod = this->matchPod();
     if (!pod.empty()) {
         // One of the few tokens that can span multiple lines
-        tokens.emplace_back(Token(TokenType::Pod, startPos, FilePos(this->currentLine, this->currentCol - 1), pod));
+        tokens.emplace_back(Token(TokenType::Pod, startPos, FilePos(this->_position), pod));
         return;
     }
 
     // POD takes priority
     if (this->peek() == '=') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::Assignment, startPos, startPos.col));
+        tokens.emplace_back(Token(TokenType::Assignment, startPos, startPos));
         return;
     }
 
@@ -1570,7 +1301,7 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
         } else {
             auto prevTokenType = prevTokenTypeOption.value().type;
             TokenType secondType = TokenType::EndOfInput;
-            std::string secondData = "";
+            std::string_view secondData;
 
             if (prevTokenType == TokenType::Name) {
                 // See if it is a direct dereference (e.g ->name)
@@ -1638,7 +1369,7 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
 
     if (peek == '/' && peekAhead(2) == '=') {
         this->nextChar();
-        tokens.emplace_back(Token(TokenType::Operator, startPos, startPos.col, "/="));
+        tokens.emplace_back(Token(TokenType::Operator, startPos, startPos, "/="));
         return;
     }
 
@@ -1665,7 +1396,7 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
     if (!ident.empty()) {
         // Also use a name here
         auto token = Token(TokenType::Name, startPos, ident);
-        if (this->builtinSubMap.count(ident) != 0) token.type = TokenType::Builtin;
+        if (lexicon::BUILTINS.contains(ident)) token.type = TokenType::Builtin;
         tokens.emplace_back(token);
         return;
 
@@ -1674,7 +1405,7 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
     auto name = this->matchName();
     if (!name.empty()) {
         auto token = Token(TokenType::Name, startPos, name);
-        if (this->builtinSubMap.count(name) != 0) token.type = TokenType::Builtin;
+        if (lexicon::BUILTINS.contains(name)) token.type = TokenType::Builtin;
         tokens.emplace_back(token);
         return;
     }
@@ -1688,16 +1419,169 @@ void Tokeniser::nextTokens(std::vector<Token> &tokens, bool enableHereDoc) {
  */
 std::vector<Token> Tokeniser::tokenise() {
     std::vector<Token> tokens;
-    if (this->program.empty()) return tokens;
+    tokenise(tokens);
+    return tokens;
+}
+
+void Tokeniser::tokenise(std::vector<Token> &tokens) {
+    tokens.clear();
+    if (this->program.empty()) return;
 
     while (tokens.empty() || tokens[tokens.size() - 1].type != TokenType::EndOfInput) {
-        nextTokens(tokens);
+        nextTopLevelTokens(tokens);
+
+        // The lexer only looks back as far as the last non whitespace token and the start of the current line
+        int lastToken = (int) tokens.size() - 1;
+        while (lastToken >= 0 && isWhitespaceNewlineComment(tokens[lastToken].type)) lastToken--;
+        secondPass(tokens, std::min(lastToken, this->lineStart));
+    }
+
+    secondPass(tokens, tokens.size());
+}
+
+void Tokeniser::tokenise(std::vector<Token> &tokens, TriviaTable &trivia) {
+    // The lexer needs the trivia to look back at, so it is only moved out once the whole stream is built
+    tokenise(tokens);
+    trivia.clear();
+    trivia.program = this->program;
+    trivia.before.emplace_back(0);
+
+    int numSignificant = 0;
+    for (const auto &token : tokens) {
+        if (isWhitespaceNewlineComment(token.type)) {
+            trivia.trivia.emplace_back(
+                    Trivia{token.type, token.startPos, (int) token.data.size(), token.isRestartPoint});
+        } else {
+            trivia.before.emplace_back(trivia.trivia.size());
+            tokens[numSignificant++] = token;
+        }
+    }
+
+    tokens.erase(tokens.begin() + numSignificant, tokens.end());
+}
+
+std::vector<Token> Tokeniser::tokenise(const std::vector<Token> &previousTokens, const SourceBuffer &previousSource,
+                                       const TextEdit &edit) {
+    int delta = (int) edit.replacement.size() - edit.length;
+    bool isValidEdit = edit.position >= 0 && edit.length >= 0 &&
+                       edit.position + edit.length <= (int) previousSource.text.size() &&
+                       (int) previousSource.text.size() + delta == (int) this->source->text.size();
+
+    // Token positions don't include a byte order mark, so just start again if there is one
+    if (!isValidEdit || previousTokens.empty() || this->program.empty() ||
+        this->program.size() != this->source->text.size() ||
+        withoutByteOrderMark(previousSource.text).size() != previousSource.text.size()) {
+        return tokenise();
+    }
+
+    // Find last restart point at or before the edit. Nothing lexed before a restart point looked at the text from
+    // there on, so all tokens before it are unchanged
+    int restart = std::partition_point(previousTokens.begin(), previousTokens.end(), [&](const Token &token) {
+        return token.startPos.position < edit.position;
+    }) - previousTokens.begin();
+    if (restart == previousTokens.size()) restart--;
+    while (restart > 0 && !(previousTokens[restart].isRestartPoint &&
+                            previousTokens[restart].startPos.position <= edit.position)) {
+        restart--;
+    }
+
+    std::vector<Token> tokens;
+    tokens.reserve(previousTokens.size() + edit.replacement.size());
+    for (int i = 0; i < restart; i++) {
+        Token token = previousTokens[i];
+        token.type = token.rawType();
+        token.isSecondPassType = false;
+        token.data = rebaseData(token.data, previousSource, edit);
+        tokens.emplace_back(token);
+    }
+
+    auto restartPos = restart == 0 ? FilePos(0) : previousTokens[restart].startPos;
+    this->_position = restartPos.position - 1;
+    this->furthestRead = this->_position;
+    this->lineStart = restart;
+    while (this->lineStart > 0 && tokens[this->lineStart - 1].type != TokenType::Newline) this->lineStart--;
+    for (int i = this->lineStart; i < restart; i++) {
+        if (tokens[i].type == TokenType::Operator && tokens[i].data == "<<") this->pendingHereDocs.emplace_back(i);
     }
 
-    secondPass(tokens);
+    int editEnd = edit.position + (int) edit.replacement.size();
+    int old = restart;
+    while (tokens.empty() || tokens[tokens.size() - 1].type != TokenType::EndOfInput) {
+        int position = this->_position + 1;
+        if (position >= editEnd && this->furthestRead < position && !tokens.empty() &&
+            tokens[tokens.size() - 1].type == TokenType::Newline) {
+            // Past the edit and at a line start, so see if the previous tokens had a restart point here too
+            while (old < previousTokens.size() && previousTokens[old].startPos.position < position - delta) old++;
+            if (old < previousTokens.size() && old > 0 && previousTokens[old].startPos.position == position - delta &&
+                previousTokens[old].isRestartPoint &&
+                previousTokens[old - 1].type == TokenType::Newline) {
+                // Lexer also looks back at the previous non whitespace token, so that must be the same as well
+                int previous = (int) tokens.size() - 1;
+                while (previous >= 0 && isWhitespaceNewlineComment(tokens[previous].type)) previous--;
+                int oldPrevious = old - 1;
+                while (oldPrevious >= 0 && isWhitespaceNewlineComment(previousTokens[oldPrevious].type)) oldPrevious--;
+
+                if ((previous == -1 && oldPrevious == -1) ||
+                    (previous != -1 && oldPrevious != -1 &&
+                     tokens[previous].type == previousTokens[oldPrevious].rawType() &&
+                     tokens[previous].data == previousTokens[oldPrevious].data)) {
+                    // Resynchronised, rest of the tokens just need to be moved
+                    for (int i = old; i < previousTokens.size(); i++) {
+                        Token token = previousTokens[i];
+                        token.type = token.rawType();
+                        token.isSecondPassType = false;
+                        token.data = rebaseData(token.data, previousSource, edit);
+                        if (token.startPos.position != -1) token.startPos.position += delta;
+                        if (token.endPos.position != -1) token.endPos.position += delta;
+                        tokens.emplace_back(token);
+                    }
+                    break;
+                }
+            }
+        }
+
+        nextTopLevelTokens(tokens);
+    }
+
+    secondPass(tokens, tokens.size());
     return tokens;
 }
 
+void Tokeniser::nextTopLevelTokens(std::vector<Token> &tokens) {
+    auto startPos = currentPos();
+    bool canRestart = this->furthestRead < startPos.position;
+    int first = tokens.size();
+    nextTokens(tokens);
+
+    if (canRestart && first < tokens.size() && tokens[first].startPos == startPos &&
+        tokens[first].startPos.position == startPos.position) {
+        tokens[first].isRestartPoint = true;
+    }
+}
+
+/**
+ * Data of a token from previousSource, as a view into this tokeniser's source
+ */
+std::string_view Tokeniser::rebaseData(std::string_view data, const SourceBuffer &previousSource,
+                                       const TextEdit &edit) {
+    if (data.empty()) return data;
+    std::less_equal<const char *> lessEqual;
+    const char *previousText = previousSource.text.data();
+    if (lessEqual(previousText, data.data()) &&
+        lessEqual(data.data() + data.size(), previousText + previousSource.text.size())) {
+        int offset = data.data() - previousText;
+        if (offset >= edit.position + edit.length) offset += (int) edit.replacement.size() - edit.length;
+        return std::string_view(this->source->text).substr(offset, data.size());
+    }
+
+    for (const auto &owned : previousSource.ownedData) {
+        if (data.data() == owned.data()) return this->source->own(owned);
+    }
+
+    // Otherwise a string literal, which lives forever
+    return data;
+}
+
 bool Tokeniser::matchAttribute(std::vector<Token> &tokens) {
     // Read name of attribute
     if (this->peek() == ':') {
@@ -1713,13 +1597,15 @@ bool Tokeniser::matchAttribute(std::vector<Token> &tokens) {
     tokens.emplace_back(Token(TokenType::Attribute, start, attrName));
 
     start = currentPos();
-    std::string arguments;
 
     if (this->peek() == '(') {
         // Attribute has arguments
         this->nextChar();
-        auto args = '(' + matchBracketedStringLiteral('(') + ')';
+        auto contents = matchBracketedStringLiteral('(');
         nextChar();
+        auto args = sliceFrom(start);
+        // Escaped backslashes were collapsed (or there was no closing bracket), so the source text can't be used
+        if (args.size() != contents.size() + 2) args = this->source->own('(' + std::string(contents) + ')');
         tokens.emplace_back(Token(TokenType::AttributeArgs, start, args));
     }
 
@@ -1754,40 +1640,41 @@ bool Tokeniser::matchAttributes(std::vector<Token> &tokens) {
  * given heuristic (isPrototype).
  * @return
  */
-std::string Tokeniser::matchPrototype() {
-    std::string proto;
-    if (peek() != '(') return proto;
-    proto += peek();
+std::string_view Tokeniser::matchPrototype() {
+    auto start = currentPos();
+    if (peek() != '(') return {};
     nextChar();
 
     while (peek() != ')' && peek() != EOF && !isNewline(peek())) {
-        proto += peek();
         nextChar();
     }
 
-    if (peek() == ')') proto += ')';
+    if (peek() == ')') {
+        nextChar();
+        return sliceFrom(start);
+    }
+
+    // Unterminated prototype still consumes the next character, but it isn't part of the prototype
+    auto proto = sliceFrom(start);
     nextChar();
     return proto;
 }
 
-std::string Tokeniser::matchSignature() {
+std::string_view Tokeniser::matchSignature() {
     // Straight forward, just match until ending bracket
-    std::string signature;
-    if (peek() != '(') return signature;
-    signature += peek();
+    auto start = currentPos();
+    if (peek() != '(') return {};
     nextChar();
 
     while (peek() != '}' && peek() != EOF && peek() != ')') {
-        signature += peek();
         nextChar();
     }
 
     if (peek() == ')') {
-        signature += ')';
         nextChar();
     }
 
-    return signature;
+    return sliceFrom(start);
 }
 
 
@@ -1811,7 +1698,7 @@ bool Tokeniser::matchSignatureTokens(std::vector<Token> &tokens) {
         auto trimmedSignature = signature.substr(0, signature.size() - numWhitespace);
         tokens.emplace_back(Token(TokenType::Signature, start, trimmedSignature));
         FilePos whitespaceStart = start;
-        whitespaceStart.col += (int) signature.size() - numWhitespace; // TODO newline?
+        whitespaceStart.position += (int) signature.size() - numWhitespace;
         tokens.emplace_back(Token(TokenType::Whitespace, whitespaceStart, whitespace));
     } else {
         tokens.emplace_back(Token(TokenType::Signature, start, signature));
@@ -1873,41 +1760,6 @@ void Tokeniser::matchSubroutine(std::vector<Token> &tokens) {
     }
 }
 
-/**
- * Second pass to replace *Bracket tokens with HashSub* tokens.
- * This is not too important but if missed then the parser will generate too many scopes (as $x->{...} will get a scope)
- *  This wastes resources, especially in analysis
- * @param tokens
- * @param i
- */
-void Tokeniser::secondPassHash(std::vector<Token> &tokens, int &i) {
-    TokenIterator tokenIterator(tokens, std::vector<TokenType>{TokenType::Whitespace, TokenType::Comment,
-                                                               TokenType::Whitespace}, i);
-    Token token = tokenIterator.next();
-    if (!isVariable(token.type)) return;
-    token = tokenIterator.next();
-    if (token.type != TokenType::LBracket) return;
-    int lBracketOffset = tokenIterator.getIndex() - 1;
-
-    // Expect comma separated list of variable|string|name
-    while (token.type != TokenType::RBracket && token.type != TokenType::EndOfInput) {
-        // Read variable, name or string
-        token = tokenIterator.next();
-        if (token.type != TokenType::Name && token.type != TokenType::String && !isVariable(token.type)) return;
-        token = tokenIterator.next();
-
-        // Now a possible comma
-        if (token.type != TokenType::Comma && token.type != TokenType::RBracket) return;
-    }
-
-    if (token.type != TokenType::RBracket) return;
-
-    // Now just replace brackets
-    tokens[lBracketOffset].type = TokenType::HashSubStart;
-    tokens[tokenIterator.getIndex() - 1].type = TokenType::HashSubEnd;
-    i++;
-}
-
 bool Tokeniser::addWhitespaceToken(std::vector<Token> &tokens) {
     auto start = currentPos();
     auto whitespace = matchWhitespace();
@@ -1915,69 +1767,106 @@ bool Tokeniser::addWhitespaceToken(std::vector<Token> &tokens) {
     return !whitespace.empty();
 }
 
-void Tokeniser::secondPassHashReref(std::vector<Token> &tokens, int &i) {
-    TokenIterator tokenIterator(tokens, std::vector<TokenType>{TokenType::Whitespace, TokenType::Comment,
-                                                               TokenType::Whitespace}, i);
-    Token token = tokenIterator.next();
-    if (!isVariable(token.type)) return;
-    token = tokenIterator.next();
-    if (token.type != TokenType::Operator || token.data != "->") return;
-
-    token = tokenIterator.next();
-    if (token.type != TokenType::LBracket) return;
-    int lBracketOffset = tokenIterator.getIndex() - 1;
-
-    // Keep count of brackets to match
-    int bracketCount = 1;
-    token = tokenIterator.next();
-    int rBracketOffset = tokenIterator.getIndex();
-
-    while (bracketCount > 0 && token.type != TokenType::EndOfInput) {
-        if (token.type == TokenType::LBracket) bracketCount++;
-        if (token.type == TokenType::RBracket) {
-            rBracketOffset = tokenIterator.getIndex() - 1;
-            bracketCount--;
-        }
-        token = tokenIterator.next();
-    }
+/**
+ * Whether tokens between the brackets at lBracket and rBracket are a list of hash keys `{a, $b, c}` (or a single key)
+ * Then the brackets can be replaced with HashSub* tokens.
+ * This is not too important but if missed then the parser will generate too many scopes (as $x{...} will get a scope)
+ *  This wastes resources, especially in analysis
+ */
+static bool isHashKeyList(const std::vector<Token> &tokens, int lBracket, int rBracket) {
+    bool expectKey = true;
+    for (int i = lBracket + 1; i < rBracket; i++) {
+        auto type = tokens[i].type;
+        if (type == TokenType::Whitespace || type == TokenType::Comment) continue;
+        if (expectKey && type != TokenType::Name && type != TokenType::String && !isVariable(type)) return false;
+        if (!expectKey && type != TokenType::Comma) return false;
+        expectKey = !expectKey;
+    }
+
+    // Must end with a key
+    return !expectKey;
+}
 
-    if (bracketCount > 0) return;
-    tokens[lBracketOffset].type = TokenType::HashDerefStart;
-    tokens[rBracketOffset].type = TokenType::HashDerefEnd;
-    i++;
+// Index of the token before i, ignoring whitespace and comments. -1 if there is none
+static int previousIgnoringWhitespaceComment(const std::vector<Token> &tokens, int i) {
+    i--;
+    while (i >= 0 && (tokens[i].type == TokenType::Whitespace || tokens[i].type == TokenType::Comment)) i--;
+    return i;
 }
 
+static void setSecondPassType(Token &token, TokenType type) {
+    token.type = type;
+    token.isSecondPassType = true;
+}
 
 // Second pass to fix any tokenization errors with a little bit of context
 // Note this is fixing errors, not doing any parsing
-void Tokeniser::secondPass(std::vector<Token> &tokens) {
+// Carries on from where the last call finished up to (not including) end, so it can be run as tokens are produced.
+// Only tokens the lexer will never look back at again should be included
+void Tokeniser::secondPass(std::vector<Token> &tokens, int end) {
     if (!doSecondPass) return;
-    for (int i = 0; i < (int) tokens.size() - 1; i++) {
-        if (isVariable(tokens[i].type)) {
-            int prevI = i;
-            secondPassHash(tokens, i);
-            i = prevI;
-            secondPassHashReref(tokens, i);
-        }
-
-        // Go back to previous non-whitespace token
-        // If it is a Name, replace with HashKey
-        // e.g. `key => "Hello"` -> HashKey[key] Op[=>] StringStart(") String(Hello) StringEnd(")
-        if (tokens[i].type == TokenType::Operator && tokens[i].data == "=>") {
+    for (; this->secondPassIndex < end; this->secondPassIndex++) {
+        int i = this->secondPassIndex;
+        auto type = tokens[i].type;
+
+        if (type == TokenType::LBracket) {
+            this->openBrackets.emplace_back(i);
+        } else if (type == TokenType::RBracket && !this->openBrackets.empty()) {
+            int lBracket = this->openBrackets.back();
+            this->openBrackets.pop_back();
+
+            // `$x{a, b}` -> HashSubStart ... HashSubEnd
+            // `$x->{...}` -> HashDerefStart ... HashDerefEnd
+            int previous = previousIgnoringWhitespaceComment(tokens, lBracket);
+            if (previous == -1) continue;
+            if (isVariable(tokens[previous].type)) {
+                if (isHashKeyList(tokens, lBracket, i)) {
+                    setSecondPassType(tokens[lBracket], TokenType::HashSubStart);
+                    setSecondPassType(tokens[i], TokenType::HashSubEnd);
+                }
+            } else if (tokens[previous].type == TokenType::Operator && tokens[previous].data == "->") {
+                int variable = previousIgnoringWhitespaceComment(tokens, previous);
+                if (variable != -1 && isVariable(tokens[variable].type)) {
+                    setSecondPassType(tokens[lBracket], TokenType::HashDerefStart);
+                    setSecondPassType(tokens[i], TokenType::HashDerefEnd);
+                }
+            }
+        } else if (type == TokenType::Operator && tokens[i].data == "=>") {
+            // Go back to previous non-whitespace token
+            // If it is a Name, replace with HashKey
+            // e.g. `key => "Hello"` -> HashKey[key] Op[=>] StringStart(") String(Hello) StringEnd(")
             int counter = i - 1;
             while (counter >= 0 && isWhitespaceNewlineComment(tokens[counter].type)) counter--;
-            if (tokens[counter].type == TokenType::Name) {
-                tokens[counter].type = TokenType::HashKey;
+            if (counter >= 0 && tokens[counter].type == TokenType::Name) {
+                setSecondPassType(tokens[counter], TokenType::HashKey);
             }
         }
     }
 }
 
+TextEdit::TextEdit(int position, int length, std::string replacement) : position(position), length(length),
+                                                                        replacement(std::move(replacement)) {}
+
+TextEdit TextEdit::between(std::string_view previous, std::string_view current) {
+    int prefix = 0;
+    int maxPrefix = std::min(previous.size(), current.size());
+    while (prefix < maxPrefix && previous[prefix] == current[prefix]) prefix++;
+
+    int suffix = 0;
+    int maxSuffix = maxPrefix - prefix;
+    while (suffix < maxSuffix && previous[previous.size() - 1 - suffix] == current[current.size() - 1 - suffix]) {
+        suffix++;
+    }
+
+    return TextEdit(prefix, (int) previous.size() - prefix - suffix,
+                    std::string(current.substr(prefix, current.size() - prefix - suffix)));
+}
+
 std::string Tokeniser::tokenToStrWithCode(Token token) {
     return ::tokenToStrWithCode(token, this->program);
 }
 
-std::string tokenToStrWithCode(Token token, const std::string &program) {
+std::string tokenToStrWithCode(Token token, std::string_view program) {
     std::string code;
     bool success = false;
 
@@ -1993,7 +1882,7 @@ std::string tokenToStrWithCode(Token token, const std::string &program) {
         code = "End position pos exceeds program size";
     } else {
         success = true;
-        code = program.substr(token.startPos.position, (token.endPos.position - token.startPos.position) + 1);
+        code = std::string(program.substr(token.startPos.position, (token.endPos.position - token.startPos.position) + 1));
     }
 
     if (!success) {
@@ -2028,9 +1917,34 @@ bool Tokeniser::isPrototype() {
 }
 
 FilePos Tokeniser::currentPos() {
-    return FilePos(this->currentLine, this->currentCol, this->_position + 1 + this->positionOffset);
+    return FilePos(this->_position + 1 + this->positionOffset);
+}
+
+
+// Pooled tokenisers kept by each thread. Capped so a thread doesn't hold on to more than it's likely to use at once
+static const int POOL_MAX_ITEMS = 4;
+static thread_local std::vector<std::unique_ptr<PooledTokeniser>> pool;
+
+void tokeniserPool::Release::operator()(PooledTokeniser *pooled) const {
+    pooled->tokens.clear();
+    pooled->trivia.clear();
+    if (pool.size() < POOL_MAX_ITEMS) {
+        pool.emplace_back(pooled);
+    } else {
+        delete pooled;
+    }
 }
 
+tokeniserPool::Handle tokeniserPool::acquire(std::string_view program, bool doSecondPass) {
+    if (pool.empty()) {
+        return Handle(new PooledTokeniser{Tokeniser(std::string(program), doSecondPass), {}, {}});
+    }
+
+    Handle pooled(pool.back().release());
+    pool.pop_back();
+    pooled->tokeniser.reset(program, doSecondPass);
+    return pooled;
+}
 
 std::optional<Token> previousNonWhitespaceToken(const std::vector<Token> &tokens) {
     if (tokens.empty()) return std::optional<Token>();
@@ -2042,3 +1956,66 @@ std::optional<Token> previousNonWhitespaceToken(const std::vector<Token> &tokens
     if (isWhitespaceNewlineComment(tokens[i].type)) return std::optional<Token>();
     return std::optional<Token>(tokens[i]);
 }
+
+static bool isDigitOrUnderscore(char c) {
+    return isdigit(c) || c == '_';
+}
+
+bool isNumericLiteral(std::string_view str) {
+    int i = 0;
+    int size = str.size();
+    if (i < size && (str[i] == '+' || str[i] == '-')) i++;
+
+    // A sign on its own (or nothing at all) is accepted
+    if (i == size) return true;
+
+    if (str[i] == '0' && i + 1 < size && (str[i + 1] == 'x' || str[i + 1] == 'b')) {
+        // 0x[0-9a-fA-F]+ or 0b[01]+. Nothing else can follow a leading 0x or 0b
+        bool isHex = str[i + 1] == 'x';
+        i += 2;
+        if (i == size) return false;
+        for (; i < size; i++) {
+            if (isHex ? !isxdigit(str[i]) : (str[i] != '0' && str[i] != '1')) return false;
+        }
+        return true;
+    }
+
+    // (\d+|_)
+    if (isdigit(str[i])) {
+        while (i < size && isdigit(str[i])) i++;
+    } else if (str[i] == '_') {
+        i++;
+    } else {
+        return false;
+    }
+
+    // \.?[\d_]*
+    if (i < size && str[i] == '.') i++;
+    while (i < size && isDigitOrUnderscore(str[i])) i++;
+    if (i == size) return true;
+
+    // (e[+-]?[\d_]+)?
+    if (str[i] != 'e') return false;
+    i++;
+    if (i < size && (str[i] == '+' || str[i] == '-')) i++;
+    if (i == size) return false;
+    while (i < size && isDigitOrUnderscore(str[i])) i++;
+    return i == size;
+}
+
+bool isVersionString(std::string_view str) {
+    int i = 0;
+    int size = str.size();
+    if (i < size && str[i] == 'v') i++;
+
+    // v?\d([_|.]?\d)*
+    if (i == size || !isdigit(str[i])) return false;
+    i++;
+    while (i < size) {
+        if (str[i] == '_' || str[i] == '.' || str[i] == '|') i++;
+        if (i == size || !isdigit(str[i])) return false;
+        i++;
+    }
+
+    return true;
+}
@@ -6,28 +6,75 @@
 #define PERLPARSER_TOKENISER_H
 
 #include <string>
-#include <functional>
+#include <algorithm>
 #include <memory>
 #include <vector>
-#include <regex>
 #include <utility>
 #include <iostream>
 #include <unordered_map>
 #include <optional>
 
 #include "Token.h"
+#include "Scan.h"
 #include "Util.h"
 #include "TokeniseException.h"
 
+/**
+ * Change to a program: the length bytes starting at position are replaced by replacement
+ */
+struct TextEdit {
+    TextEdit(int position, int length, std::string replacement);
+
+    // Smallest single edit that turns previous into current
+    static TextEdit between(std::string_view previous, std::string_view current);
+
+    int position;
+    int length;
+    std::string replacement;
+};
+
 class Tokeniser {
 public:
     Tokeniser(std::string program, bool doSecondPass = true);
 
+    // Start again with a new program, keeping buffers that can be reused
+    void reset(std::string_view program, bool doSecondPass = true);
+
     std::vector<Token> tokenise();
 
+    // Tokenise into tokens, reusing its capacity
+    void tokenise(std::vector<Token> &tokens);
+
+    // Tokenise into tokens without any whitespace, newline or comment tokens, which go into trivia instead. The full
+    // stream is still built (and tokens grows to fit it) before the trivia is moved out, so this saves later passes
+    // from stepping over trivia rather than saving memory
+    void tokenise(std::vector<Token> &tokens, TriviaTable &trivia);
+
+    /**
+     * Tokenise the program given the tokens of the program before an edit was made.
+     *
+     * Lexing restarts from the last restart point before the edit and stops as soon as the lexer is back in the same
+     * state at the same (shifted) position as in previousTokens, the rest are copied over. So the cost depends on the
+     * size of the damaged region rather than the file. Restart points are only ever the start of a top level lexer
+     * step, so are never inside a heredoc body, POD or a multi-line string.
+     *
+     * @param previousTokens Result of tokenising the program before the edit
+     * @param previousSource Source of previousTokens (see getSource())
+     * @param edit Edit that turns previousSource into this tokeniser's program
+     * @return Same tokens as tokenise() would give
+     */
+    std::vector<Token> tokenise(const std::vector<Token> &previousTokens, const SourceBuffer &previousSource,
+                                const TextEdit &edit);
+
     std::string tokenToStrWithCode(Token token);
 
-    std::string matchIdentifier();
+    std::string_view matchIdentifier();
+
+    // Buffer that the data of every token produced by this tokeniser points into
+    std::shared_ptr<SourceBuffer> getSource();
+
+    // Token positions are offsets into the text without any byte order mark, so lines must be found in this too
+    static std::string_view withoutByteOrderMark(std::string_view text);
 
 private:
     char nextChar();
@@ -47,48 +94,48 @@ private:
 
     static bool isPunctuation(char c);
 
-    bool matchKeyword(const std::string &keyword);
+    bool matchKeyword(std::string_view keyword);
 
     static bool isNameBody(char c);
 
-    std::string getWhile(const std::function<bool(char)> &nextCharTest);
+    template<typename CharTest>
+    std::string_view getWhile(CharTest nextCharTest);
 
     // options should be sorted longest to shortest and in preference of match
-    std::string matchStringOption(const std::vector<std::string> &options, bool requireTrailingNonAN = false);
+    template<std::size_t N>
+    std::string_view matchStringOption(const std::string_view (&options)[N], bool requireTrailingNonAN = false);
 
     // Match some perl 'name' - could be a function name, function call, etc... We just don't know yet
-    std::string matchName();
+    std::string_view matchName();
 
-    std::string matchStringLiteral(char delim, bool includeDelim = true);
+    std::string_view matchStringLiteral(char delim, bool includeDelim = true);
 
-    std::string matchBracketedStringLiteral(char bracket);
+    std::string_view matchBracketedStringLiteral(char bracket);
 
     bool matchQuoteLiteral(std::vector<Token> &tokens);
 
     bool matchSimpleString(std::vector<Token> &tokens);
 
-    std::string matchNumeric();
+    std::string_view matchNumeric();
 
-    std::string matchComment();
+    std::string_view matchComment();
 
-    std::string matchPod();
+    std::string_view matchPod();
 
-    std::string matchVariable();
+    std::string_view matchVariable();
 
-    std::string matchWhitespace();
+    std::string_view matchWhitespace();
 
     int peekPackageTokens(int i);
 
-    int nextLine();
+    void advancePosition(int i);
 
-    void advancePositionSameLine(int i);
+    void skipUntil(const scan::StopChars &stopChars);
 
-    void secondPass(std::vector<Token> &tokens);
+    void secondPass(std::vector<Token> &tokens, int end);
 
     void matchSubroutine(std::vector<Token> &tokens);
 
-    void secondPassHash(std::vector<Token> &tokens, int &i);
-
     std::optional<Token> tryMatchKeywords(FilePos startPos);
 
     FilePos currentPos();
@@ -97,41 +144,57 @@ private:
 
     bool matchAttributes(std::vector<Token> &tokens);
 
-    std::string matchPrototype();
+    std::string_view matchPrototype();
 
-    std::string matchSignature();
+    std::string_view matchSignature();
 
     bool matchSignatureTokens(std::vector<Token> &tokens);
 
-    std::string matchStringContainingOnlyLetters(const std::string &letters);
+    std::string_view matchStringContainingOnlyLetters(std::string_view letters);
+
+    // Program text from start up to (not including) the next character to be consumed
+    std::string_view sliceFrom(const FilePos &start);
 
 
     bool isPrototype();
 
     int _position = -1;
-    int currentLine = 1;
-    int currentCol = 1;
-    std::string program;
-    std::unordered_map<std::string, TokenType> keywordMap;
-    std::unordered_map<std::string, int> builtinSubMap;
+    std::shared_ptr<SourceBuffer> source;
+    // View of source text with any byte order mark removed
+    std::string_view program;
     int positionOffset = 0;
     bool doSecondPass = true;
+    // Furthest position looked at so far, including lookahead that was never consumed
+    int furthestRead = -1;
+    // Index of the first token after the last newline
+    int lineStart = 0;
+    // Indexes of << operators that may start a heredoc, its body is matched after the next newline
+    std::vector<int> pendingHereDocs;
+    // Second pass has been run on all tokens before this index
+    int secondPassIndex = 0;
+    // Indexes of LBrackets seen by the second pass that have not been closed yet
+    std::vector<int> openBrackets;
 
     void matchDelimString(std::vector<Token> &tokens);
 
     void nextTokens(std::vector<Token> &tokens, bool enableHereDoc = true);
 
-    void matchHereDocBody(std::vector<Token> &tokens, const std::string &hereDocDelim, bool hasTilde);
+    // nextTokens, marking the first token produced as a restart point when nothing before it read this far
+    void nextTopLevelTokens(std::vector<Token> &tokens);
 
-    void secondPassHashReref(std::vector<Token> &tokens, int &i);
+    std::string_view rebaseData(std::string_view data, const SourceBuffer &previousSource, const TextEdit &edit);
+
+    bool matchHereDoc(std::vector<Token> &tokens, int start, int lineEnd);
+
+    void matchHereDocBody(std::vector<Token> &tokens, std::string_view hereDocDelim, bool hasTilde);
 
     bool matchSlashString(std::vector<Token> &tokens);
 
     bool matchNewline(std::vector<Token> &tokens);
 
-    std::string matchBasicIdentifier(int &i);
+    bool matchBasicIdentifier(int &i);
 
-    std::string doMatchNormalIdentifier(int &i);
+    void doMatchNormalIdentifier(int &i);
 
     void matchDereferenceBrackets(std::vector<Token> &tokens);
 
@@ -139,16 +202,89 @@ private:
 
     bool addNewlineWhitespaceCommentTokens(std::vector<Token> &tokens, bool ignoreComments = false);
 
-    std::string matchQuoteOperator();
+    std::string_view matchQuoteOperator();
 
     void backtrack(FilePos pos);
 
-    std::string matchVersionString();
+    std::string_view matchVersionString();
 };
 
+template<typename CharTest>
+std::string_view Tokeniser::getWhile(CharTest nextCharTest) {
+    auto start = currentPos();
+    while (nextCharTest(this->peek()) && !this->isEof()) {
+        this->nextChar();
+    }
+
+    return sliceFrom(start);
+}
+
+/**
+ * Given a list of possible strings, will try to match that string and consume the input
+ * @param options
+ * @param requireTrailingNonAN - Require a non alpha numeric character to follow the string
+ * @return
+ */
+template<std::size_t N>
+std::string_view Tokeniser::matchStringOption(const std::string_view (&options)[N], bool requireTrailingNonAN) {
+    for (const auto &option : options) {
+        bool match = true;  // Assume match until proven otherwise
+        for (int i = 0; i < (int) option.length() && match; i++) {
+            match = this->peekAhead(i + 1) == option[i];
+        }
+
+        // If requireTrailingNonAN check next char is not alphanumeric
+        // This fixes issues with `sub length() {...}` being translated to NAME(SUB) OP(LE) NAME(GTH) ...
+        if (match && (!requireTrailingNonAN || !isalnum(this->peekAhead((int) option.length() + 1)))) {
+            auto start = currentPos();
+            this->advancePosition(option.length());
+            return sliceFrom(start);
+        }
+    }
+
+    return {};
+}
+
+
+/**
+ * Tokeniser and token buffer that are reused from file to file, see tokeniserPool
+ */
+struct PooledTokeniser {
+    Tokeniser tokeniser;
+    std::vector<Token> tokens;
+    TriviaTable trivia;
+};
+
+/**
+ * Per thread pool of tokenisers, so tokenising many files doesn't construct a tokeniser and grow a new token vector
+ * for every one. Tokens stay valid after the handle has gone as long as their source (getSource()) is kept.
+ */
+namespace tokeniserPool {
+    // Returns the tokeniser to the pool of the thread that releases it
+    struct Release {
+        void operator()(PooledTokeniser *pooled) const;
+    };
+
+    using Handle = std::unique_ptr<PooledTokeniser, Release>;
+
+    // Pooled tokeniser reset to program, or a new one if this thread's pool is empty
+    Handle acquire(std::string_view program, bool doSecondPass = true);
+}
+
 std::optional<Token> previousNonWhitespaceToken(const std::vector<Token> &tokens);
 
-std::string tokenToStrWithCode(Token token, const std::string& program);
+std::string tokenToStrWithCode(Token token, std::string_view program);
+
+/**
+ * Check if str is a numeric literal. Accepts decimals with optional fraction and exponent (underscores allowed),
+ * 0x hex and 0b binary, all with an optional sign.
+ */
+bool isNumericLiteral(std::string_view str);
+
+/**
+ * Check if str is a version string, such as v5.36.0 or 5_001
+ */
+bool isVersionString(std::string_view str);
 
 
 #endif //PERLPARSER_TOKENISER_H
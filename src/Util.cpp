@@ -6,14 +6,7 @@
 
 bool insideRange(FilePos start, FilePos end, FilePos pos) {
     // Note end is inclusive
-    // TODO improve performance here
-    bool correctLine = pos.line >= start.line && pos.line <= end.line;
-    if (!correctLine) return false;
-
-    if (pos.line == start.line) return pos.col >= start.col;
-    if (pos.line == end.line) return pos.col <= end.col;
-
-    return true;
+    return start <= pos && pos <= end;
 }
 
 bool insideRange(Range range, FilePos pos) {
@@ -13,6 +13,10 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include "IOException.h"
 #include "FilePos.h"
 
@@ -48,4 +52,35 @@ std::string directoryOf(std::string path);
 
 std::string toLower(const std::string &str);
 
+/**
+ * Call work(job, worker) for every job from 0 up to jobs, spread over up to threads threads. Each thread takes the next
+ * job that hasn't been started, and worker is the index of the thread running it (so per-thread state can be kept in a
+ * vector). The first exception thrown by a job is rethrown once every thread has finished
+ */
+template<typename Work>
+void parallelFor(int jobs, int threads, const Work &work) {
+    threads = std::max(1, std::min(threads, jobs));
+    std::atomic<int> nextJob{0};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto runJobs = [&](int worker) {
+        for (int job = nextJob++; job < jobs; job = nextJob++) {
+            try {
+                work(job, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int worker = 1; worker < threads; worker++) workers.emplace_back(runJobs, worker);
+    runJobs(0);
+    for (auto &worker : workers) worker.join();
+
+    if (error) std::rethrow_exception(error);
+}
+
 #endif //PERLPARSER_UTIL_H
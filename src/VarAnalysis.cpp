@@ -3,9 +3,10 @@
 //
 
 #include "VarAnalysis.h"
+#include "Lexicon.h"
 
 
-std::optional<GlobalVariable> handleGlobalVariables(const Token &varToken, const std::vector<PackageSpan> &packages) {
+std::optional<GlobalVariable> handleGlobalVariables(const Token &varToken, const PackageIndex &packages) {
     if (!(varToken.type == TokenType::ScalarVariable || varToken.type == TokenType::HashVariable ||
           varToken.type == TokenType::ArrayVariable)) {
         return {};
@@ -13,19 +14,13 @@ std::optional<GlobalVariable> handleGlobalVariables(const Token &varToken, const
 
     // First check if it is a special variable
     // if it is, ignore it
-    if (varToken.type == TokenType::ScalarVariable &&
-        std::find(constant::SPECIAL_SCALARS.begin(), constant::SPECIAL_SCALARS.end(), varToken.data) !=
-        constant::SPECIAL_SCALARS.end()) {
+    if (varToken.type == TokenType::ScalarVariable && lexicon::SPECIAL_SCALARS.contains(varToken.data)) {
         return std::optional<GlobalVariable>();
     }
-    if (varToken.type == TokenType::ArrayVariable &&
-        std::find(constant::SPECIAL_ARRAYS.begin(), constant::SPECIAL_ARRAYS.end(), varToken.data) !=
-        constant::SPECIAL_ARRAYS.end()) {
+    if (varToken.type == TokenType::ArrayVariable && lexicon::SPECIAL_ARRAYS.contains(varToken.data)) {
         return std::optional<GlobalVariable>();
     }
-    if (varToken.type == TokenType::HashVariable &&
-        std::find(constant::SPECIAL_HASHES.begin(), constant::SPECIAL_HASHES.end(), varToken.data) !=
-        constant::SPECIAL_HASHES.end()) {
+    if (varToken.type == TokenType::HashVariable && lexicon::SPECIAL_HASHES.contains(varToken.data)) {
         return std::optional<GlobalVariable>();
     }
 
@@ -44,143 +39,151 @@ std::optional<GlobalVariable> handleGlobalVariables(const Token &varToken, const
         if (isInt) return {};
     }
 
-    auto package = findPackageAtPos(packages, varToken.startPos);
-    auto globalVariable = getFullyQualifiedVariableName(varToken.data, package);
+    auto globalVariable = getFullyQualifiedVariableName(std::string(varToken.data), packages.packageAt(varToken.startPos));
     globalVariable.setLocation(Range(varToken.startPos, varToken.endPos));
     return std::optional<GlobalVariable>(globalVariable);
 }
 
-void doFindDeclaration(const std::shared_ptr<SymbolNode> &symbolNode, const std::string &varName, const FilePos &varPos,
-                       const std::shared_ptr<SymbolNode> &searchUntilInc, std::shared_ptr<Variable> &currentDecl) {
-    for (const auto &variable : symbolNode->variables) {
-        if (variable->name == varName && variable->declaration <= varPos) {
-            currentDecl = variable;
-        }
+LexicalScope::LexicalScope(std::shared_ptr<SymbolNode> symbolNode) : symbolNode(std::move(symbolNode)) {}
+
+void LexicalScope::addVariable(const std::shared_ptr<Variable> &variable) {
+    int index = symbolNode->variables.size();
+    symbolNode->variables.emplace_back(variable);
+    if (declarations == nullptr) declarations = std::make_shared<Declarations>();
+
+    // Names are owned by the variables, which live as long as the symbol node
+    auto latest = declarations->latest.find(variable->name);
+    if (latest == declarations->latest.end()) {
+        declarations->previous.emplace_back(-1);
+        declarations->latest.emplace(variable->name, index);
+    } else {
+        declarations->previous.emplace_back(latest->second);
+        latest->second = index;
     }
+}
 
-    for (const auto &child : symbolNode->children) {
-        if (insideRange(child->startPos, child->endPos, varPos)) {
-            doFindDeclaration(child, varName, varPos, searchUntilInc, currentDecl);
-        }
-        if (child == searchUntilInc) return;
+const std::shared_ptr<Variable> *LexicalScope::findVariable(const std::string &name, const FilePos &pos) const {
+    if (declarations == nullptr) return nullptr;
+    auto latest = declarations->latest.find(name);
+    if (latest == declarations->latest.end()) return nullptr;
+
+    // Usually the latest declaration, unless it's later on in the same tokens as the usage
+    const auto &variables = symbolNode->variables;
+    for (int index = latest->second; index != -1; index = declarations->previous[index]) {
+        if (variables[index]->declaration <= pos) return &variables[index];
     }
-}
 
+    return nullptr;
+}
 
 std::shared_ptr<Variable>
-findDeclaration(const std::shared_ptr<SymbolNode> &symbolTree, const std::shared_ptr<SymbolNode> &searchUntilInc,
-                const std::string &varName, const FilePos &varPos) {
-    std::shared_ptr<Variable> currentDecl = nullptr;
-    doFindDeclaration(symbolTree, varName, varPos, searchUntilInc, currentDecl);
-    return currentDecl;
-}
+findDeclaration(const std::vector<LexicalScope> &scopes, const std::string &varName, const FilePos &varPos) {
+    // Every scope below the file contains the one after it, so only those up to the first the variable is outside of
+    // are visible
+    int innermost = 1;
+    while (innermost < (int) scopes.size()) {
+        const auto &symbolNode = scopes[innermost].symbolNode;
+        if (!insideRange(symbolNode->startPos, symbolNode->endPos, varPos)) break;
+        innermost++;
+    }
 
+    // Declarations in deeper scopes hide those above them
+    for (int level = innermost - 1; level >= 0; level--) {
+        if (auto variable = scopes[level].findVariable(varName, varPos)) return *variable;
+    }
 
-/**
- * Scan tree to find variable declarations
- *
- * @param symbolNode - The tree containing the variable declarations for this scope
- * @param usages - The output map containing the usage of each variable. Maps each variable to list of positions where
- * is it used
- */
-void
-doFindVariableUsages(FileSymbols &fileSymbols, const std::shared_ptr<SymbolNode> &symbolNode,
-                     std::unordered_map<std::shared_ptr<Variable>, std::vector<Range>> &usages) {
-    for (auto &child : symbolNode->blockNode->children) {
-        // BlockNode, don't bother will be considered when we consider children of current child node
-        std::shared_ptr<TokensNode> tokensNode = std::dynamic_pointer_cast<TokensNode>(child);
-        if (tokensNode == nullptr) continue;
-
-        TokenIterator tokenIterator(tokensNode->tokens,
-                                    std::vector<TokenType>{TokenType::Newline, TokenType::Whitespace,
-                                                           TokenType::Comment});
-        Token token = tokenIterator.next();
-        while (token.type != TokenType::EndOfInput) {
-            if (token.type == TokenType::ScalarVariable || token.type == TokenType::HashVariable ||
-                token.type == TokenType::ArrayVariable) {
-                // First find declaration
-                // Need to consider context of variable to determine what it's declaration looks like
-                // e.g. $test refers to a scalar defined like my $test = ..., where as $test[0] refers to my @test = ...
-                std::string canonicalName = token.data;
-                Token accessor = tokenIterator.next();
-                if (token.type == TokenType::ScalarVariable && accessor.type == TokenType::LSquareBracket) {
-                    // Array access
-                    canonicalName = "@" + token.data.substr(1, token.data.size() - 1);
-                } else if (token.type == TokenType::ScalarVariable && accessor.type == TokenType::HashDerefStart) {
-                    canonicalName = "%" + token.data.substr(1, token.data.size() - 1);
-                }
+    return nullptr;
+}
 
-                std::shared_ptr<Variable> declaration = findDeclaration(fileSymbols.symbolTree, symbolNode,
-                                                                        canonicalName,
-                                                                        token.startPos);
-                if (declaration == nullptr) {
-                    // If there is no previous declaration then treat the variable as a global
-                    auto globalOptional = handleGlobalVariables(token, fileSymbols.packages);
-                    if (globalOptional.has_value()) {
-                        GlobalVariable global = globalOptional.value();
-                        // IMPORTANT: hash for GlobalVariable DOES NOT take into account the global position
-                        if (fileSymbols.globals.count(global) == 0) {
-                            fileSymbols.globals[global] = std::vector<GlobalVariable>{};
-                        }
-
-                        fileSymbols.globals[global].emplace_back(global);
-                    }
-                } else {
-                    if (usages.count(declaration) == 0) usages[declaration] = std::vector<Range>();
-                    usages[declaration].emplace_back(Range(token.startPos, token.endPos));
-                }
+void findScopeUsages(const ParseTree &tree, int tokensNode, const std::vector<LexicalScope> &scopes,
+                     std::vector<SymbolUsage> &usages) {
+    TokenIterator tokenIterator = tree.tokenIterator(tokensNode, TRIVIA_TOKENS);
+    const Token *token = &tokenIterator.next();
+    while (token->type != TokenType::EndOfInput) {
+        if (token->type == TokenType::ScalarVariable || token->type == TokenType::HashVariable ||
+            token->type == TokenType::ArrayVariable) {
+            // First find declaration
+            // Need to consider context of variable to determine what it's declaration looks like
+            // e.g. $test refers to a scalar defined like my $test = ..., where as $test[0] refers to my @test = ...
+            std::string canonicalName(token->data);
+            const Token &accessor = tokenIterator.next();
+            if (token->type == TokenType::ScalarVariable && accessor.type == TokenType::LSquareBracket) {
+                // Array access
+                canonicalName[0] = '@';
+            } else if (token->type == TokenType::ScalarVariable && accessor.type == TokenType::HashDerefStart) {
+                canonicalName[0] = '%';
+            }
 
-            } else if (token.type == TokenType::Name) {
-                Token nameToken = token;
-                auto peek = tokenIterator.peek();
-                if (peek.type == TokenType::Operator && peek.data == "->") {
+            // No declaration means it's a global, which is worked out along with the subroutines
+            usages.emplace_back(SymbolUsage{*token, "", findDeclaration(scopes, canonicalName, token->startPos)});
+        } else if (token->type == TokenType::Name) {
+            Token nameToken = *token;
+            std::string name(token->data);
+            const Token &peek = tokenIterator.peek();
+            if (peek.type == TokenType::Operator && peek.data == "->") {
+                tokenIterator.next();
+                const Token &peekName = tokenIterator.peek();
+                if (peekName.type == TokenType::Name) {
                     tokenIterator.next();
-                    auto peekName = tokenIterator.peek();
-                    if (peekName.type == TokenType::Name) {
-                        tokenIterator.next();
-                        // We have Name -> Name
-                        // Combine into single token
-                        nameToken.endPos = peekName.endPos;
-                        nameToken.data = nameToken.data + "::" + peekName.data;
-                    }
-                }
-                // Try to resolve to subroutine declaration
-                auto currPackage = findPackageAtPos(fileSymbols.packages, nameToken.startPos);
-                auto canonicalSubName = getCanonicalPackageName(nameToken.data);
-                PackagedSymbol subSymbol = splitOnPackage(canonicalSubName, currPackage);
-
-                // Now resolve
-                auto key = subSymbol.package + "::" + subSymbol.symbol;
-                if (fileSymbols.subroutineDeclarations.count(key) > 0) {
-                    auto decl = fileSymbols.subroutineDeclarations[key];
-                    if (fileSymbols.fileSubroutineUsages.count(*decl) == 0) {
-                        fileSymbols.fileSubroutineUsages[*decl] = std::vector<SubroutineCode>();
-                    }
-                    fileSymbols.fileSubroutineUsages[*decl].emplace_back(
-                            SubroutineCode(Range(nameToken.startPos, nameToken.endPos), nameToken.data));
-
-                } else {
-                    // For further processing later on
-                    auto subUsage = SubroutineUsage(subSymbol.package, subSymbol.symbol, nameToken.data,
-                                                    Range(nameToken.startPos, nameToken.endPos));
-                    fileSymbols.possibleSubroutineUsages.emplace_back(subUsage);
+                    // We have Name -> Name
+                    // Combine into single token
+                    nameToken.endPos = peekName.endPos;
+                    name += "::";
+                    name += peekName.data;
                 }
             }
-            token = tokenIterator.next();
+
+            usages.emplace_back(SymbolUsage{nameToken, name, nullptr});
         }
+        token = &tokenIterator.next();
     }
+}
 
+static void addGlobalUsage(FileSymbols &usageSymbols, const PackageIndex &packages, const Token &token) {
+    auto globalOptional = handleGlobalVariables(token, packages);
+    if (!globalOptional.has_value()) return;
 
-    for (auto &symbolChild : symbolNode->children) {
-        doFindVariableUsages(fileSymbols, symbolChild, usages);
-    }
+    const GlobalVariable &global = globalOptional.value();
+    // IMPORTANT: hash for GlobalVariable DOES NOT take into account the global position
+    usageSymbols.globals[global].emplace_back(global);
+}
 
+static void addSubroutineUsage(const FileSymbols &fileSymbols, FileSymbols &usageSymbols,
+                               const PackageIndex &packages, const Token &nameToken, const std::string &name) {
+    // Try to resolve to subroutine declaration
+    const auto &currPackage = packages.packageAt(nameToken.startPos);
+    auto canonicalSubName = getCanonicalPackageName(name);
+    PackagedSymbol subSymbol = splitOnPackage(canonicalSubName, currPackage);
+
+    // Now resolve
+    auto key = subSymbol.package + "::" + subSymbol.symbol;
+    auto decl = fileSymbols.subroutineDeclarations.find(key);
+    if (decl != fileSymbols.subroutineDeclarations.end()) {
+        usageSymbols.fileSubroutineUsages[*decl->second].emplace_back(
+                SubroutineCode(Range(nameToken.startPos, nameToken.endPos), name));
+
+    } else {
+        // For further processing later on
+        auto subUsage = SubroutineUsage(subSymbol.package, subSymbol.symbol, name,
+                                        Range(nameToken.startPos, nameToken.endPos));
+        usageSymbols.possibleSubroutineUsages.emplace_back(subUsage);
+    }
 }
 
-void buildVariableSymbolTree(const std::shared_ptr<BlockNode> &tree, FileSymbols &fileSymbols) {
-    std::unordered_map<std::shared_ptr<Variable>, std::vector<Range>> usages;
-    doFindVariableUsages(fileSymbols, fileSymbols.symbolTree, usages);
-    fileSymbols.variableUsages = usages;
+void addSymbolUsages(const FileSymbols &fileSymbols, FileSymbols &usageSymbols, const PackageIndex &packages,
+                     const std::vector<std::vector<SymbolUsage>> &scopeUsages) {
+    for (const auto &scope : scopeUsages) {
+        for (const auto &usage : scope) {
+            if (usage.token.type == TokenType::Name) {
+                addSubroutineUsage(fileSymbols, usageSymbols, packages, usage.token, usage.name);
+            } else if (usage.declaration == nullptr) {
+                addGlobalUsage(usageSymbols, packages, usage.token);
+            } else {
+                usageSymbols.variableUsages[usage.declaration].emplace_back(
+                        Range(usage.token.startPos, usage.token.endPos));
+            }
+        }
+    }
 }
 
 void doPrintSymbolTree(const std::shared_ptr<SymbolNode> &node, int level) {
@@ -227,32 +230,57 @@ void printFileSymbols(FileSymbols &fileSymbols) {
 }
 
 
-void doGetSymbolMap(const std::shared_ptr<SymbolNode> &symbolTree, const FilePos &pos, SymbolMap &symbolMap) {
-    for (const auto &variable : symbolTree->variables) {
-        symbolMap[variable->name] = variable;
-    }
-
-    for (const auto &child : symbolTree->children) {
-        if (insideRange(child->startPos, child->endPos, pos)) {
-            doGetSymbolMap(child, pos, symbolMap);
+std::vector<std::shared_ptr<Variable>> getVisibleVariables(const FileSymbols &fileSymbols, const FilePos &pos) {
+    std::vector<std::shared_ptr<Variable>> visible;
+    if (fileSymbols.symbolTree == nullptr) return visible;
+
+    // Each scope has its variables sorted already, so merge them from the innermost scope out. A name already visible
+    // shadows the same name further out
+    std::vector<std::shared_ptr<Variable>> merged;
+    for (auto scope = fileSymbols.symbolTree->innermostScope(pos); scope != nullptr; scope = scope->parent) {
+        const auto &outer = scope->scopeVariables;
+        if (outer.empty()) continue;
+
+        merged.clear();
+        merged.reserve(visible.size() + outer.size());
+        auto inner = visible.begin();
+        auto it = outer.begin();
+        while (inner != visible.end() || it != outer.end()) {
+            if (it == outer.end() || (inner != visible.end() && (*inner)->name <= (*it)->name)) {
+                if (it != outer.end() && (*inner)->name == (*it)->name) it++;
+                merged.emplace_back(*inner++);
+            } else {
+                merged.emplace_back(*it++);
+            }
         }
+        visible.swap(merged);
     }
+
+    return visible;
 }
 
-SymbolMap getSymbolMap(const FileSymbols &fileSymbols, const FilePos &pos) {
-    SymbolMap symbolMap;
-    doGetSymbolMap(fileSymbols.symbolTree, pos, symbolMap);
-    return symbolMap;
+std::shared_ptr<Variable> findVisibleVariable(const std::vector<std::shared_ptr<Variable>> &visible,
+                                              const std::string &name) {
+    auto it = std::lower_bound(visible.begin(), visible.end(), name,
+                               [](const std::shared_ptr<Variable> &variable, const std::string &name) {
+                                   return variable->name < name;
+                               });
+    if (it != visible.end() && (*it)->name == name) return *it;
+    return nullptr;
 }
 
-std::string variableForCompletion(std::string variable, char sigilContext) {
+std::string variableForCompletion(const std::string &variable, char sigilContext) {
     if (variable.empty()) return "";
     if (variable[0] == sigilContext) return variable;
-    std::string variableWithoutSigil = variable.substr(1, variable.size() - 1);
-    if (variable[0] == '@' && sigilContext == '$') return "$" + variableWithoutSigil;
-    if (variable[0] == '%' && sigilContext == '$') return "$" + variableWithoutSigil;
-    if (variable[0] == '%' && sigilContext == '@') return "@" + variableWithoutSigil;
-    return "";
+
+    bool convertible = (variable[0] == '@' && sigilContext == '$')
+                       || (variable[0] == '%' && sigilContext == '$')
+                       || (variable[0] == '%' && sigilContext == '@');
+    if (!convertible) return "";
+
+    std::string completion = variable;
+    completion[0] = sigilContext;
+    return completion;
 }
 
 
@@ -290,7 +318,7 @@ std::string getCanonicalVariableName(std::string variableName) {
  * @param packageVariableName Variable as it appears in the code
  * @param packageContext Package that the variable was found in
  */
-GlobalVariable getFullyQualifiedVariableName(const std::string &packageVariableName, std::string packageContext) {
+GlobalVariable getFullyQualifiedVariableName(const std::string &packageVariableName, const std::string &packageContext) {
     if (packageVariableName.empty()) {
         return GlobalVariable("", "", "", "");
     }
@@ -26,22 +26,79 @@ struct VariableDeclarationWithUsages {
     std::vector<Range> usages;
 };
 
-void buildVariableSymbolTree(const std::shared_ptr<BlockNode> &tree, FileSymbols &fileSymbols);
+// Variable or name found in a scope. Names are left to be resolved once every subroutine in the file is known
+struct SymbolUsage {
+    // Name tokens are extended to cover `Name -> Name`
+    Token token;
+    std::string name;
+
+    // Nullptr for globals and names
+    std::shared_ptr<Variable> declaration;
+};
+
+// Scope being analysed, with the variables declared in it so far indexed by name. Copies share the same symbol node and
+// index, so a finished scope can be copied into the scope stacks of several threads for reading
+class LexicalScope {
+public:
+    explicit LexicalScope(std::shared_ptr<SymbolNode> symbolNode);
+
+    std::shared_ptr<SymbolNode> symbolNode;
+
+    // Add variable to the symbol node. Variables must be added in the order they are declared
+    void addVariable(const std::shared_ptr<Variable> &variable);
+
+    // Last variable with the name declared at or before pos, nullptr if there isn't one
+    const std::shared_ptr<Variable> *findVariable(const std::string &name, const FilePos &pos) const;
+
+private:
+    struct Declarations {
+        // Index into the symbol node's variables of the last declaration of each name
+        std::unordered_map<std::string_view, int> latest;
+
+        // For each variable, index of the declaration of the same name before it or -1
+        std::vector<int> previous;
+    };
+
+    // Only made once a variable is declared, as most scopes have none
+    std::shared_ptr<Declarations> declarations;
+};
+
+/**
+ * Find the variables and names used in a tokens node, resolving variables against the scopes it is nested in
+ *
+ * @param scopes - Scopes from the whole file down to the one containing the tokens node. Only declarations made before
+ * the end of the tokens node need to be in them
+ */
+void findScopeUsages(const ParseTree &tree, int tokensNode, const std::vector<LexicalScope> &scopes,
+                     std::vector<SymbolUsage> &usages);
+
+/**
+ * Add usages found in each scope to usageSymbols, with scopes in the same order as the symbol tree
+ *
+ * @param fileSymbols - Subroutine names are resolved against the declarations in here. Can be usageSymbols itself, or
+ * be shared by threads each adding the usages of a different part of the file
+ */
+void addSymbolUsages(const FileSymbols &fileSymbols, FileSymbols &usageSymbols, const PackageIndex &packages,
+                     const std::vector<std::vector<SymbolUsage>> &scopeUsages);
 
 
 void printSymbolTree(const std::shared_ptr<SymbolNode> &node);
 
 void printFileSymbols(FileSymbols &fileSymbols);
 
-typedef std::unordered_map<std::string, std::shared_ptr<Variable>> SymbolMap;
+// Lexical variables visible at pos, sorted by name. Where a name is declared more than once the innermost, latest
+// declaration wins
+std::vector<std::shared_ptr<Variable>> getVisibleVariables(const FileSymbols &fileSymbols, const FilePos &pos);
 
-SymbolMap getSymbolMap(const FileSymbols &fileSymbols, const FilePos &pos);
+// Binary search the result of getVisibleVariables for a name (with sigil)
+std::shared_ptr<Variable> findVisibleVariable(const std::vector<std::shared_ptr<Variable>> &visible,
+                                              const std::string &name);
 
-std::string variableForCompletion(std::string variable, char sigilContext);
+std::string variableForCompletion(const std::string &variable, char sigilContext);
 
 std::string getCanonicalVariableName(std::string variableName);
 
-GlobalVariable getFullyQualifiedVariableName(const std::string &packageVariableName, std::string packageContext);
+GlobalVariable getFullyQualifiedVariableName(const std::string &packageVariableName, const std::string &packageContext);
 
 std::vector<Range> findLocalVariableUsages(FileSymbols &fileSymbols, FilePos location);
 
@@ -1,10 +1,12 @@
 #include <iostream>
 #include <chrono>
 #include "Tokeniser.h"
+#include "LineIndex.h"
 #include "Parser.h"
 #include "VarAnalysis.h"
 #include "IOException.h"
 #include "Test.h"
+#include "Benchmark.h"
 #include "PerlServer.h"
 #include "SymbolLoader.h"
 
@@ -24,10 +26,10 @@ void printFileTokens(const std::string &file, bool includeLocation) {
     }
 }
 
-// Bad symbol node = symbol node with end pos = 0:0
+// Bad symbol node = symbol node with no end position
 // Indicates parser has consumed entire file
 std::shared_ptr<SymbolNode> findBadSymbolNode(std::shared_ptr<SymbolNode> node) {
-    if (node->endPos.line == 0) return node;
+    if (node->endPos.position == -1) return node;
     for (auto child : node->children) {
         auto res = findBadSymbolNode(child);
         if (res != nullptr) return res;
@@ -63,7 +65,9 @@ FileSymbols analysisWithTime(const std::string &path, TimeInfo &timing, bool pri
     FileSymbols fileSymbols;
 
     auto begin = std::chrono::steady_clock::now();
-    auto tokens = tokeniser.tokenise();
+    std::vector<Token> tokens;
+    TriviaTable trivia;
+    tokeniser.tokenise(tokens, trivia);
     auto end = std::chrono::steady_clock::now();
     timing.tokenise = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
 
@@ -75,9 +79,7 @@ FileSymbols analysisWithTime(const std::string &path, TimeInfo &timing, bool pri
     timing.parse = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
 
     begin = std::chrono::steady_clock::now();
-    fileSymbols.packages = parsePackages(parseTree);
-    parseFirstPass(parseTree, fileSymbols);
-    buildVariableSymbolTree(parseTree, fileSymbols);
+    parseFileSymbols(parseTree, fileSymbols);
     end = std::chrono::steady_clock::now();
     timing.analysis = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
     auto totalEnd = std::chrono::steady_clock::now();
@@ -106,12 +108,13 @@ int timeParse(const std::string &path, int num = 1) {
         Tokeniser tokeniser(contents);
         FileSymbols fileSymbols;
 
-        auto tokens = tokeniser.tokenise();
+        std::vector<Token> tokens;
+        TriviaTable trivia;
+        tokeniser.tokenise(tokens, trivia);
         int partiallyParsed = -1;
         auto parseTree = buildParseTree(tokens, partiallyParsed);
         fileSymbols.partialParse = partiallyParsed;
-        fileSymbols.packages = parsePackages(parseTree);
-        parseFirstPass(parseTree, fileSymbols);
+        parseFileSymbols(parseTree, fileSymbols);
     }
 
     auto totalEnd = std::chrono::steady_clock::now();
@@ -134,8 +137,9 @@ void testFiles() {
         }
 
         if (fileSymbols.partialParse > -1) {
+            LineIndex lines(Tokeniser::withoutByteOrderMark(readFile(file)));
             std::cout << std::endl << console::bold << console::red << "Partial parse detected at line"
-                      << fileSymbols.partialParse
+                      << lines.lineCol(FilePos(fileSymbols.partialParse)).line
                       << console::clear << std::endl;
             return;
         }
@@ -150,11 +154,11 @@ void debugPrint(const std::string &path) {
 //    return;
     printFileSymbols(fileSymbols);
 
+    LineIndex lines(Tokeniser::withoutByteOrderMark(readFile(path)));
     std::cout << console::bold << std::endl << "Variables at position" << console::clear << std::endl;
-    auto pos = FilePos(30, 1);
-    auto map = getSymbolMap(fileSymbols, pos);
-    for (const auto &varItem : map) {
-        std::cout << varItem.second->toStr() << std::endl;
+    auto pos = lines.filePos(30, 1);
+    for (const auto &variable : getVisibleVariables(fileSymbols, pos)) {
+        std::cout << variable->toStr() << std::endl;
     }
 
     std::cout << console::bold << std::endl << "Variable usages" << console::clear << std::endl;
@@ -207,7 +211,7 @@ void debugPrint(const std::string &path) {
 
     if (fileSymbols.partialParse > -1) {
         std::cout << std::endl << console::bold << console::red << "Partial parse detected at line"
-                  << fileSymbols.partialParse
+                  << lines.lineCol(FilePos(fileSymbols.partialParse)).line
                   << console::clear << std::endl;
     }
 
@@ -236,7 +240,7 @@ void buildSymbolsTest() {
 int main(int argc, char **args) {
     std::string file = "../perl/input.pl";
 //    Cache cache;
-//    analysis::renameSymbol(file, FilePos(39, 10, 99), "main::NewSubroutineName", std::vector<std::string>{}, cache);
+//    analysis::renameSymbol(file, FilePos(99), "main::NewSubroutineName", std::vector<std::string>{}, cache);
 //    return 0;
 
     std::string arg1 = argc >= 2 ? std::string(args[1]) : "";
@@ -264,6 +268,12 @@ int main(int argc, char **args) {
         return 0;
     }
 
+    if (argc >= 3 && strncmp(args[1], "bench", 5) == 0) {
+        std::vector<std::string> benchArgs(args + 3, args + argc);
+        if (!runBenchmark(args[2], benchArgs)) std::cerr << "No benchmark named " << args[2] << std::endl;
+        return 0;
+    }
+
     if (argc == 2 && strncmp(args[1], "serve", 6) == 0) {
         std::cout << "Started server on 1234" << std::endl;
         startAndBlock(1234);
@@ -26,3 +26,13 @@ print <<`EOL`;
     XHello World!
     Y qw {
 EOL
+
+print <<FIRST, <<"SECOND";
+first body
+FIRST
+second body
+SECOND
+
+print <<END_OF_A_LONG_DELIMITER;
+longer than fits in a short string
+END_OF_A_LONG_DELIMITER